@@ -6,7 +6,20 @@ set(UAVOBJ_BIN "${OPENPILOT_DIR}/build/uavobjgenerator/uavobjgenerator")
 set(UAVOBJ_XML_DIR "${OPENPILOT_DIR}/shared/uavobjectdefinition")
 set(UAVOBJ_TEMPLATE_DIR "${CMAKE_CURRENT_SOURCE_DIR}")
 set(UAVOBJ_DEPEND "uavobjgenerator")
+set(UAVOBJ_POSTGEN "${CMAKE_CURRENT_SOURCE_DIR}/genuavobj.py")
+set(UAVOBJ_SUBSET "" CACHE STRING "Objects to generate: list of names or manifest file, one name per line (empty - all)")
 
+# Objects used by the gateway itself, kept in any subset
+set(UAVOBJ_REQUIRED
+	GCSTelemetryStats
+	FlightTelemetryStats
+	SystemStats
+	ObjectPersistence
+	OPLinkSettings
+	)
+
+
+find_package(PythonInterp REQUIRED)
 
 get_filename_component(OPENPILOT_DIR ${OPENPILOT_DIR} REALPATH)
 if(NOT EXISTS "${OPENPILOT_DIR}/Makefile")
@@ -26,22 +39,54 @@ endif()
 set(UAVOBJ_SYNTETICS_DIR "rosuavobject")
 
 file(GLOB UAVOBJ_DEFINITIONS "${UAVOBJ_XML_DIR}/*.xml")
+
+if(UAVOBJ_SUBSET)
+	if(EXISTS "${UAVOBJ_SUBSET}")
+		file(STRINGS "${UAVOBJ_SUBSET}" UAVOBJ_SUBSET_NAMES REGEX "^[ \t]*[A-Za-z]")
+	else()
+		set(UAVOBJ_SUBSET_NAMES ${UAVOBJ_SUBSET})
+	endif()
+
+	# definition files are named by lower case object name
+	set(UAVOBJ_DEFINITIONS "")
+	foreach(name ${UAVOBJ_SUBSET_NAMES} ${UAVOBJ_REQUIRED})
+		string(STRIP "${name}" name)
+		string(TOLOWER "${name}" name)
+		if(NOT EXISTS "${UAVOBJ_XML_DIR}/${name}.xml")
+			message(FATAL_ERROR "UAVObject definition not found: ${name}")
+		endif()
+		list(APPEND UAVOBJ_DEFINITIONS "${UAVOBJ_XML_DIR}/${name}.xml")
+	endforeach(name)
+	list(REMOVE_DUPLICATES UAVOBJ_DEFINITIONS)
+
+	# generator reads a whole directory, so selected files are copied
+	set(UAVOBJ_XML_DIR "${CMAKE_CURRENT_BINARY_DIR}/uavobjectdefinition")
+	file(REMOVE_RECURSE "${UAVOBJ_XML_DIR}")
+	file(COPY ${UAVOBJ_DEFINITIONS} DESTINATION "${UAVOBJ_XML_DIR}")
+
+	list(LENGTH UAVOBJ_DEFINITIONS count)
+	message(STATUS "UAVObject subset: ${count} objects")
+endif()
 foreach(fl ${UAVOBJ_DEFINITIONS})
 	get_filename_component(basename ${fl} NAME_WE)
 	list(APPEND UAVOBJ_SYNTETICS_SOURCES "${UAVOBJ_SYNTETICS_DIR}/${basename}.cpp")
 endforeach(fl)
 
 list(APPEND UAVOBJ_SYNTETICS_SOURCES "${UAVOBJ_SYNTETICS_DIR}/uavobjectsinit.cpp")
+set(UAVOBJ_SYNTETICS_HEADERS "${UAVOBJ_SYNTETICS_DIR}/uavobjectsvisit.h")
 
 #foreach(f ${UAVOBJ_SYNTETICS_SOURCES})
 #	message(${f})
 #endforeach(f)
 
+# uavobjgenerator fills the tags it knows, genuavobj.py the rest
+# (field codec, views, descriptors, lazy registration, uavobjectsvisit.h)
 add_custom_command(
-	OUTPUT  ${UAVOBJ_SYNTETICS_SOURCES}
+	OUTPUT  ${UAVOBJ_SYNTETICS_SOURCES} ${UAVOBJ_SYNTETICS_HEADERS}
 	COMMAND ${UAVOBJ_BIN} -rosgw ${UAVOBJ_XML_DIR} ${UAVOBJ_TEMPLATE_DIR}
+	COMMAND ${PYTHON_EXECUTABLE} ${UAVOBJ_POSTGEN} ${UAVOBJ_XML_DIR} ${UAVOBJ_TEMPLATE_DIR}/src/uavobjects ${UAVOBJ_SYNTETICS_DIR}
 	COMMENT "Generating UAVObjects"
-	DEPENDS ${UAVOBJ_DEPEND}
+	DEPENDS ${UAVOBJ_DEPEND} ${UAVOBJ_POSTGEN}
 	)
 
 add_custom_target(uavobjgenerator
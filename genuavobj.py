@@ -0,0 +1,267 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# @file       genuavobj.py
+# @author     Vladimir Ermakov, Copyright (C) 2013.
+# @brief      Second pass of UAVObject generation
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+"""Fill template tags unknown to uavobjgenerator -rosgw.
+
+uavobjgenerator (vooon/OpenPilot, uavobjgen-ros branch) replaces only the
+tags it knows and leaves the rest of the templates as is. This script runs
+after it (see genuavobj.cmake) and replaces in the generated files:
+
+  <name>.h, <name>.cpp   $(NUMBYTES) $(VIEWFIELDS) $(PACKFIELDS) $(UNPACKFIELDS)
+                         $(NATIVELAYOUT) $(FIELDDESCRIPTORS)
+  uavobjectsinit.cpp     $(OBJREGTYPE)
+
+and makes uavobjectsvisit.h from its template ($(OBJINC), $(OBJVISIT)).
+
+Field types, element counts, units and enum options are read from the XML
+definitions. Field order is taken from the generated DataFields struct,
+so the wire layout is the one chosen by uavobjgenerator.
+
+usage: genuavobj.py XML_DIR TEMPLATE_DIR OUTPUT_DIR
+"""
+
+from __future__ import print_function, unicode_literals
+
+import io
+import os
+import re
+import sys
+import xml.etree.ElementTree as ET
+
+# XML type -> C type, size, UAVObjectField::Type
+TYPES = {
+    'int8':   ('int8_t',   1, 'TYPE_INT8'),
+    'int16':  ('int16_t',  2, 'TYPE_INT16'),
+    'int32':  ('int32_t',  4, 'TYPE_INT32'),
+    'uint8':  ('uint8_t',  1, 'TYPE_UINT8'),
+    'uint16': ('uint16_t', 2, 'TYPE_UINT16'),
+    'uint32': ('uint32_t', 4, 'TYPE_UINT32'),
+    'float':  ('float',    4, 'TYPE_FLOAT32'),
+    'enum':   ('uint8_t',  1, 'TYPE_ENUM'),
+}
+
+class Field(object):
+    def __init__(self, name, ftype, elements, units, options):
+        self.name = name
+        self.type = ftype
+        self.elements = elements
+        self.units = units
+        self.options = options
+
+
+class UAVObject(object):
+    def __init__(self, name, fields):
+        self.name = name
+        self.fields = fields     # by name, order is taken from DataFields
+
+
+def die(msg):
+    print('genuavobj.py: error: ' + msg, file=sys.stderr)
+    sys.exit(1)
+
+
+def split_list(text):
+    return [s.strip() for s in text.split(',') if s.strip()]
+
+
+def child_list(elem, tag, subtag):
+    node = elem.find(tag)
+    if node is None:
+        return None
+    return [(e.text or '').strip() for e in node.findall(subtag)]
+
+
+def parse_field(elem, known):
+    """Field attributes as uavobjgenerator reads them, cloneof copies another field"""
+    name = elem.get('name')
+    clone = elem.get('cloneof')
+    if clone:
+        if clone not in known:
+            die('field %s is clone of unknown field %s' % (name, clone))
+        src = known[clone]
+        return Field(name, src.type, src.elements, src.units, src.options)
+
+    ftype = elem.get('type')
+    if ftype not in TYPES:
+        die('field %s has unknown type %s' % (name, ftype))
+
+    elementnames = child_list(elem, 'elementnames', 'elementname')
+    if elementnames is None and elem.get('elementnames'):
+        elementnames = split_list(elem.get('elementnames'))
+    if elementnames:
+        elements = len(elementnames)
+    else:
+        elements = int(elem.get('elements', '1'))
+
+    options = child_list(elem, 'options', 'option')
+    if options is None and elem.get('options'):
+        options = split_list(elem.get('options'))
+    if ftype != 'enum':
+        options = None
+
+    return Field(name, ftype, elements, elem.get('units', ''), options)
+
+
+def parse_xml(path):
+    root = ET.parse(path).getroot()
+    obj = root if root.tag == 'object' else root.find('object')
+    if obj is None:
+        die('no object in ' + path)
+
+    fields = {}
+    for elem in obj.findall('field'):
+        field = parse_field(elem, fields)
+        fields[field.name] = field
+
+    return UAVObject(obj.get('name'), fields)
+
+
+def read_text(path):
+    with io.open(path, 'r', newline='') as f:
+        return f.read()
+
+
+def write_text(path, text):
+    with io.open(path, 'w', newline='') as f:
+        f.write(text)
+
+
+def field_order(obj, header):
+    """Names of DataFields members in declaration order"""
+    m = re.search(r'typedef\s+struct\s*\{(.*?)\}[^;]*DataFields\s*;', header, re.S)
+    if m is None:
+        die('no DataFields in %s.h' % obj.name.lower())
+
+    names = re.findall(r'^\s*[\w:]+\s+(\w+)\s*(?:\[\s*\d+\s*\])?\s*;', m.group(1), re.M)
+    if sorted(names) != sorted(obj.fields.keys()):
+        die('%s: DataFields members %s do not match definition %s' %
+                (obj.name, names, sorted(obj.fields.keys())))
+    return names
+
+
+def c_string(text):
+    return '"' + text.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def object_tags(obj, order):
+    view, pack, unpack, native, options, desc = [], [], [], [], [], []
+    offset = 0
+
+    for name in order:
+        f = obj.fields[name]
+        ctype, size, ftype = TYPES[f.type]
+
+        if f.elements == 1:
+            view.append('\t\t%s get%s() const { return get<%s>(%d); }' % (ctype, name, ctype, offset))
+            pack.append('\tUAVObjectCodec::pack(dataOut + %d, &data.%s, 1);' % (offset, name))
+            unpack.append('\tUAVObjectCodec::unpack(&data.%s, dataIn + %d, 1);' % (name, offset))
+        else:
+            view.append('\t\t%s get%s(uint32_t index) const { return get<%s>(%d + index * sizeof(%s)); }' %
+                    (ctype, name, ctype, offset, ctype))
+            pack.append('\tUAVObjectCodec::pack(dataOut + %d, data.%s, %d);' % (offset, name, f.elements))
+            unpack.append('\tUAVObjectCodec::unpack(data.%s, dataIn + %d, %d);' % (name, offset, f.elements))
+
+        native.append('offsetof(%s::DataFields, %s) == %d' % (obj.name, name, offset))
+
+        if f.options:
+            options.append('static const char *const %sOptionNames[] = { %s };' %
+                    (name, ', '.join(c_string(o) for o in f.options)))
+        desc.append('\t{ %s, UAVObjectField::%s, %d, offsetof(%s::DataFields, %s), %s, %s, %d },' %
+                (c_string(name), ftype, f.elements, obj.name, name, c_string(f.units),
+                 (name + 'OptionNames') if f.options else 'NULL', len(f.options or [])))
+
+        offset += size * f.elements
+
+    descriptors = options + ([''] if options else [])
+    descriptors += ['const UAVObjectField %s::FIELDS[] = {' % obj.name] + desc + ['};']
+
+    return {
+        'NUMBYTES': str(offset),
+        'VIEWFIELDS': '\n'.join(view),
+        'PACKFIELDS': '\n'.join(pack),
+        'UNPACKFIELDS': '\n'.join(unpack),
+        'NATIVELAYOUT': ' &&\n\t'.join(native),
+        'FIELDDESCRIPTORS': '\n'.join(descriptors),
+    }
+
+
+def fill(text, tags):
+    """Replace tags, new lines follow the line ending of the file"""
+    eol = '\r\n' if '\r\n' in text else '\n'
+    for tag, value in tags.items():
+        text = text.replace('$(' + tag + ')', value.replace('\n', eol))
+    return text
+
+
+def check_filled(path, text):
+    left = sorted(set(re.findall(r'\$\([A-Z_]+\)', text)))
+    if left:
+        die('%s: unknown template tags %s' % (path, ' '.join(left)))
+
+
+def main(argv):
+    if len(argv) != 4:
+        die('usage: genuavobj.py XML_DIR TEMPLATE_DIR OUTPUT_DIR')
+
+    xml_dir, template_dir, out_dir = argv[1:]
+    objects = []
+
+    for fname in sorted(os.listdir(xml_dir)):
+        if not fname.endswith('.xml'):
+            continue
+
+        obj = parse_xml(os.path.join(xml_dir, fname))
+        h_path = os.path.join(out_dir, obj.name.lower() + '.h')
+        cpp_path = os.path.join(out_dir, obj.name.lower() + '.cpp')
+        header = read_text(h_path)
+        tags = object_tags(obj, field_order(obj, header))
+
+        for path, text in ((h_path, header), (cpp_path, read_text(cpp_path))):
+            text = fill(text, tags)
+            check_filled(path, text)
+            write_text(path, text)
+
+        objects.append(obj)
+
+    objects.sort(key=lambda o: o.name)
+    common = {
+        'OBJINC': '\n'.join('#include "%s.h"' % o.name.lower() for o in objects),
+        'OBJVISIT': '\n'.join('\tcase %s::OBJID:\n\t\tvisitor(static_cast<%s *>(obj));\n\t\treturn true;' %
+                (o.name, o.name) for o in objects),
+        'OBJREGTYPE': '\n'.join('\tobjMngr->registerType(%s::OBJID, %s::NAME, &UAVObjectFactory<%s>);' %
+                (o.name, o.name, o.name) for o in objects),
+    }
+
+    init_path = os.path.join(out_dir, 'uavobjectsinit.cpp')
+    text = fill(read_text(init_path), common)
+    check_filled(init_path, text)
+    write_text(init_path, text)
+
+    visit_path = os.path.join(out_dir, 'uavobjectsvisit.h')
+    text = fill(read_text(os.path.join(template_dir, 'uavobjectsvisit.h.template')), common)
+    check_filled(visit_path, text)
+    write_text(visit_path, text)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
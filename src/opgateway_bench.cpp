@@ -0,0 +1,292 @@
+/**
+ * Microbenchmarks of the gateway hot paths
+ *
+ * Results are written to opgateway_bench.json (google-benchmark JSON format)
+ * unless --benchmark_out is given, so they may be compared between versions
+ * (e.g. with benchmark's tools/compare.py).
+ * Set OPGATEWAY_BENCH_CAPTURE to a raw UAVTalk capture to also benchmark
+ * parsing of a recorded stream.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <benchmark/benchmark.h>
+
+#include "uavobjectmanager.h"
+#include "uavobjectsinit.h"
+#include "uavtalk.h"
+#include "telemetry.h"
+#include "systemstats.h"
+#include "accessorydesired.h"
+#include "gcstelemetrystats.h"
+
+
+using namespace openpilot;
+
+
+/** Driver which keeps what is written
+ */
+class CaptureIO : public UAVTalkIOBase {
+public:
+	std::vector<uint8_t> data;
+
+	void write(const uint8_t *buf, size_t length) { data.insert(data.end(), buf, buf + length); }
+	bool is_open() { return true; }
+};
+
+/** Exposes protected helpers
+ */
+class BenchTalk : public UAVTalk {
+public:
+	BenchTalk(UAVTalkIOBase *iodev, UAVObjectManager *objMngr) : UAVTalk(iodev, objMngr) {}
+
+	using UAVTalk::updateCRC;
+};
+
+static void dummy_slot(UAVObject *obj)
+{
+	benchmark::DoNotOptimize(obj);
+}
+
+/** Synthetic stream: SystemStats, GCSTelemetryStats and AccessoryDesired instances
+ */
+static std::vector<uint8_t> make_stream(size_t frames)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	CaptureIO cap;
+	UAVTalk utalk(&cap, &objMngr);
+
+	UAVObject *objs[] = {
+		SystemStats::GetInstance(&objMngr),
+		GCSTelemetryStats::GetInstance(&objMngr),
+		AccessoryDesired::GetInstance(&objMngr)
+	};
+
+	for (size_t n = 0; n < frames; ++n)
+		utalk.sendObject(objs[n % 3], false, false);
+
+	return cap.data;
+}
+
+static void process_stream(benchmark::State &state, const std::vector<uint8_t> &stream)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	CaptureIO cap;
+	UAVTalk utalk(&cap, &objMngr);
+	std::vector<uint8_t> buf(stream);
+
+	while (state.KeepRunning())
+		cap.sig_read(&buf[0], buf.size());
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+	state.counters["rxObjects"] = utalk.getStats().rxObjects;
+}
+
+static void BM_ProcessInputStream(benchmark::State &state)
+{
+	process_stream(state, make_stream(state.range(0)));
+}
+BENCHMARK(BM_ProcessInputStream)->Arg(1)->Arg(64)->Arg(1024);
+
+static void BM_ProcessInputStreamRecorded(benchmark::State &state, std::vector<uint8_t> stream)
+{
+	process_stream(state, stream);
+}
+
+static void BM_UpdateCRC(benchmark::State &state)
+{
+	std::vector<uint8_t> buf(state.range(0));
+	for (size_t n = 0; n < buf.size(); ++n)
+		buf[n] = n * 7;
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(BenchTalk::updateCRC(0, &buf[0], buf.size()));
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+}
+BENCHMARK(BM_UpdateCRC)->Arg(8)->Arg(64)->Arg(266);
+
+static void BM_GetObjectById(benchmark::State &state)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(objMngr.getObject(SystemStats::OBJID));
+}
+BENCHMARK(BM_GetObjectById);
+
+static void BM_GetObjectByName(benchmark::State &state)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	const std::string name("SystemStats");
+
+	while (state.KeepRunning())
+		benchmark::DoNotOptimize(objMngr.getObject(name));
+}
+BENCHMARK(BM_GetObjectByName);
+
+static void BM_RegisterInstances(benchmark::State &state)
+{
+	while (state.KeepRunning()) {
+		state.PauseTiming();
+		UAVObjectManager *objMngr = new UAVObjectManager();
+		AccessoryDesired *acc = new AccessoryDesired();
+		objMngr->registerObject(acc);
+		state.ResumeTiming();
+
+		for (int64_t n = 1; n < state.range(0); ++n)
+			objMngr->registerObject(acc->clone(n));
+
+		state.PauseTiming();
+		// manager does not own objects
+		UAVObjectManager::inst_vec insts = objMngr->getObjectInstances(AccessoryDesired::OBJID);
+		UAVMetaObject *meta = acc->getMetaObject();
+		for (size_t n = 0; n < insts.size(); ++n)
+			delete static_cast<AccessoryDesired *>(insts[n]);
+		delete meta;
+		delete objMngr;
+		state.ResumeTiming();
+	}
+
+	state.SetItemsProcessed(int64_t(state.iterations()) * (state.range(0) - 1));
+}
+BENCHMARK(BM_RegisterInstances)->Arg(16)->Arg(256);
+
+static void BM_SignalEmit(benchmark::State &state)
+{
+	SystemStats obj;
+
+	for (int64_t n = 0; n < state.range(0); ++n)
+		obj.objectUpdated.connect(dummy_slot);
+
+	while (state.KeepRunning())
+		obj.objectUpdated(&obj);
+}
+BENCHMARK(BM_SignalEmit)->Arg(0)->Arg(1)->Arg(4);
+
+static void BM_SetData(benchmark::State &state)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	SystemStats *obj = SystemStats::GetInstance(&objMngr);
+	SystemStats::DataFields data = obj->getData();
+
+	obj->objectUpdated.connect(dummy_slot);
+	while (state.KeepRunning()) {
+		data.FlightTime++;
+		obj->setData(data);
+	}
+}
+BENCHMARK(BM_SetData);
+
+/** Manual update through Telemetry: signal, post, event queue, transaction, UAVTalk TX
+ */
+static void BM_TelemetryUpdate(benchmark::State &state)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	boost::asio::io_service io;
+	CaptureIO cap;
+	UAVTalk utalk(&cap, &objMngr);
+
+	SystemStats *obj = SystemStats::GetInstance(&objMngr);
+	UAVObject::Metadata mdata = obj->getMetadata();
+	UAVObject::SetGcsTelemetryAcked(mdata, false);
+	UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_MANUAL);
+	obj->setMetadata(mdata);
+
+	Telemetry tel(io, &utalk, &objMngr);
+
+	// updates are sent only while connected
+	GCSTelemetryStats *gcsStatsObj = GCSTelemetryStats::GetInstance(&objMngr);
+	GCSTelemetryStats::DataFields gcsStats = gcsStatsObj->getData();
+	gcsStats.Status = GCSTelemetryStats::STATUS_CONNECTED;
+	gcsStatsObj->setData(gcsStats);
+	io.poll();
+
+	while (state.KeepRunning()) {
+		obj->updated();
+		io.poll();
+
+		if (cap.data.size() > 1 << 20)
+			cap.data.clear();
+	}
+
+	state.counters["txObjects"] = utalk.getStats().txObjects;
+}
+BENCHMARK(BM_TelemetryUpdate);
+
+static void BM_Serialize(benchmark::State &state)
+{
+	SystemStats obj;
+	std::vector<uint8_t> buf(obj.getNumBytes());
+
+	while (state.KeepRunning()) {
+		obj.serialize(&buf[0]);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+}
+BENCHMARK(BM_Serialize);
+
+static void BM_Deserialize(benchmark::State &state)
+{
+	SystemStats obj;
+	std::vector<uint8_t> buf(obj.getNumBytes());
+	obj.serialize(&buf[0]);
+
+	while (state.KeepRunning()) {
+		obj.deserialize(&buf[0]);
+		benchmark::ClobberMemory();
+	}
+
+	state.SetBytesProcessed(int64_t(state.iterations()) * buf.size());
+}
+BENCHMARK(BM_Deserialize);
+
+int main(int argc, char **argv)
+{
+	std::vector<char *> args(argv, argv + argc);
+	bool has_out = false;
+
+	for (int n = 1; n < argc; ++n)
+		if (strncmp(argv[n], "--benchmark_out=", 16) == 0)
+			has_out = true;
+
+	// JSON results by default
+	char out_arg[] = "--benchmark_out=opgateway_bench.json";
+	char fmt_arg[] = "--benchmark_out_format=json";
+	if (!has_out) {
+		args.push_back(out_arg);
+		args.push_back(fmt_arg);
+	}
+
+	const char *capture = getenv("OPGATEWAY_BENCH_CAPTURE");
+	if (capture != NULL) {
+		std::ifstream in(capture, std::ios::in | std::ios::binary);
+		std::vector<uint8_t> stream((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		if (stream.empty()) {
+			fprintf(stderr, "Can't read capture %s\n", capture);
+			return 1;
+		}
+
+		benchmark::RegisterBenchmark("BM_ProcessInputStreamRecorded", BM_ProcessInputStreamRecorded, stream);
+	}
+
+	int nargs = args.size();
+	benchmark::Initialize(&nargs, &args[0]);
+	if (benchmark::ReportUnrecognizedArguments(nargs, &args[0]))
+		return 1;
+
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
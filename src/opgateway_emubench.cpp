@@ -0,0 +1,239 @@
+/**
+ * End-to-end telemetry benchmark
+ *
+ * Runs TelemetryManager against the autopilot emulator over a pty pair
+ * and reports connect time, received objects per second and latency.
+ */
+
+#include <unistd.h>
+#include <cstdio>
+#include <algorithm>
+#include <sstream>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "uavobjectmanager.h"
+#include "uavobjectsinit.h"
+#include "telemetrymanager.h"
+#include "autopilotemulator.h"
+#include "iodrivers/uavtalkserialio.h"
+#include "iodrivers/uavtalkptyio.h"
+#include "iodrivers/uavtalkimpairio.h"
+#include "systemstats.h"
+
+
+using namespace openpilot;
+
+
+static boost::mutex g_mutex;
+static boost::condition_variable g_cond;
+static bool g_connected = false;
+static uint32_t g_seq = 0;
+static std::map<uint32_t, boost::posix_time::ptime> g_sent;	// SystemStats.FlightTime -> send time
+static std::vector<long> g_latency;				// us
+static std::map<uint32_t, uint32_t> g_received;			// objId -> count
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-d seconds] [-a] [-s Name:rate[,Name:rate...]] [-i ber:drop:latency[:jitter[:baud]]] [-r seed]\n"
+		"  -d  streaming duration (default: 10)\n"
+		"  -a  stream objects with OBJ_ACK\n"
+		"  -s  object mix (default: SystemStats:100)\n"
+		"  -i  impair the link in both directions: bit error rate, byte drop rate,\n"
+		"      latency and jitter (ms), baud rate limit (see UAVTalkImpairIO)\n"
+		"  -r  impairment random seed (default: 0)\n"
+		"SystemStats.FlightTime is used as sequence number for latency measurement.\n",
+		prog);
+}
+
+static void telem_connected(void)
+{
+	boost::mutex::scoped_lock lock(g_mutex);
+	g_connected = true;
+	g_cond.notify_all();
+}
+
+/** Autopilot side, called before object is packed */
+static void object_sending(UAVObject *obj)
+{
+	if (obj->getObjID() != SystemStats::OBJID)
+		return;
+
+	SystemStats *sysStats = static_cast<SystemStats *>(obj);
+	SystemStats::DataFields data = sysStats->getData();
+
+	boost::mutex::scoped_lock lock(g_mutex);
+	data.FlightTime = ++g_seq;
+	g_sent[data.FlightTime] = boost::posix_time::microsec_clock::universal_time();
+	sysStats->setData(data);
+}
+
+/** GCS side */
+static void object_unpacked(UAVObject *obj)
+{
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	boost::mutex::scoped_lock lock(g_mutex);
+
+	g_received[obj->getObjID()]++;
+	if (obj->getObjID() != SystemStats::OBJID)
+		return;
+
+	SystemStats::DataFields data = static_cast<SystemStats *>(obj)->getData();
+	std::map<uint32_t, boost::posix_time::ptime>::iterator it = g_sent.find(data.FlightTime);
+	if (it != g_sent.end()) {
+		g_latency.push_back((now - it->second).total_microseconds());
+		g_sent.erase(it);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int duration = 10;
+	bool acked = false;
+	std::string mix = "SystemStats:100";
+	std::string impair;
+	uint32_t seed = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:as:i:r:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'a':
+			acked = true;
+			break;
+		case 's':
+			mix = optarg;
+			break;
+		case 'i':
+			impair = optarg;
+			break;
+		case 'r':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// GCS side (objects and link are left running until exit)
+	UAVObjectManager *objMngr = new UAVObjectManager();
+	UAVObjectsInitialize(objMngr);
+
+	// Autopilot side
+	UAVObjectManager *apObjMngr = new UAVObjectManager();
+	UAVObjectsInitialize(apObjMngr);
+
+	UAVTalkPtyIO *pty = new UAVTalkPtyIO();
+	AutopilotEmulator *autopilot = new AutopilotEmulator(pty, apObjMngr);
+	autopilot->objectSending.connect(object_sending);
+
+	// Parse object mix
+	std::vector<std::pair<UAVObject *, double> > streams;
+	std::istringstream mix_ss(mix);
+	std::string item;
+	while (std::getline(mix_ss, item, ',')) {
+		size_t colon = item.find(':');
+		UAVObject *obj = objMngr->getObject(item.substr(0, colon));
+		if (obj == NULL || colon == std::string::npos) {
+			fprintf(stderr, "Bad object mix item: %s\n", item.c_str());
+			return 1;
+		}
+
+		streams.push_back(std::make_pair(obj, atof(item.substr(colon + 1).c_str())));
+		obj->objectUnpacked.connect(object_unpacked);
+	}
+
+	// Connect
+	boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+
+	UAVTalkSerialIO *ser = new UAVTalkSerialIO(pty->getSlaveName(), 115200);
+	UAVTalkImpairIO *impairIO = NULL;
+	if (!impair.empty()) {
+		UAVTalkImpairIO::Impairment imp = UAVTalkImpairIO::Impairment();
+		if (sscanf(impair.c_str(), "%lf:%lf:%u:%u:%u", &imp.bitErrorRate, &imp.dropRate,
+					&imp.latencyMs, &imp.jitterMs, &imp.baudrate) < 3) {
+			fprintf(stderr, "Bad impairment: %s\n", impair.c_str());
+			return 1;
+		}
+
+		impairIO = new UAVTalkImpairIO(ser, seed);
+		impairIO->setImpairment(UAVTalkImpairIO::DIR_TX, imp);
+		impairIO->setImpairment(UAVTalkImpairIO::DIR_RX, imp);
+	}
+
+	TelemetryManager *telMngr = new TelemetryManager(objMngr);
+	telMngr->connected.connect(telem_connected);
+	telMngr->start((impairIO != NULL) ? static_cast<UAVTalkIOBase *>(impairIO) : ser);
+
+	{
+		boost::system_time timeout = boost::get_system_time() + boost::posix_time::seconds(30);
+		boost::mutex::scoped_lock lock(g_mutex);
+		while (!g_connected) {
+			if (!g_cond.timed_wait(lock, timeout)) {
+				fprintf(stderr, "Connection timeout\n");
+				return 1;
+			}
+		}
+	}
+
+	boost::posix_time::time_duration connect_time = boost::posix_time::microsec_clock::universal_time() - start_time;
+	printf("connect time: %ld ms\n", (long)connect_time.total_milliseconds());
+
+	// Stream
+	for (size_t n = 0; n < streams.size(); ++n)
+		autopilot->setStream(streams[n].first->getObjID(), streams[n].second, acked);
+
+	{
+		boost::mutex::scoped_lock lock(g_mutex);
+		g_received.clear();
+		g_latency.clear();
+	}
+
+	start_time = boost::posix_time::microsec_clock::universal_time();
+	boost::this_thread::sleep(boost::posix_time::seconds(duration));
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_time;
+
+	for (size_t n = 0; n < streams.size(); ++n) {
+		autopilot->setStream(streams[n].first->getObjID(), 0);
+		streams[n].first->objectUnpacked.disconnect(object_unpacked);
+	}
+	autopilot->objectSending.disconnect(object_sending);
+
+	// Report
+	boost::mutex::scoped_lock lock(g_mutex);
+	double seconds = elapsed.total_microseconds() / 1e6;
+	uint32_t total = 0;
+
+	for (size_t n = 0; n < streams.size(); ++n) {
+		uint32_t count = g_received[streams[n].first->getObjID()];
+		total += count;
+		printf("%-24s requested %8.1f/s received %8.1f/s\n", streams[n].first->getName().c_str(),
+				streams[n].second, count / seconds);
+	}
+	printf("total: %u objects, %.1f objects/s, streamed %u\n", total, total / seconds,
+			autopilot->getEmulatorStats().objectsStreamed);
+
+	if (!g_latency.empty()) {
+		std::sort(g_latency.begin(), g_latency.end());
+		printf("latency (us): min %ld p50 %ld p99 %ld max %ld (%zu samples, %zu lost)\n",
+				g_latency.front(),
+				g_latency[g_latency.size() / 2],
+				g_latency[g_latency.size() * 99 / 100],
+				g_latency.back(),
+				g_latency.size(), g_sent.size());
+	}
+
+	if (impairIO != NULL) {
+		UAVTalkImpairIO::ImpairStats rx = impairIO->getImpairStats(UAVTalkImpairIO::DIR_RX);
+		UAVTalkImpairIO::ImpairStats tx = impairIO->getImpairStats(UAVTalkImpairIO::DIR_TX);
+		printf("impairment: rx %u bytes, %u bits flipped, %u dropped; tx %u bytes, %u bits flipped, %u dropped\n",
+				rx.bytes, rx.bitsFlipped, rx.bytesDropped, tx.bytes, tx.bitsFlipped, tx.bytesDropped);
+	}
+
+	return 0;
+}
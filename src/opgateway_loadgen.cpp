@@ -0,0 +1,434 @@
+/**
+ * Synthetic UAVTalk load generator
+ *
+ * Sends generated objects with given mix, rates, ack ratio and corruption
+ * to a pty, UDP socket or file from several threads, and reports what was
+ * sent together with the ComStats expected on the receiving side.
+ * Corruption changes one byte after the header, so each corrupted frame
+ * is exactly one CRC error and never hides the following frame.
+ */
+
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_01.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "uavobjectmanager.h"
+#include "uavobjectsinit.h"
+#include "uavtalk.h"
+#include "iodrivers/uavtalkptyio.h"
+
+
+using namespace openpilot;
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-o output] [-s Name:rate[:instances],...] [-d seconds] [-j threads]\n"
+		"          [-a ack_ratio] [-c corrupt_ratio] [-r seed] [-w seconds]\n"
+		"  -o  pty (default), udp:host:port, file:path or parser (in-process UAVTalk,\n"
+		"      its ComStats are checked against what was sent)\n"
+		"  -s  object mix, rate is per instance and per second, 0 - as fast as possible\n"
+		"      (default: SystemStats:0)\n"
+		"  -d  duration (default: 10)\n"
+		"  -j  generator threads, each sends the whole mix (default: 1)\n"
+		"  -a  ratio of frames sent as OBJ_ACK (default: 0)\n"
+		"  -c  ratio of corrupted frames (default: 0)\n"
+		"  -r  random seed (default: 0)\n"
+		"  -w  wait before sending, to connect the gateway to the pty (default: 5 for pty)\n",
+		prog);
+}
+
+
+/** Keeps the last written frame
+ */
+class FrameIO : public UAVTalkIOBase {
+public:
+	std::vector<uint8_t> frame;
+
+	void write(const uint8_t *data, size_t length) { frame.assign(data, data + length); }
+	bool is_open() { return true; }
+};
+
+/** Drops everything
+ */
+class NullIO : public UAVTalkIOBase {
+public:
+	void write(const uint8_t *data, size_t length) {}
+	bool is_open() { return true; }
+};
+
+class FileIO : public UAVTalkIOBase {
+public:
+	FileIO(const std::string &path) : out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc) {}
+
+	void write(const uint8_t *data, size_t length)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		out.write((const char *)data, length);
+	}
+
+	bool is_open() { return out.good(); }
+
+private:
+	std::ofstream out;
+	boost::mutex mutex;
+};
+
+/** UDP client, one datagram per frame
+ */
+class UDPClientIO : public UAVTalkIOBase {
+public:
+	UDPClientIO(const std::string &host, const std::string &port) :
+		socket(io_service)
+	{
+		boost::asio::ip::udp::resolver resolver(io_service);
+		boost::asio::ip::udp::resolver::query query(boost::asio::ip::udp::v4(), host, port);
+		endpoint = *resolver.resolve(query);
+		socket.open(boost::asio::ip::udp::v4());
+	}
+
+	void write(const uint8_t *data, size_t length)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		boost::system::error_code ec;
+		socket.send_to(boost::asio::buffer(data, length), endpoint, 0, ec);
+	}
+
+	bool is_open() { return socket.is_open(); }
+
+private:
+	boost::asio::io_service io_service;
+	boost::asio::ip::udp::socket socket;
+	boost::asio::ip::udp::endpoint endpoint;
+	boost::mutex mutex;
+};
+
+/** Feeds in-process UAVTalk parser
+ */
+class ParserIO : public UAVTalkIOBase {
+public:
+	ParserIO(UAVObjectManager *objMngr) : utalk(&rx, objMngr) {}
+
+	void write(const uint8_t *data, size_t length)
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		buf.assign(data, data + length);
+		rx.sig_read(&buf[0], buf.size());
+	}
+
+	bool is_open() { return true; }
+	UAVTalk::ComStats getStats() { return utalk.getStats(); }
+
+private:
+	NullIO rx;	/** parser side, ACKs are dropped */
+	UAVTalk utalk;
+	std::vector<uint8_t> buf;
+	boost::mutex mutex;
+};
+
+/** Sends single frames without transactions
+ */
+class LoadTalk : public UAVTalk {
+public:
+	LoadTalk(UAVTalkIOBase *iodev, UAVObjectManager *objMngr) : UAVTalk(iodev, objMngr) {}
+
+	bool send(UAVObject *obj, bool acked)
+	{
+		boost::recursive_mutex::scoped_lock lock(mutex);
+		return transmitSingleObject(obj, acked ? TYPE_OBJ_ACK : TYPE_OBJ, false);
+	}
+
+	static size_t headerLength(UAVObject *obj)
+	{
+		return obj->isSingleInstance() ? MIN_HEADER_LENGTH : MAX_HEADER_LENGTH;
+	}
+};
+
+
+typedef struct {
+	UAVObject *obj;
+	double rate;
+} StreamSpec;
+
+typedef struct {
+	uint64_t frames;
+	uint64_t acked;
+	uint64_t corrupted;
+	uint64_t bytes;
+	uint64_t objectBytes;
+} StreamStats;
+
+typedef struct {
+	UAVObjectManager *objMngr;
+	UAVTalkIOBase *out;
+	std::vector<StreamSpec> streams;
+	boost::posix_time::ptime end;
+	double ackRatio;
+	double corruptRatio;
+	uint32_t seed;
+	int threads;
+} Config;
+
+
+static void generator(const Config *cfg, int idx, std::vector<StreamStats> *stats)
+{
+	boost::random::mt19937 rng(cfg->seed + idx);
+	boost::random::uniform_01<> uniform;
+	FrameIO frameIO;
+	LoadTalk talk(&frameIO, cfg->objMngr);
+	std::vector<boost::posix_time::ptime> next(cfg->streams.size(), boost::posix_time::microsec_clock::universal_time());
+	std::vector<boost::posix_time::time_duration> period(cfg->streams.size());
+	bool flood = false;
+
+	stats->assign(cfg->streams.size(), StreamStats());
+	for (size_t n = 0; n < cfg->streams.size(); ++n) {
+		if (cfg->streams[n].rate > 0)
+			period[n] = boost::posix_time::microseconds(int64_t(1e6 * cfg->threads / cfg->streams[n].rate));
+		else
+			flood = true;
+	}
+
+	for (;;) {
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+		if (now >= cfg->end)
+			break;
+
+		for (size_t n = 0; n < cfg->streams.size(); ++n) {
+			if (cfg->streams[n].rate > 0) {
+				if (next[n] > now)
+					continue;
+
+				// do not try to catch up if we are late more than one period
+				next[n] += period[n];
+				if (next[n] < now)
+					next[n] = now + period[n];
+			}
+
+			UAVObject *obj = cfg->streams[n].obj;
+			bool acked = uniform(rng) < cfg->ackRatio;
+			if (!talk.send(obj, acked))
+				continue;
+
+			std::vector<uint8_t> &frame = frameIO.frame;
+			StreamStats &st = (*stats)[n];
+			size_t hdr = LoadTalk::headerLength(obj);
+
+			if (cfg->corruptRatio > 0 && uniform(rng) < cfg->corruptRatio) {
+				size_t pos = boost::random::uniform_int_distribution<size_t>(hdr, frame.size() - 1)(rng);
+				frame[pos] ^= uint8_t(boost::random::uniform_int_distribution<unsigned>(1, 255)(rng));
+				st.corrupted++;
+			} else {
+				st.objectBytes += frame.size() - hdr - 1;
+			}
+
+			cfg->out->write(&frame[0], frame.size());
+			st.frames++;
+			st.bytes += frame.size();
+			if (acked)
+				st.acked++;
+		}
+
+		if (!flood) {
+			boost::posix_time::ptime wake = cfg->end;
+			for (size_t n = 0; n < next.size(); ++n)
+				wake = std::min(wake, next[n]);
+
+			now = boost::posix_time::microsec_clock::universal_time();
+			if (wake > now)
+				boost::this_thread::sleep(wake - now);
+		}
+	}
+}
+
+/** Parse "Name:rate[:instances],..." and create missing instances
+ */
+static bool parse_mix(UAVObjectManager *objMngr, const std::string &mix, std::vector<StreamSpec> &streams)
+{
+	std::istringstream mix_ss(mix);
+	std::string item;
+
+	while (std::getline(mix_ss, item, ',')) {
+		std::istringstream item_ss(item);
+		std::string name, rate, instances("1");
+
+		std::getline(item_ss, name, ':');
+		std::getline(item_ss, rate, ':');
+		std::getline(item_ss, instances, ':');
+
+		UAVDataObject *obj = UAVDataObject::cast(objMngr->getObject(name));
+		int ninst = atoi(instances.c_str());
+		if (obj == NULL || rate.empty() || ninst < 1 || (obj->isSingleInstance() && ninst > 1)) {
+			fprintf(stderr, "Bad object mix item: %s\n", item.c_str());
+			return false;
+		}
+
+		for (int inst = objMngr->getNumInstances(obj->getObjID()); inst < ninst; ++inst)
+			objMngr->registerObject(obj->clone(inst));
+
+		for (int inst = 0; inst < ninst; ++inst) {
+			StreamSpec s;
+			s.obj  = objMngr->getObject(obj->getObjID(), inst);
+			s.rate = atof(rate.c_str());
+			streams.push_back(s);
+		}
+	}
+
+	return !streams.empty();
+}
+
+int main(int argc, char **argv)
+{
+	std::string output = "pty";
+	std::string mix = "SystemStats:0";
+	int duration = 10;
+	int wait = -1;
+	Config cfg;
+	int opt;
+
+	cfg.ackRatio = 0;
+	cfg.corruptRatio = 0;
+	cfg.seed = 0;
+	cfg.threads = 1;
+
+	while ((opt = getopt(argc, argv, "o:s:d:j:a:c:r:w:h")) != -1) {
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 's':
+			mix = optarg;
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'j':
+			cfg.threads = std::max(1, atoi(optarg));
+			break;
+		case 'a':
+			cfg.ackRatio = atof(optarg);
+			break;
+		case 'c':
+			cfg.corruptRatio = atof(optarg);
+			break;
+		case 'r':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			wait = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	cfg.objMngr = &objMngr;
+	if (!parse_mix(&objMngr, mix, cfg.streams))
+		return 1;
+
+	// Receiver has its own objects, so parsing does not contend with generators
+	UAVObjectManager rxObjMngr;
+	UAVObjectsInitialize(&rxObjMngr);
+
+	std::auto_ptr<UAVTalkIOBase> out;
+	ParserIO *parser = NULL;
+	try {
+		if (output == "pty") {
+			UAVTalkPtyIO *pty = new UAVTalkPtyIO();
+			out.reset(pty);
+			printf("pty: %s\n", pty->getSlaveName().c_str());
+			if (wait < 0)
+				wait = 5;
+		} else if (output.compare(0, 4, "udp:") == 0) {
+			size_t colon = output.rfind(':');
+			out.reset(new UDPClientIO(output.substr(4, colon - 4), output.substr(colon + 1)));
+		} else if (output.compare(0, 5, "file:") == 0) {
+			out.reset(new FileIO(output.substr(5)));
+		} else if (output == "parser") {
+			parser = new ParserIO(&rxObjMngr);
+			out.reset(parser);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	} catch (std::exception &ex) {
+		fprintf(stderr, "Can't open output %s: %s\n", output.c_str(), ex.what());
+		return 1;
+	}
+
+	if (!out->is_open()) {
+		fprintf(stderr, "Can't open output %s\n", output.c_str());
+		return 1;
+	}
+
+	fflush(stdout);
+	if (wait > 0)
+		boost::this_thread::sleep(boost::posix_time::seconds(wait));
+
+	// Generate
+	cfg.out = out.get();
+	std::vector<std::vector<StreamStats> > stats(cfg.threads);
+	boost::thread_group workers;
+	boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+
+	cfg.end = start_time + boost::posix_time::seconds(duration);
+	for (int n = 0; n < cfg.threads; ++n)
+		workers.create_thread(boost::bind(generator, &cfg, n, &stats[n]));
+	workers.join_all();
+
+	double seconds = (boost::posix_time::microsec_clock::universal_time() - start_time).total_microseconds() / 1e6;
+
+	// Report
+	StreamStats total = StreamStats();
+	printf("%-24s %5s %12s %10s %10s %10s\n", "object", "inst", "frames", "frames/s", "acked", "corrupted");
+	for (size_t n = 0; n < cfg.streams.size(); ++n) {
+		StreamStats st = StreamStats();
+		for (int t = 0; t < cfg.threads; ++t) {
+			st.frames      += stats[t][n].frames;
+			st.acked       += stats[t][n].acked;
+			st.corrupted   += stats[t][n].corrupted;
+			st.bytes       += stats[t][n].bytes;
+			st.objectBytes += stats[t][n].objectBytes;
+		}
+
+		printf("%-24s %5u %12llu %10.1f %10llu %10llu\n", cfg.streams[n].obj->getName().c_str(),
+				cfg.streams[n].obj->getInstID(), (unsigned long long)st.frames, st.frames / seconds,
+				(unsigned long long)st.acked, (unsigned long long)st.corrupted);
+
+		total.frames      += st.frames;
+		total.acked       += st.acked;
+		total.corrupted   += st.corrupted;
+		total.bytes       += st.bytes;
+		total.objectBytes += st.objectBytes;
+	}
+
+	printf("total: %llu frames (%.1f frames/s, %.1f bytes/s) in %.3f s, %d threads\n",
+			(unsigned long long)total.frames, total.frames / seconds, total.bytes / seconds, seconds, cfg.threads);
+	printf("expected ComStats: rxBytes %llu rxObjects %llu rxObjectBytes %llu rxErrors %llu\n",
+			(unsigned long long)total.bytes, (unsigned long long)(total.frames - total.corrupted),
+			(unsigned long long)total.objectBytes, (unsigned long long)total.corrupted);
+
+	if (parser != NULL) {
+		UAVTalk::ComStats rx = parser->getStats();
+		bool ok = rx.rxBytes == total.bytes &&
+			rx.rxObjects == total.frames - total.corrupted &&
+			rx.rxObjectBytes == total.objectBytes &&
+			rx.rxErrors == total.corrupted;
+
+		printf("parser ComStats:   rxBytes %llu rxObjects %llu rxObjectBytes %llu rxErrors %llu: %s\n",
+				(unsigned long long)rx.rxBytes, (unsigned long long)rx.rxObjects,
+				(unsigned long long)rx.rxObjectBytes, (unsigned long long)rx.rxErrors, ok ? "OK" : "MISMATCH");
+		return ok ? 0 : 2;
+	}
+
+	return 0;
+}
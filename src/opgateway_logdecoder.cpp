@@ -0,0 +1,212 @@
+/**
+ * Offline UAVTalk capture decoder
+ *
+ * Converts a raw capture or OpenPilot GCS log (.opl) to a rosbag
+ * or to per-object record files.
+ */
+
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "ros/ros.h"
+#include "rosbag/bag.h"
+#include "opgateway/UAVObject.h"
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "uavobjectmanager.h"
+#include "uavobjectsinit.h"
+#include "uavobjectsvisit.h"
+#include "uavtalklogdecoder.h"
+
+
+using namespace openpilot;
+
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-j threads] [-r] (-b out.bag | -c outdir | -t) capture\n"
+		"  -j  number of decoding threads (default: one per core)\n"
+		"  -r  capture is a raw byte stream (default: OpenPilot .opl log)\n"
+		"  -b  write rosbag, one /uavobjects/<Name> topic per object\n"
+		"  -c  write <outdir>/<Name>.bin files of {uint32 ms, uint16 instid, data} records\n"
+		"  -t  print decoded objects to stdout, one line per record: time name instid field: values...\n",
+		prog);
+}
+
+static void write_bag(UAVObjectManager *objMngr, const std::vector<UAVTalkLogDecoder::Record> &records,
+		const std::string &path)
+{
+	rosbag::Bag bag(path, rosbag::bagmode::Write);
+
+	for (std::vector<UAVTalkLogDecoder::Record>::const_iterator it = records.begin(); it != records.end(); ++it) {
+		if (it->data == NULL)
+			continue;
+
+		UAVObject *obj = objMngr->getObject(it->objId);
+		opgateway::UAVObject msg;
+
+		msg.header.stamp = ros::TIME_MIN + ros::Duration(it->timestamp / 1000, (it->timestamp % 1000) * 1000000);
+		msg.name = obj->getName();
+		msg.objid = it->objId;
+		msg.instid = it->instId;
+		msg.data.assign(it->data, it->data + it->length);
+
+		bag.write("/uavobjects/" + msg.name, msg.header.stamp, msg);
+	}
+
+	bag.close();
+}
+
+static bool write_columns(UAVObjectManager *objMngr, const std::vector<UAVTalkLogDecoder::Record> &records,
+		const std::string &dir)
+{
+	std::map<uint32_t, std::ofstream *> files;
+	bool ok = true;
+
+	for (std::vector<UAVTalkLogDecoder::Record>::const_iterator it = records.begin(); it != records.end(); ++it) {
+		if (it->data == NULL)
+			continue;
+
+		std::ofstream *&out = files[it->objId];
+		if (out == NULL) {
+			std::string path = dir + "/" + objMngr->getObject(it->objId)->getName() + ".bin";
+			out = new std::ofstream(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!*out) {
+				fprintf(stderr, "Can't open %s\n", path.c_str());
+				ok = false;
+				break;
+			}
+		}
+
+		out->write((const char *)&it->timestamp, sizeof(it->timestamp));
+		out->write((const char *)&it->instId, sizeof(it->instId));
+		out->write((const char *)it->data, it->length);
+	}
+
+	for (std::map<uint32_t, std::ofstream *>::iterator it = files.begin(); it != files.end(); ++it)
+		delete it->second;
+
+	return ok;
+}
+
+/** Prints record with the field table of its generated class.
+ * Data is unpacked to a local DataFields, objects are not changed
+ * and no instances are created for multi-instance objects.
+ */
+class RecordPrinter {
+public:
+	RecordPrinter(std::ostream &out_, const UAVTalkLogDecoder::Record &rec_) :
+		out(out_),
+		rec(rec_)
+	{ }
+
+	template<class T>
+	void operator()(T *obj)
+	{
+		typename T::DataFields data;
+		T::UnpackData(rec.data, data);
+
+		out << rec.timestamp << " " << T::NAME << " " << rec.instId;
+		for (size_t n = 0; n < T::NUMFIELDS; ++n) {
+			const UAVObjectField &field = T::FIELDS[n];
+
+			out << " " << field.name << ":";
+			for (uint32_t idx = 0; idx < field.numElements; ++idx) {
+				const char *option = field.getOption(&data, idx);
+				if (field.type == UAVObjectField::TYPE_ENUM && option != NULL)
+					out << " " << option;
+				else
+					out << " " << field.getDouble(&data, idx);
+			}
+		}
+		out << std::endl;
+	}
+
+	void operator()(UAVMetaObject *obj)
+	{
+		// metadata has no field table
+		obj->deserialize(rec.data);
+		out << rec.timestamp << " " << obj->getName() << " 0 " << obj->toStringData();
+	}
+
+private:
+	std::ostream &out;
+	const UAVTalkLogDecoder::Record &rec;
+};
+
+static void write_text(UAVObjectManager *objMngr, const std::vector<UAVTalkLogDecoder::Record> &records)
+{
+	for (std::vector<UAVTalkLogDecoder::Record>::const_iterator it = records.begin(); it != records.end(); ++it) {
+		if (it->data == NULL)
+			continue;
+
+		RecordPrinter printer(std::cout, *it);
+		UAVObjectsVisit(objMngr->getObject(it->objId), printer);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int threads = 0;
+	UAVTalkLogDecoder::LogFormat format = UAVTalkLogDecoder::FORMAT_OPL;
+	std::string bag_path, columns_dir;
+	bool text = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:rb:c:th")) != -1) {
+		switch (opt) {
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'r':
+			format = UAVTalkLogDecoder::FORMAT_RAW;
+			break;
+		case 'b':
+			bag_path = optarg;
+			break;
+		case 'c':
+			columns_dir = optarg;
+			break;
+		case 't':
+			text = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || (bag_path.empty() && columns_dir.empty() && !text)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+
+	UAVTalkLogDecoder decoder(&objMngr);
+	if (!decoder.load(argv[optind], format)) {
+		fprintf(stderr, "Can't load %s\n", argv[optind]);
+		return 1;
+	}
+
+	boost::posix_time::ptime start_time = boost::posix_time::microsec_clock::universal_time();
+	decoder.decode(threads);
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_time;
+
+	UAVTalkLogDecoder::Stats stats = decoder.getStats();
+	fprintf(stderr, "Decoded %zu frames from %zu bytes (%zu skipped) in %zu chunks, %ld ms\n",
+			stats.frames, stats.bytes, stats.badBytes, stats.chunks, (long)elapsed.total_milliseconds());
+
+	if (!bag_path.empty())
+		write_bag(&objMngr, decoder.getRecords(), bag_path);
+	if (!columns_dir.empty() && !write_columns(&objMngr, decoder.getRecords(), columns_dir))
+		return 1;
+	if (text)
+		write_text(&objMngr, decoder.getRecords());
+
+	return 0;
+}
@@ -2,13 +2,21 @@
  * OpenPilot to ROS gateway and uavtalk relay
  */
 
+#include <sstream>
+#include <iomanip>
+
 #include "ros/ros.h"
 #include "ros/console.h"
+#include "std_srvs/Empty.h"
 
 #include "uavobjectmanager.h"
 #include "uavobjectsinit.h"
 #include "telemetrymanager.h"
 #include "uavtalkrelay.h"
+#include "flightrecorder.h"
+#include "latencytracer.h"
+#include "telemetrybudget.h"
+#include "settingscache.h"
 #include "iodrivers/uavtalkserialio.h"
 #include "iodrivers/uavtalkudpio.h"
 
@@ -19,11 +27,52 @@ using namespace openpilot;
 boost::shared_ptr<UAVObjectManager> g_objMngr;
 static boost::shared_ptr<TelemetryManager> m_telMngr;
 static boost::shared_ptr<UAVTalkRelay> m_relay;
+static boost::shared_ptr<FlightRecorder> m_recorder;
+static boost::shared_ptr<LatencyTracer> m_tracer;
+static boost::shared_ptr<TrafficShaper> m_shaper;
+static boost::shared_ptr<TelemetryBudget> m_budget;
+static boost::shared_ptr<SettingsCache> m_cache;
+static bool m_budget_apply;
 
 
 static void telem_connected(void)
 {
 	ROS_INFO("Telemetry connected");
+
+	if (!m_budget)
+		return;
+
+	TelemetryBudget::Report report = m_budget->solve();
+	ROS_INFO("Telemetry budget: %.0f B/s link, TX %.0f B/s, RX %.0f B/s",
+			report.capacity, report.load[TelemetryBudget::DIR_TX], report.load[TelemetryBudget::DIR_RX]);
+	if (report.fits)
+		return;
+
+	for (std::vector<TelemetryBudget::Item>::iterator it = report.items.begin(); it != report.items.end(); ++it) {
+		if (it->proposedMs != it->periodMs)
+			ROS_WARN("Telemetry budget: %s %s period %d -> %d ms", it->obj->getName().c_str(),
+					(it->dir == TelemetryBudget::DIR_TX) ? "gcs" : "flight", it->periodMs, it->proposedMs);
+	}
+
+	if (!report.solved)
+		ROS_WARN("Telemetry budget: link overloaded by critical objects");
+
+	if (m_budget_apply)
+		m_budget->apply(report);
+}
+
+static void set_budget_priority(ros::NodeHandle &nh, const std::string &param, TelemetryBudget::Priority priority)
+{
+	std::vector<std::string> names;
+	nh.getParam(param, names);
+
+	for (std::vector<std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+		UAVObject *obj = g_objMngr->getObject(*it);
+		if (obj != NULL)
+			m_budget->setPriority(obj->getObjID(), priority);
+		else
+			ROS_WARN_STREAM("Telemetry budget: unknown object " << *it);
+	}
 }
 
 static void telem_disconnected(void)
@@ -31,6 +80,48 @@ static void telem_disconnected(void)
 	ROS_INFO("Telemetry disconnected");
 }
 
+static bool dump_recorder(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
+{
+	m_recorder->dump("request");
+	return true;
+}
+
+static bool dump_latency(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
+{
+	std::ostringstream out;
+
+	m_tracer->dump(out);
+	ROS_INFO_STREAM("Receive latency, us:" << std::endl << out.str());
+	return true;
+}
+
+static bool dump_traffic(std_srvs::Empty::Request &req, std_srvs::Empty::Response &res)
+{
+	TrafficStats *traffic = m_telMngr->getTrafficStats();
+	if (traffic == NULL)
+		return false;
+
+	std::vector<TrafficStats::ObjectStats> all = traffic->getAll();
+	std::ostringstream out;
+
+	out << std::left << std::setw(28) << "object" << std::right
+		<< std::setw(10) << "rx" << std::setw(12) << "rx bytes" << std::setw(8) << "rx err"
+		<< std::setw(10) << "tx" << std::setw(12) << "tx bytes" << std::setw(8) << "tx err"
+		<< std::setw(10) << "rate Hz" << std::setw(12) << "jitter ms" << std::endl;
+
+	for (std::vector<TrafficStats::ObjectStats>::iterator it = all.begin(); it != all.end(); ++it) {
+		UAVObject *obj = g_objMngr->getObject(it->objId);
+		out << std::left << std::setw(28) << ((obj) ? obj->getName() : "(unknown)") << std::right
+			<< std::setw(10) << it->rxFrames << std::setw(12) << it->rxBytes << std::setw(8) << it->rxErrors
+			<< std::setw(10) << it->txFrames << std::setw(12) << it->txBytes << std::setw(8) << it->txErrors
+			<< std::fixed << std::setprecision(1)
+			<< std::setw(10) << it->rxRate << std::setw(12) << it->rxJitterMs << std::endl;
+	}
+
+	ROS_INFO_STREAM("Link traffic by object:" << std::endl << out.str());
+	return true;
+}
+
 int main(int argc, char **argv)
 {
 	ros::init(argc, argv, "opgateway");
@@ -41,25 +132,102 @@ int main(int argc, char **argv)
 	int serial_baudrate;
 	std::string relay_bind;
 	int relay_port;
+	int recorder_size;
+	int recorder_window;
+	std::string recorder_prefix;
+	bool latency_tracing;
+	std::string budget_mode;
+	double budget_utilization;
+	bool adaptive_periods;
+	bool traffic_shaping;
+	int retrieve_window;
+	std::string settings_cache;
+	bool lazy_objects;
 
 	priv_nh.param<std::string>("serial_port", serial_port, "/dev/ttyUSB0");
 	priv_nh.param<int>("serial_baudrate", serial_baudrate, 57600);
 	priv_nh.param<std::string>("relay_bind", relay_bind, "0.0.0.0");
 	priv_nh.param<int>("relay_port", relay_port, 9000);
+	priv_nh.param<int>("recorder_size", recorder_size, 4096);
+	priv_nh.param<int>("recorder_window", recorder_window, 10000);
+	priv_nh.param<std::string>("recorder_prefix", recorder_prefix, "/tmp/opgateway-recorder");
+	priv_nh.param<bool>("latency_tracing", latency_tracing, true);
+	priv_nh.param<std::string>("budget_mode", budget_mode, "warn");
+	priv_nh.param<double>("budget_utilization", budget_utilization, 0.8);
+	priv_nh.param<bool>("adaptive_periods", adaptive_periods, false);
+	priv_nh.param<bool>("traffic_shaping", traffic_shaping, true);
+	priv_nh.param<int>("retrieve_window", retrieve_window, 8);
+	priv_nh.param<std::string>("settings_cache", settings_cache, "");
+	priv_nh.param<bool>("lazy_objects", lazy_objects, false);
 
 	// Initialize UAVObject storage
+	// lazy_objects: objects are created on first use or reception
 	g_objMngr.reset(new UAVObjectManager());
-	UAVObjectsInitialize(g_objMngr.get());
+	if (lazy_objects)
+		UAVObjectsInitializeLazy(g_objMngr.get());
+	else
+		UAVObjectsInitialize(g_objMngr.get());
 
 	// Initialize IO devices
 	UAVTalkSerialIO *serial_io = new UAVTalkSerialIO(serial_port, serial_baudrate);
 	UAVTalkUDPIO *relay_io = new UAVTalkUDPIO(relay_bind, relay_port);
 
+	// Flight recorder, dumped on link loss, CRC error bursts or ~dump_recorder call
+	m_recorder.reset(new FlightRecorder(recorder_size, g_objMngr.get()));
+	m_recorder->setWindow(recorder_window);
+	m_recorder->setDumpPrefix(recorder_prefix);
+	ros::ServiceServer dump_srv = priv_nh.advertiseService("dump_recorder", dump_recorder);
+
+	// Receive latency histograms, printed on ~dump_latency call
+	ros::ServiceServer latency_srv;
+	ros::ServiceServer traffic_srv = priv_nh.advertiseService("dump_traffic", dump_traffic);
+	if (latency_tracing) {
+		m_tracer.reset(new LatencyTracer(g_objMngr.get()));
+		latency_srv = priv_nh.advertiseService("dump_latency", dump_latency);
+	}
+
+	// Periodic telemetry budget, checked on connect: off, warn or apply
+	if (budget_mode != "off") {
+		m_budget.reset(new TelemetryBudget(g_objMngr.get(), serial_baudrate));
+		m_budget->setUtilization(budget_utilization);
+		m_budget_apply = (budget_mode == "apply");
+		set_budget_priority(priv_nh, "budget_critical", TelemetryBudget::PRIORITY_CRITICAL);
+		set_budget_priority(priv_nh, "budget_high", TelemetryBudget::PRIORITY_HIGH);
+		set_budget_priority(priv_nh, "budget_low", TelemetryBudget::PRIORITY_LOW);
+	}
+
 	// Start device IO
 	m_telMngr.reset(new TelemetryManager(g_objMngr.get()));
+	m_telMngr->setFlightRecorder(m_recorder.get());
+	m_telMngr->setLatencyTracer(m_tracer.get());
+	if (traffic_shaping) {
+		// handshake and acks are not delayed by telemetry floods
+		m_shaper.reset(new TrafficShaper(serial_io, serial_baudrate));
+		m_telMngr->setTrafficShaper(m_shaper.get());
+	}
 	m_telMngr->connected.connect(telem_connected);
 	m_telMngr->disconnected.connect(telem_disconnected);
 	m_telMngr->start(serial_io);
+	m_telMngr->getTelemetryMonitor()->setRetrieveWindow(retrieve_window);
+
+	// Settings snapshot, reconnect retrieves only a few objects if settings are not changed
+	// (not with lazy_objects, the object set differs between connections)
+	if (!settings_cache.empty() && !lazy_objects) {
+		m_cache.reset(new SettingsCache(g_objMngr.get(), settings_cache));
+		m_telMngr->getTelemetryMonitor()->setSettingsCache(m_cache.get());
+	}
+
+	// Back off periodic updates on link congestion, budget_critical objects keep their rate
+	if (adaptive_periods) {
+		std::vector<std::string> names;
+		priv_nh.getParam("budget_critical", names);
+		for (std::vector<std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+			UAVObject *obj = g_objMngr->getObject(*it);
+			if (obj != NULL)
+				m_telMngr->getTelemetry()->setCritical(obj->getObjID(), true);
+		}
+		m_telMngr->getTelemetry()->setAdaptivePeriods(true);
+	}
 
 	// Relay server
 	ROS_INFO_STREAM("UAVTalk Relay listen on " << relay_bind << " port " << relay_port);
@@ -69,6 +237,19 @@ int main(int argc, char **argv)
 		ros::spin();
 	}
 
+	// Stop threads before the objects they call into are destroyed:
+	// link reads, then telemetry timers (UAVTalk enqueues to the shaper
+	// from the io thread), then the shaper; recorder and tracer go last
+	serial_io->stop();
+	relay_io->stop();
+	m_telMngr.reset();
+	m_shaper.reset();
+	m_cache.reset();
+	m_budget.reset();
+	m_relay.reset();
+	m_tracer.reset();
+	m_recorder.reset();
+
 	return 0;
 }
 
@@ -28,7 +28,7 @@ using namespace openpilot;
 /** Constructor
  */
 UAVDataObject::UAVDataObject(uint32_t objID, bool isSingleInst, bool isSet, const std::string &name) :
-	UAVObject(objID, isSingleInst, name)
+	UAVObject(objID, isSingleInst, name, KIND_DATA)
 {
 	mobj = NULL;
 	this->isSet = isSet;
@@ -42,6 +42,12 @@ public:
 	virtual UAVDataObject *clone(uint32_t instID = 0) = 0;
 	virtual UAVDataObject *dirtyClone() = 0;
 
+	/** Checked downcast by kind tag, NULL if obj is not a data object */
+	static UAVDataObject *cast(UAVObject *obj)
+	{
+		return (obj != NULL && obj->isDataObject()) ? static_cast<UAVDataObject *>(obj) : NULL;
+	}
+
 	//ssize_t serialize(uint8_t *dataOut);
 	//ssize_t deserialize(uint8_t *dataIn);
 
@@ -23,13 +23,14 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 #include "uavmetaobject.h"
+#include "uavobjectcodec.h"
 
 using namespace openpilot;
 
 /** Constructor
  */
 UAVMetaObject::UAVMetaObject(uint32_t objID, const std::string &name, UAVObject *parent) :
-	UAVObject(objID, true, name)
+	UAVObject(objID, true, name, KIND_META)
 {
 	this->parent = parent;
 	// Setup default metadata of metaobject (can not be changed)
@@ -91,23 +92,37 @@ UAVObject::Metadata UAVMetaObject::getData()
 	return parentMetadata;
 }
 
-/** serialize metadata
+/** serialize metadata, periods are little endian on the wire
  */
 ssize_t UAVMetaObject::serialize(uint8_t *dataOut)
 {
 	boost::recursive_timed_mutex::scoped_lock lock(mutex);
 
-	memcpy(dataOut, &parentMetadata, sizeof(parentMetadata));
+	// copy out of the packed struct, its members may be unaligned
+	const uint16_t periods[3] = {
+		parentMetadata.flightTelemetryUpdatePeriod,
+		parentMetadata.gcsTelemetryUpdatePeriod,
+		parentMetadata.loggingUpdatePeriod
+	};
+
+	UAVObjectCodec::pack(dataOut, &parentMetadata.flags, 1);
+	UAVObjectCodec::pack(dataOut + 1, periods, 3);
 	return sizeof(parentMetadata);
 }
 
-/** deserialize metadata
+/** deserialize metadata, see serialize()
  */
 ssize_t UAVMetaObject::deserialize(const uint8_t *dataIn)
 {
 	boost::recursive_timed_mutex::scoped_lock lock(mutex);
 
-	memcpy(&parentMetadata, dataIn, sizeof(parentMetadata));
+	uint16_t periods[3];
+
+	UAVObjectCodec::unpack(&parentMetadata.flags, dataIn, 1);
+	UAVObjectCodec::unpack(periods, dataIn + 1, 3);
+	parentMetadata.flightTelemetryUpdatePeriod = periods[0];
+	parentMetadata.gcsTelemetryUpdatePeriod = periods[1];
+	parentMetadata.loggingUpdatePeriod = periods[2];
 
 	objectUnpacked(this); // emit unpacked event
 	objectUpdated(this); // emit updated event
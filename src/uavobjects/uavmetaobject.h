@@ -25,11 +25,12 @@
 #define UAVMETAOBJECT_H
 
 #include "uavobject.h"
+#include "uavobjectpool.h"
 
 namespace openpilot
 {
 
-class UAVMetaObject : public UAVObject {
+class UAVMetaObject : public UAVObject, public PoolAllocated<UAVMetaObject> {
 public:
 	UAVMetaObject(uint32_t objID, const std::string & name, UAVObject *parent);
 	UAVObject *getParentObject();
@@ -43,6 +44,12 @@ public:
 	ssize_t deserialize(const uint8_t *dataIn);
 	std::string toStringData();
 
+	/** Checked downcast by kind tag, NULL if obj is not a metaobject */
+	static UAVMetaObject *cast(UAVObject *obj)
+	{
+		return (obj != NULL && obj->isMetaObject()) ? static_cast<UAVMetaObject *>(obj) : NULL;
+	}
+
 private:
 	UAVObject *parent;
 	Metadata ownMetadata;
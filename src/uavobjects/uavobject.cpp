@@ -29,17 +29,23 @@
 
 using namespace openpilot;
 
+const uint32_t UAVObject::INVALID_TYPE_INDEX;
+
 /** Constructor
  * @param objID The object ID
  * @param isSingleInst True if this object can only have a single instance
  * @param name Object name
+ * @param kind Class of the derived object
  */
-UAVObject::UAVObject(uint32_t objID, bool isSingleInst, const std::string &name)
+UAVObject::UAVObject(uint32_t objID, bool isSingleInst, const std::string &name, Kind kind)
 {
 	this->objID  = objID;
 	this->instID = 0;
 	this->isSingleInst = isSingleInst;
+	this->kind   = kind;
+	this->typeIndex = INVALID_TYPE_INDEX;
 	this->name   = name;
+	this->dataCached = true;
 }
 
 /** Initialize object with its instance ID
@@ -72,6 +78,35 @@ bool UAVObject::isSingleInstance()
 	return isSingleInst;
 }
 
+/** Get the dense type index, assigned by UAVObjectManager on registration.
+ * All instances of a type share one index, metaobjects have their own.
+ * \return index or INVALID_TYPE_INDEX if object is not registered
+ */
+uint32_t UAVObject::getTypeIndex()
+{
+	return typeIndex;
+}
+
+void UAVObject::setTypeIndex(uint32_t typeIndex)
+{
+	this->typeIndex = typeIndex;
+}
+
+/** Keep received data in the object (default).
+ * If disabled, UAVTalk only emits objectReceived with the frame payload
+ * and the object (getData(), objectUpdated, relay) keeps the old data.
+ * Meant for high rate objects read only through T::View.
+ */
+void UAVObject::setDataCached(bool cached)
+{
+	dataCached = cached;
+}
+
+bool UAVObject::isDataCached()
+{
+	return dataCached;
+}
+
 /** Get the name of the object
 */
 std::string UAVObject::getName()
@@ -45,6 +45,7 @@ namespace openpilot
 
 class UAVObject {
 public:
+	static const uint32_t INVALID_TYPE_INDEX = 0xFFFFFFFF;
 
 	/** Object update mode
 	 */
@@ -85,12 +86,26 @@ public:
 		uint16_t loggingUpdatePeriod; /** Update period used by the logging module (only if logging mode is PERIODIC) */
 	} __attribute__((packed)) Metadata;
 
+	/** Object class, replaces dynamic_cast in type tests
+	 */
+	typedef enum {
+		KIND_DATA,	/** UAVDataObject */
+		KIND_META	/** UAVMetaObject */
+	} Kind;
+
 
-	UAVObject(uint32_t objID, bool isSingleInstance, const std::string &name);
+	UAVObject(uint32_t objID, bool isSingleInstance, const std::string &name, Kind kind);
 	void initialize(uint32_t instID);
 	uint32_t getObjID();
 	uint32_t getInstID();
 	bool isSingleInstance();
+	Kind getKind() { return kind; }
+	bool isMetaObject() { return kind == KIND_META; }
+	bool isDataObject() { return kind == KIND_DATA; }
+	uint32_t getTypeIndex();
+	void setTypeIndex(uint32_t typeIndex);
+	void setDataCached(bool cached);
+	bool isDataCached();
 	std::string getName();
 	size_t getNumBytes();
 	virtual ssize_t serialize(uint8_t *dataOut) = 0;
@@ -127,6 +142,7 @@ public:
 	void requestUpdate();
 	void updated();
 
+	boost::signals2::signal<void(UAVObject *, const uint8_t *data)> objectReceived;	/** raw payload, valid during the call */
 	boost::signals2::signal<void(UAVObject *)> objectUnpacked;
 	boost::signals2::signal<void(UAVObject *)> objectUpdated;
 	boost::signals2::signal<void(UAVObject *)> objectUpdatedAuto;
@@ -140,6 +156,9 @@ protected:
 	uint32_t objID;
 	uint32_t instID;
 	bool isSingleInst;
+	Kind kind;
+	uint32_t typeIndex;
+	bool dataCached;
 	std::string name;
 	boost::recursive_timed_mutex mutex;
 	uint8_t *data;
@@ -0,0 +1,125 @@
+/**
+ ******************************************************************************
+ * @file       uavobjectcodec.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief      Field codec of generated objects
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef UAVOBJECTCODEC_H
+#define UAVOBJECTCODEC_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define UAVOBJ_BIG_ENDIAN 1
+#else
+#define UAVOBJ_BIG_ENDIAN 0
+#endif
+
+namespace openpilot
+{
+
+/** Conversion of field arrays between host and UAVTalk wire format
+ * (little endian, fields without padding).
+ *
+ * Generated PackData()/UnpackData() call pack()/unpack() once per field
+ * with the wire offset of the field. If DataFields has the wire layout
+ * on a little endian host, they copy the whole struct instead.
+ */
+namespace UAVObjectCodec
+{
+
+static const bool HOST_LITTLE_ENDIAN = !UAVOBJ_BIG_ENDIAN;
+
+/** Reverse bytes of count elements of size N in place.
+ * Simple loops over fixed size elements, vectorized by the compiler.
+ */
+template<size_t N>
+struct ByteSwap;
+
+template<>
+struct ByteSwap<1> {
+	static void apply(uint8_t *data, size_t count) { }
+};
+
+template<>
+struct ByteSwap<2> {
+	static void apply(uint8_t *data, size_t count)
+	{
+		for (size_t n = 0; n < count; ++n, data += 2) {
+			uint16_t value;
+			memcpy(&value, data, sizeof(value));
+			value = __builtin_bswap16(value);
+			memcpy(data, &value, sizeof(value));
+		}
+	}
+};
+
+template<>
+struct ByteSwap<4> {
+	static void apply(uint8_t *data, size_t count)
+	{
+		for (size_t n = 0; n < count; ++n, data += 4) {
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			value = __builtin_bswap32(value);
+			memcpy(data, &value, sizeof(value));
+		}
+	}
+};
+
+template<>
+struct ByteSwap<8> {
+	static void apply(uint8_t *data, size_t count)
+	{
+		for (size_t n = 0; n < count; ++n, data += 8) {
+			uint64_t value;
+			memcpy(&value, data, sizeof(value));
+			value = __builtin_bswap64(value);
+			memcpy(data, &value, sizeof(value));
+		}
+	}
+};
+
+/** Write count elements to the wire buffer (may be unaligned)
+ */
+template<typename T>
+inline void pack(uint8_t *dataOut, const T *values, size_t count)
+{
+	memcpy(dataOut, values, count * sizeof(T));
+	if (!HOST_LITTLE_ENDIAN)
+		ByteSwap<sizeof(T)>::apply(dataOut, count);
+}
+
+/** Read count elements from the wire buffer (may be unaligned)
+ */
+template<typename T>
+inline void unpack(T *values, const uint8_t *dataIn, size_t count)
+{
+	memcpy(values, dataIn, count * sizeof(T));
+	if (!HOST_LITTLE_ENDIAN)
+		ByteSwap<sizeof(T)>::apply(reinterpret_cast<uint8_t *>(values), count);
+}
+
+} // namespace UAVObjectCodec
+
+} // namespace openpilot
+
+#endif // UAVOBJECTCODEC_H
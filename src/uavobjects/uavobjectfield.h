@@ -0,0 +1,124 @@
+/**
+ ******************************************************************************
+ * @file       uavobjectfield.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief      Field descriptors of generated objects
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef UAVOBJECTFIELD_H
+#define UAVOBJECTFIELD_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+
+namespace openpilot
+{
+
+/** Static description of one DataFields member.
+ *
+ * Each generated object has a constant table FIELDS[NUMFIELDS] in
+ * DataFields order (see $(FIELDDESCRIPTORS) in uavobject.cpp.template),
+ * so generic code may walk any object type without virtual calls:
+ *
+ *   for (size_t n = 0; n < T::NUMFIELDS; ++n)
+ *       out << T::FIELDS[n].name << " " << T::FIELDS[n].getDouble(&data, 0);
+ */
+struct UAVObjectField {
+	typedef enum {
+		TYPE_INT8,
+		TYPE_INT16,
+		TYPE_INT32,
+		TYPE_UINT8,
+		TYPE_UINT16,
+		TYPE_UINT32,
+		TYPE_FLOAT32,
+		TYPE_ENUM	/** uint8_t, option names in options[] */
+	} Type;
+
+	const char *name;
+	Type type;
+	uint32_t numElements;
+	size_t offset;			/** in DataFields */
+	const char *units;
+	const char *const *options;	/** enum option names or NULL */
+	uint32_t numOptions;
+
+	/** Size of one element */
+	size_t getElementSize() const
+	{
+		switch (type) {
+		case TYPE_INT16:
+		case TYPE_UINT16:
+			return 2;
+		case TYPE_INT32:
+		case TYPE_UINT32:
+		case TYPE_FLOAT32:
+			return 4;
+		default:
+			return 1;
+		}
+	}
+
+	size_t getNumBytes() const
+	{
+		return getElementSize() * numElements;
+	}
+
+	/** Read element as double
+	 * \param[in] data DataFields of the object
+	 * \param[in] index Element index
+	 */
+	double getDouble(const void *data, uint32_t index) const
+	{
+		const uint8_t *p = static_cast<const uint8_t *>(data) + offset + index * getElementSize();
+
+		switch (type) {
+		case TYPE_INT8:    return read<int8_t>(p);
+		case TYPE_INT16:   return read<int16_t>(p);
+		case TYPE_INT32:   return read<int32_t>(p);
+		case TYPE_UINT16:  return read<uint16_t>(p);
+		case TYPE_UINT32:  return read<uint32_t>(p);
+		case TYPE_FLOAT32: return read<float>(p);
+		default:           return read<uint8_t>(p);
+		}
+	}
+
+	/** Option name of enum element, NULL if out of range
+	 */
+	const char *getOption(const void *data, uint32_t index) const
+	{
+		uint8_t value = static_cast<const uint8_t *>(data)[offset + index];
+
+		return (options != NULL && value < numOptions) ? options[value] : NULL;
+	}
+
+private:
+	// data may be a copy at unaligned address
+	template<typename T>
+	static T read(const uint8_t *p)
+	{
+		T value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+};
+
+} // namespace openpilot
+
+#endif // UAVOBJECTFIELD_H
@@ -22,12 +22,36 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 #include "uavobjectmanager.h"
+#include "uavobjectcodec.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <boost/bind.hpp>
+#include <boost/crc.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 using namespace openpilot;
 
+/** Store value little endian, snapshot header and entries */
+template<typename T>
+static inline void putLE(uint8_t *out, T value)
+{
+	UAVObjectCodec::pack(out, &value, 1);
+}
+
+template<typename T>
+static inline T getLE(const uint8_t *in)
+{
+	T value;
+	UAVObjectCodec::unpack(&value, in, 1);
+	return value;
+}
+
 /** Constructor
  */
-UAVObjectManager::UAVObjectManager()
+UAVObjectManager::UAVObjectManager() :
+	numTypes(0)
 {
 }
 
@@ -61,7 +85,7 @@ bool UAVObjectManager::registerObject(UAVDataObject *obj)
 		// The object type has alredy been added, so now we need to initialize the new instance with the appropriate id
 		// There is a single metaobject for all object instances of this type, so no need to create a new one
 		// Get object type metaobject from existing instance
-		UAVDataObject *refObj = dynamic_cast<UAVDataObject *>(objs[0]);
+		UAVDataObject *refObj = UAVDataObject::cast(objs[0]);
 		if (refObj == NULL)
 			return false;
 
@@ -83,6 +107,7 @@ bool UAVObjectManager::registerObject(UAVDataObject *obj)
 			for (uint32_t instidx = objs.size(); instidx < obj->getInstID(); ++instidx) {
 				UAVDataObject *cobj = obj->clone(instidx);
 				cobj->initialize(mobj);
+				cobj->setTypeIndex(refObj->getTypeIndex());
 				objs.push_back(cobj);
 				getObject(cobj->getObjID())->newInstance(cobj);
 
@@ -101,6 +126,7 @@ bool UAVObjectManager::registerObject(UAVDataObject *obj)
 		}
 
 		// Add the actual object instance in the list
+		obj->setTypeIndex(refObj->getTypeIndex());
 		objs.push_back(obj);
 		// emit signals
 		getObject(obj->getObjID())->newInstance(obj);
@@ -112,6 +138,8 @@ bool UAVObjectManager::registerObject(UAVDataObject *obj)
 
 	// If this point is reached then this is the first time this object type (ID) is added in the list
 	// create a new list of the instances, add in the object collection and create the object's metaobject
+	lazyTypes.erase(obj->getObjID());
+
 	// Create metaobject
 	std::string mname = obj->getName();
 	mname.append("Meta");
@@ -125,10 +153,51 @@ bool UAVObjectManager::registerObject(UAVDataObject *obj)
 	return true;
 }
 
+/** Register an object type without creating it (lazy mode, see UAVObjectsInitializeLazy()).
+ * The object and its metaobject are created on the first getObject() of
+ * either ID, e.g. by GetInstance() or when UAVTalk receives the object;
+ * newObject is emitted then. Until that getObjects() does not return them.
+ */
+bool UAVObjectManager::registerType(uint32_t objId, const std::string &name, ObjectFactory factory)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (objects.find(objId) != objects.end())
+		return false;
+
+	lazyTypes[objId] = factory;
+	name_to_objid[name] = objId;
+	name_to_objid[name + "Meta"] = objId + 1;
+
+	return true;
+}
+
+/** Create object of a lazily registered type
+ * \param[in] objId Object or metaobject ID
+ * \return false if there is no such type
+ */
+bool UAVObjectManager::createType(uint32_t objId)
+{
+	if (lazyTypes.empty())
+		return false;
+
+	std::map<uint32_t, ObjectFactory>::iterator it = lazyTypes.find(objId);
+	if (it == lazyTypes.end())
+		it = lazyTypes.find(objId - 1);
+	if (it == lazyTypes.end())
+		return false;
+
+	ObjectFactory factory = it->second;
+	lazyTypes.erase(it);
+
+	return registerObject(factory());
+}
+
 void UAVObjectManager::addObject(UAVObject *obj)
 {
 	// Add to list
 	inst_vec vec;
+	obj->setTypeIndex(numTypes++);
 	vec.push_back(obj);
 	objects[obj->getObjID()] = vec;
 	name_to_objid[obj->getName()] = obj->getObjID();
@@ -166,6 +235,9 @@ UAVObject *UAVObjectManager::getObject(uint32_t objId, uint32_t instId)
 	objects_map::iterator it;
 
 	it = objects.find(objId);
+	if (it == objects.end() && createType(objId))
+		it = objects.find(objId);
+
 	if (it != objects.end()) {
 		inst_vec &objs = it->second;
 
@@ -199,6 +271,9 @@ UAVObjectManager::inst_vec UAVObjectManager::getObjectInstances(uint32_t objId)
 	objects_map::iterator it;
 
 	it = objects.find(objId);
+	if (it == objects.end() && createType(objId))
+		it = objects.find(objId);
+
 	if (it != objects.end())
 		return it->second;
 
@@ -218,6 +293,25 @@ ssize_t UAVObjectManager::getNumInstances(const std::string &name)
 	return getNumInstances(it->second);
 }
 
+/** Get the number of registered object types (data and meta),
+ * type indexes are 0 .. getNumTypes() - 1
+ */
+uint32_t UAVObjectManager::getNumTypes()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return numTypes;
+}
+
+/** Get the number of object types registered by registerType() and not created yet
+ */
+uint32_t UAVObjectManager::getNumLazyTypes()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return lazyTypes.size();
+}
+
 /** Get the number of instances for an object given its ID
  */
 ssize_t UAVObjectManager::getNumInstances(uint32_t objId)
@@ -226,11 +320,221 @@ ssize_t UAVObjectManager::getNumInstances(uint32_t objId)
 	objects_map::iterator it;
 
 	it = objects.find(objId);
+	if (it == objects.end() && createType(objId))
+		it = objects.find(objId);
+
 	if (it != objects.end())
 		return it->second.size();
 
 	return -1;
 }
 
+/** Write object data to a snapshot file (replaced atomically).
+ * Data is stored as serialized, metadata as metaobject data.
+ * \param[in] path Snapshot file
+ * \param[in] scope Settings only, settings with all metadata or all objects with all instances
+ * \return Success (true), Failure (false)
+ */
+bool UAVObjectManager::saveSnapshot(const std::string &path, SnapshotScope scope)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	std::vector<uint8_t> image(sizeof(SnapshotHeader));
+	SnapshotHeader header;
+
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.scope = scope;
+	header.count = 0;
+
+	for (objects_map::iterator it = objects.begin(); it != objects.end(); ++it) {
+		UAVObject *obj = it->second[0];
+
+		if (scope != SNAPSHOT_ALL) {
+			UAVMetaObject *mobj = UAVMetaObject::cast(obj);
+			UAVDataObject *dobj = UAVDataObject::cast((mobj != NULL) ? mobj->getParentObject() : obj);
+			bool settings = (dobj != NULL && dobj->isSettings());
+			if (!settings && !(mobj != NULL && scope == SNAPSHOT_SETTINGS_METADATA))
+				continue;
+		}
+
+		for (inst_vec::iterator inst_it = it->second.begin(); inst_it != it->second.end(); ++inst_it) {
+			SnapshotEntry entry;
+			size_t pos = image.size();
+
+			entry.objId = (*inst_it)->getObjID();
+			entry.instId = (*inst_it)->getInstID();
+			entry.length = (*inst_it)->getNumBytes();
+
+			image.resize(pos + sizeof(entry) + entry.length);
+			packEntry(&image[pos], entry);
+			(*inst_it)->serialize(&image[pos] + sizeof(entry));
+			header.count++;
+		}
+	}
+
+	boost::crc_32_type crc;
+	// no entries: payload is empty, image[sizeof(header)] would be out of range
+	crc.process_bytes(&image[0] + sizeof(header), image.size() - sizeof(header));
+	header.length = image.size() - sizeof(header);
+	header.crc = crc.checksum();
+	packHeader(&image[0], header);
+
+	std::string tmp = path + ".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	out.write(reinterpret_cast<const char *>(&image[0]), image.size());
+	out.close();
+
+	if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/** Load object data from a snapshot file.
+ * Missing instances of multi-instance objects are created,
+ * entries of unknown objects or with other size are skipped.
+ * \param[in] path Snapshot file
+ * \return Number of loaded objects, -1 if file is missing or damaged
+ */
+ssize_t UAVObjectManager::loadSnapshot(const std::string &path)
+{
+	return readSnapshot(path, boost::bind(&UAVObjectManager::loadEntry, this, _1, _2, _3, _4));
+}
+
+/** Read a snapshot file without changing objects.
+ * File is memory mapped, visitor gets the entry data in place.
+ * \param[in] path Snapshot file
+ * \param[in] visitor Called for each entry
+ * \return Number of entries used by visitor, -1 if file is missing or damaged
+ */
+ssize_t UAVObjectManager::readSnapshot(const std::string &path, const SnapshotVisitor &visitor)
+{
+	using namespace boost::interprocess;
+
+	file_mapping file;
+	mapped_region region;
+
+	try {
+		file_mapping f(path.c_str(), read_only);
+		mapped_region r(f, read_only);
+		file.swap(f);
+		region.swap(r);
+	} catch (interprocess_exception &ex) {
+		return -1;
+	}
+
+	const uint8_t *image = static_cast<const uint8_t *>(region.get_address());
+	size_t size = region.get_size();
+	SnapshotHeader header;
+
+	if (size < sizeof(header))
+		return -1;
+
+	unpackHeader(header, image);
+	if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+			header.length != size - sizeof(header))
+		return -1;
+
+	boost::crc_32_type crc;
+	crc.process_bytes(image + sizeof(header), header.length);
+	if (crc.checksum() != header.crc)
+		return -1;
+
+	size_t pos = sizeof(header);
+	ssize_t used = 0;
+
+	for (uint32_t n = 0; n < header.count && pos + sizeof(SnapshotEntry) <= size; ++n) {
+		SnapshotEntry entry;
+
+		unpackEntry(entry, image + pos);
+		pos += sizeof(entry);
+		if (pos + entry.length > size)
+			break;
+
+		if (visitor(entry.objId, entry.instId, image + pos, entry.length))
+			used++;
+
+		pos += entry.length;
+	}
+
+	return used;
+}
+
+/** Deserialize snapshot entry into the object instance
+ */
+bool UAVObjectManager::loadEntry(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	UAVObject *obj = getOrCreateInstance(objId, instId);
+	if (obj == NULL || obj->getNumBytes() != length)
+		return false;
+
+	obj->deserialize(data);
+	return true;
+}
+
+void UAVObjectManager::packHeader(uint8_t *out, const SnapshotHeader &header)
+{
+	putLE(out + 0, header.magic);
+	putLE(out + 4, header.version);
+	putLE(out + 6, header.scope);
+	putLE(out + 8, header.count);
+	putLE(out + 12, header.length);
+	putLE(out + 16, header.crc);
+}
+
+void UAVObjectManager::unpackHeader(SnapshotHeader &header, const uint8_t *in)
+{
+	header.magic   = getLE<uint32_t>(in + 0);
+	header.version = getLE<uint16_t>(in + 4);
+	header.scope   = getLE<uint16_t>(in + 6);
+	header.count   = getLE<uint32_t>(in + 8);
+	header.length  = getLE<uint32_t>(in + 12);
+	header.crc     = getLE<uint32_t>(in + 16);
+}
 
+void UAVObjectManager::packEntry(uint8_t *out, const SnapshotEntry &entry)
+{
+	putLE(out + 0, entry.objId);
+	putLE(out + 4, entry.instId);
+	putLE(out + 6, entry.length);
+}
 
+void UAVObjectManager::unpackEntry(SnapshotEntry &entry, const uint8_t *in)
+{
+	entry.objId  = getLE<uint32_t>(in + 0);
+	entry.instId = getLE<uint16_t>(in + 4);
+	entry.length = getLE<uint16_t>(in + 6);
+}
+
+/** Find instance, instances are usually stored in instance ID order.
+ * Missing instance of a multi-instance data object is created.
+ */
+UAVObject *UAVObjectManager::getOrCreateInstance(uint32_t objId, uint16_t instId)
+{
+	objects_map::iterator it = objects.find(objId);
+	if (it == objects.end() && createType(objId))
+		it = objects.find(objId);
+	if (it == objects.end())
+		return NULL;
+
+	inst_vec &objs = it->second;
+	if (instId < objs.size() && objs[instId]->getInstID() == instId)
+		return objs[instId];
+
+	UAVObject *obj = getObject(objId, instId);
+	if (obj != NULL)
+		return obj;
+
+	UAVDataObject *refObj = UAVDataObject::cast(objs[0]);
+	if (refObj == NULL || refObj->isSingleInstance() || instId >= MAX_INSTANCES)
+		return NULL;
+
+	if (!registerObject(refObj->clone(instId)))
+		return NULL;
+
+	return getObject(objId, instId);
+}
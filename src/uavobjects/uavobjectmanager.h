@@ -29,10 +29,20 @@
 #include "uavmetaobject.h"
 #include <vector>
 #include <map>
+#include <string>
+#include <boost/function.hpp>
 
 namespace openpilot
 {
 
+/** Factory of generated object T, for UAVObjectManager::registerType()
+ */
+template<class T>
+UAVDataObject *UAVObjectFactory()
+{
+	return new T();
+}
+
 class UAVObjectManager {
 public:
 	UAVObjectManager();
@@ -40,8 +50,19 @@ public:
 
 	typedef std::vector<UAVObject *> inst_vec;
 	typedef std::map<uint32_t, inst_vec> objects_map;
+	typedef UAVDataObject *(*ObjectFactory)();
+
+	typedef enum {
+		SNAPSHOT_SETTINGS,	/** settings objects and their metaobjects */
+		SNAPSHOT_ALL,		/** all objects and instances */
+		SNAPSHOT_SETTINGS_METADATA	/** settings objects and all metaobjects */
+	} SnapshotScope;
+
+	/** Called for each snapshot entry, returns true if the entry was used */
+	typedef boost::function<bool(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length)> SnapshotVisitor;
 
 	bool registerObject(UAVDataObject *obj);
+	bool registerType(uint32_t objId, const std::string &name, ObjectFactory factory);
 	objects_map getObjects();
 	//std::map<uint32_t, std::vector<UAVDataObject *> > getDataObjects();
 	//std::map<uint32_t, std::vector<UAVMetaObject *> > getMetaObjects();
@@ -51,6 +72,12 @@ public:
 	inst_vec getObjectInstances(uint32_t objId);
 	ssize_t getNumInstances(const std::string &name);
 	ssize_t getNumInstances(uint32_t objId);
+	uint32_t getNumTypes();
+	uint32_t getNumLazyTypes();
+
+	bool saveSnapshot(const std::string &path, SnapshotScope scope = SNAPSHOT_SETTINGS);
+	ssize_t loadSnapshot(const std::string &path);
+	ssize_t readSnapshot(const std::string &path, const SnapshotVisitor &visitor);
 
 	// signals:
 	boost::signals2::signal<void(UAVObject *)> newObject;
@@ -58,12 +85,42 @@ public:
 
 private:
 	static const uint32_t MAX_INSTANCES = 1000;
+	static const uint32_t SNAPSHOT_MAGIC = 0x53564155;	/** "UAVS" */
+	static const uint16_t SNAPSHOT_VERSION = 1;
+
+	/** Snapshot file: header, then entries, each followed by object data.
+	 * Header and entry fields are little endian, object data is serialized
+	 * (UAVTalk wire format), so files are portable between hosts.
+	 */
+	typedef struct {
+		uint32_t magic;
+		uint16_t version;
+		uint16_t scope;
+		uint32_t count;		/** entries */
+		uint32_t length;	/** bytes after header */
+		uint32_t crc;		/** CRC-32 of bytes after header */
+	} __attribute__((packed)) SnapshotHeader;
+
+	typedef struct {
+		uint32_t objId;
+		uint16_t instId;
+		uint16_t length;
+	} __attribute__((packed)) SnapshotEntry;
 
 	objects_map objects;
+	std::map<uint32_t, ObjectFactory> lazyTypes;	/** registered, not created yet */
 	std::map<std::string, uint32_t> name_to_objid;
+	uint32_t numTypes;
 	boost::recursive_mutex mutex;
 
 	void addObject(UAVObject *obj);
+	bool loadEntry(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length);
+	static void packHeader(uint8_t *out, const SnapshotHeader &header);
+	static void unpackHeader(SnapshotHeader &header, const uint8_t *in);
+	static void packEntry(uint8_t *out, const SnapshotEntry &entry);
+	static void unpackEntry(SnapshotEntry &entry, const uint8_t *in);
+	bool createType(uint32_t objId);
+	UAVObject *getOrCreateInstance(uint32_t objId, uint16_t instId);
 };
 
 } // namespace openpilot
@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * @file       uavobjectpool.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief      Per-type pool allocation
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef UAVOBJECTPOOL_H
+#define UAVOBJECTPOOL_H
+
+#include <new>
+#include <boost/pool/singleton_pool.hpp>
+
+namespace openpilot
+{
+
+/** Base of classes allocated from a pool of their own type.
+ *
+ * new T takes a chunk of boost::singleton_pool<T, sizeof(T)>, so objects
+ * (and instances) of one type are contiguous, and delete returns it to
+ * the pool free list for the next new instead of the heap. Pool memory is
+ * kept until exit. Classes derived from T with other size use the heap.
+ *
+ *   class Foo : public Base, public PoolAllocated<Foo> { ... };
+ */
+template<class T>
+class PoolAllocated {
+public:
+	static void *operator new(size_t size)
+	{
+		if (size != sizeof(T))
+			return ::operator new(size);
+
+		void *p = boost::singleton_pool<T, sizeof(T)>::malloc();
+		if (p == NULL)
+			throw std::bad_alloc();
+
+		return p;
+	}
+
+	static void operator delete(void *p, size_t size)
+	{
+		if (p == NULL)
+			return;
+
+		if (size != sizeof(T))
+			::operator delete(p);
+		else
+			boost::singleton_pool<T, sizeof(T)>::free(p);
+	}
+};
+
+} // namespace openpilot
+
+#endif // UAVOBJECTPOOL_H
@@ -31,6 +31,7 @@ namespace openpilot
 {
 
 void UAVObjectsInitialize(UAVObjectManager *objMngr);
+void UAVObjectsInitializeLazy(UAVObjectManager *objMngr);
 
 } // namespace openpilot
 
@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * @file       uavobjectview.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief      Read-only access to serialized object data
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef UAVOBJECTVIEW_H
+#define UAVOBJECTVIEW_H
+
+#include "uavobjectcodec.h"
+
+namespace openpilot
+{
+
+/** Base of generated T::View classes.
+ *
+ * View reads fields directly from a buffer in UAVTalk layout (packed,
+ * little endian), e.g. frame passed by UAVObject::objectReceived,
+ * without copy into the object:
+ *
+ *   void attitudeReceived(UAVObject *obj, const uint8_t *data)
+ *   {
+ *       AttitudeState::View view(data);
+ *       float yaw = view.getYaw();
+ *   }
+ *
+ * View does not own the buffer and must not outlive it.
+ */
+class UAVObjectView {
+public:
+	explicit UAVObjectView(const uint8_t *data_) :
+		data(data_)
+	{ }
+
+	const uint8_t *getBuffer() const { return data; }
+
+protected:
+	const uint8_t *data;
+
+	/** Read value at wire offset, converted to host byte order
+	 */
+	template<typename T>
+	T get(size_t offset) const
+	{
+		T value;
+		UAVObjectCodec::unpack(&value, data + offset, 1);
+		return value;
+	}
+};
+
+} // namespace openpilot
+
+#endif // UAVOBJECTVIEW_H
@@ -0,0 +1,260 @@
+/**
+ ******************************************************************************
+ * @file       autopilotemulator.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Autopilot side of the UAVTalk link, for tests and benchmarks
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "autopilotemulator.h"
+#include "gcstelemetrystats.h"
+#include "flighttelemetrystats.h"
+
+using namespace openpilot;
+
+/** Constructor, timers run in own thread
+ */
+AutopilotEmulator::AutopilotEmulator(UAVTalkIOBase *iodev, UAVObjectManager *objMngr) :
+	UAVTalk(iodev, objMngr),
+	own_io_service(new boost::asio::io_service()),
+	io_service(*own_io_service),
+	io_work(new boost::asio::io_service::work(io_service)),
+	streamTimer(io_service),
+	statsTimer(io_service),
+	statsPeriod(boost::posix_time::milliseconds(DEFAULT_STATS_PERIOD_MS))
+{
+	init();
+
+	// run io_service for stream and stats timers
+	boost::thread t(boost::bind(&boost::asio::io_service::run, &this->io_service));
+	io_thread.swap(t);
+}
+
+/** Constructor, timers run in caller's io_service
+ */
+AutopilotEmulator::AutopilotEmulator(boost::asio::io_service &io, UAVTalkIOBase *iodev, UAVObjectManager *objMngr) :
+	UAVTalk(iodev, objMngr),
+	io_service(io),
+	streamTimer(io_service),
+	statsTimer(io_service),
+	statsPeriod(boost::posix_time::milliseconds(DEFAULT_STATS_PERIOD_MS))
+{
+	init();
+}
+
+AutopilotEmulator::~AutopilotEmulator()
+{
+	if (own_io_service.get() != NULL) {
+		io_work.reset();
+		io_service.stop();
+		io_thread.join();
+	}
+}
+
+void AutopilotEmulator::init()
+{
+	memset(&emuStats, 0, sizeof(emuStats));
+	memset(&lastStats, 0, sizeof(lastStats));
+
+	statsTimer.expires_from_now(statsPeriod);
+	statsTimer.async_wait(boost::bind(&AutopilotEmulator::processStats, this, boost::asio::placeholders::error));
+}
+
+/** Stream object at given rate
+ * \param[in] objId Object ID (instance 0 is sent)
+ * \param[in] rate Updates per second, 0 stops streaming
+ * \param[in] acked Send with OBJ_ACK
+ */
+void AutopilotEmulator::setStream(uint32_t objId, double rate, bool acked)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	for (std::vector<Stream>::iterator it = streams.begin(); it != streams.end(); ++it) {
+		if (it->obj->getObjID() == objId) {
+			streams.erase(it);
+			break;
+		}
+	}
+
+	UAVObject *obj = objMngr->getObject(objId);
+	if (obj != NULL && rate > 0) {
+		Stream s;
+		s.obj    = obj;
+		s.period = boost::posix_time::microseconds(int64_t(1000000 / rate));
+		s.next   = TelemetryClock::now();
+		s.acked  = acked;
+		streams.push_back(s);
+	}
+
+	io_service.post(boost::bind(&AutopilotEmulator::scheduleStreams, this));
+}
+
+/** Answer object requests with NACK, as if the object does not exist on the autopilot
+ */
+void AutopilotEmulator::setNack(uint32_t objId, bool nack)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (nack)
+		nackObjects.insert(objId);
+	else
+		nackObjects.erase(objId);
+}
+
+/** Set FlightTelemetryStats update period
+ */
+void AutopilotEmulator::setStatsPeriod(uint32_t periodMs)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	statsPeriod = boost::posix_time::milliseconds(periodMs);
+}
+
+bool AutopilotEmulator::isConnected()
+{
+	FlightTelemetryStats::DataFields flightStats = FlightTelemetryStats::GetInstance(objMngr)->getData();
+
+	return flightStats.Status == FlightTelemetryStats::STATUS_CONNECTED;
+}
+
+AutopilotEmulator::EmulatorStats AutopilotEmulator::getEmulatorStats()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return emuStats;
+}
+
+/** Receive an object, see UAVTalk::receiveObject().
+ * Handles NACK list and the connection handshake, the rest is done by UAVTalk.
+ */
+bool AutopilotEmulator::receiveObject(uint8_t type, uint32_t objId, uint16_t instId, uint8_t *data, size_t length)
+{
+	if (type == TYPE_OBJ_REQ) {
+		emuStats.objectRequests++;
+		if (nackObjects.find(objId) != nackObjects.end()) {
+			emuStats.nacksSent++;
+			transmitNack(objId);
+			return false;
+		}
+	} else if (type == TYPE_ACK) {
+		emuStats.acksReceived++;
+	}
+
+	bool ret = UAVTalk::receiveObject(type, objId, instId, data, length);
+
+	if ((type == TYPE_OBJ || type == TYPE_OBJ_ACK) && objId == GCSTelemetryStats::OBJID)
+		updateTelemetryStats();
+
+	return ret;
+}
+
+/** Flight side of the connection handshake (same as in the autopilot telemetry module)
+ */
+void AutopilotEmulator::updateTelemetryStats()
+{
+	FlightTelemetryStats *flightStatsObj = FlightTelemetryStats::GetInstance(objMngr);
+	FlightTelemetryStats::DataFields flightStats = flightStatsObj->getData();
+	GCSTelemetryStats::DataFields gcsStats = GCSTelemetryStats::GetInstance(objMngr)->getData();
+	uint8_t oldStatus = flightStats.Status;
+
+	if (flightStats.Status == FlightTelemetryStats::STATUS_DISCONNECTED) {
+		if (gcsStats.Status == GCSTelemetryStats::STATUS_HANDSHAKEREQ ||
+				gcsStats.Status == GCSTelemetryStats::STATUS_CONNECTED)
+			flightStats.Status = FlightTelemetryStats::STATUS_HANDSHAKEACK;
+	} else if (flightStats.Status == FlightTelemetryStats::STATUS_HANDSHAKEACK) {
+		if (gcsStats.Status == GCSTelemetryStats::STATUS_CONNECTED)
+			flightStats.Status = FlightTelemetryStats::STATUS_CONNECTED;
+		else if (gcsStats.Status == GCSTelemetryStats::STATUS_DISCONNECTED)
+			flightStats.Status = FlightTelemetryStats::STATUS_DISCONNECTED;
+	} else if (flightStats.Status == FlightTelemetryStats::STATUS_CONNECTED) {
+		if (gcsStats.Status != GCSTelemetryStats::STATUS_CONNECTED)
+			flightStats.Status = FlightTelemetryStats::STATUS_DISCONNECTED;
+	}
+
+	if (flightStats.Status != oldStatus) {
+		flightStatsObj->setData(flightStats);
+		sendObject(flightStatsObj, false, false);
+	}
+}
+
+/** Arm stream timer for the nearest object
+ */
+void AutopilotEmulator::scheduleStreams()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (streams.empty()) {
+		streamTimer.cancel();
+		return;
+	}
+
+	boost::posix_time::ptime next = streams[0].next;
+	for (std::vector<Stream>::iterator it = streams.begin(); it != streams.end(); ++it)
+		next = std::min(next, it->next);
+
+	streamTimer.expires_at(next);
+	streamTimer.async_wait(boost::bind(&AutopilotEmulator::processStreams, this, boost::asio::placeholders::error));
+}
+
+void AutopilotEmulator::processStreams(boost::system::error_code error)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (error)
+		return;
+
+	boost::posix_time::ptime now = TelemetryClock::now();
+	for (std::vector<Stream>::iterator it = streams.begin(); it != streams.end(); ++it) {
+		if (it->next > now)
+			continue;
+
+		objectSending(it->obj); // emit signal
+		if (sendObject(it->obj, it->acked, false))
+			emuStats.objectsStreamed++;
+
+		// do not try to catch up if we are late more than one period
+		it->next += it->period;
+		if (it->next < now)
+			it->next = now + it->period;
+	}
+
+	scheduleStreams();
+}
+
+void AutopilotEmulator::processStats(boost::system::error_code error)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (error)
+		return;
+
+	FlightTelemetryStats *flightStatsObj = FlightTelemetryStats::GetInstance(objMngr);
+	ComStats stats = getStats();
+	FlightTelemetryStats::DataFields flightStats = flightStatsObj->getData();
+
+	flightStats.TxDataRate = (stats.txBytes - lastStats.txBytes) / (statsPeriod.total_milliseconds() / 1000.0);
+	flightStats.RxDataRate = (stats.rxBytes - lastStats.rxBytes) / (statsPeriod.total_milliseconds() / 1000.0);
+	flightStats.RxFailures += stats.rxErrors - lastStats.rxErrors;
+	flightStats.TxFailures += stats.txErrors - lastStats.txErrors;
+	lastStats = stats;
+
+	flightStatsObj->setData(flightStats);
+	sendObject(flightStatsObj, false, false);
+
+	statsTimer.expires_from_now(statsPeriod);
+	statsTimer.async_wait(boost::bind(&AutopilotEmulator::processStats, this, boost::asio::placeholders::error));
+}
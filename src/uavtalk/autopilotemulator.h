@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * @file       autopilotemulator.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Autopilot side of the UAVTalk link, for tests and benchmarks
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef AUTOPILOTEMULATOR_H
+#define AUTOPILOTEMULATOR_H
+
+#include <set>
+#include <memory>
+#include "uavtalk.h"
+#include "telemetryclock.h"
+
+namespace openpilot
+{
+
+/** Emulates the flight side of the telemetry link.
+ *
+ * Answers the GCSTelemetryStats/FlightTelemetryStats handshake, object
+ * requests (with NACK for objects listed by setNack()) and acked updates,
+ * and streams selected objects at given rates.
+ * Uses its own UAVObjectManager, which must not be shared with the GCS side.
+ * Timers run in its own thread, or in the given io_service (e.g. one driven
+ * by a test together with TelemetryClock virtual time).
+ */
+class AutopilotEmulator : public UAVTalk {
+public:
+	typedef struct {
+		uint32_t objectRequests;
+		uint32_t nacksSent;
+		uint32_t acksReceived;
+		uint32_t objectsStreamed;
+	} EmulatorStats;
+
+	AutopilotEmulator(UAVTalkIOBase *iodev, UAVObjectManager *objMngr);
+	AutopilotEmulator(boost::asio::io_service &io, UAVTalkIOBase *iodev, UAVObjectManager *objMngr);
+	~AutopilotEmulator();
+
+	void setStream(uint32_t objId, double rate, bool acked = false);
+	void setNack(uint32_t objId, bool nack = true);
+	void setStatsPeriod(uint32_t periodMs);
+	bool isConnected();
+	EmulatorStats getEmulatorStats();
+
+	// signals:
+	boost::signals2::signal<void(UAVObject *obj)> objectSending; /** emitted before the streamed object is packed */
+
+private:
+	static const uint32_t DEFAULT_STATS_PERIOD_MS = 1000;
+
+	typedef struct {
+		UAVObject *obj;
+		boost::posix_time::time_duration period;
+		boost::posix_time::ptime next;
+		bool acked;
+	} Stream;
+
+	std::auto_ptr<boost::asio::io_service> own_io_service;
+	boost::asio::io_service &io_service;
+	std::auto_ptr<boost::asio::io_service::work> io_work;
+	boost::thread io_thread;
+	telemetry_timer streamTimer;
+	telemetry_timer statsTimer;
+	std::vector<Stream> streams;
+	std::set<uint32_t> nackObjects;
+	boost::posix_time::time_duration statsPeriod;
+	EmulatorStats emuStats;
+	ComStats lastStats;	/** link counters at previous stats update */
+
+	void init();
+	bool receiveObject(uint8_t type, uint32_t objId, uint16_t instId, uint8_t *data, size_t length);
+	void updateTelemetryStats();
+	void scheduleStreams();
+
+	// slots:
+	void processStreams(boost::system::error_code error);
+	void processStats(boost::system::error_code error);
+};
+
+} // namespace openpilot
+
+#endif // AUTOPILOTEMULATOR_H
@@ -0,0 +1,280 @@
+/**
+ ******************************************************************************
+ * @file       flightrecorder.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief In-memory recorder of the last UAVTalk frames and link events
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "flightrecorder.h"
+#include "uavtalkiobase.h"
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <ros/console.h>
+
+using namespace openpilot;
+
+static const char *frame_type_name(uint8_t type)
+{
+	// see UAVTalk::TYPE_*
+	switch (type) {
+	case 0x20: return "OBJ";
+	case 0x21: return "OBJ_REQ";
+	case 0x22: return "OBJ_ACK";
+	case 0x23: return "ACK";
+	case 0x24: return "NACK";
+	default:   return "?";
+	}
+}
+
+static const char *event_name(uint8_t ev)
+{
+	switch (ev) {
+	case FlightRecorder::EV_CRC_ERROR:      return "CRC_ERROR";
+	case FlightRecorder::EV_LENGTH_ERROR:   return "LENGTH_ERROR";
+	case FlightRecorder::EV_UNKNOWN_OBJECT: return "UNKNOWN_OBJECT";
+	case FlightRecorder::EV_TX_ERROR:       return "TX_ERROR";
+	case FlightRecorder::EV_CONNECTED:      return "CONNECTED";
+	case FlightRecorder::EV_DISCONNECTED:   return "DISCONNECTED";
+	default:                                return "?";
+	}
+}
+
+/** Constructor
+ * \param[in] capacity Number of records held in the ring
+ * \param[in] objMngr Used only to print object names in dumps (may be NULL)
+ */
+FlightRecorder::FlightRecorder(size_t capacity, UAVObjectManager *objMngr) :
+	capacity(capacity),
+	slots(new Slot[capacity]),
+	head(0),
+	objMngr(objMngr),
+	dumpPrefix("/tmp/opgateway-recorder"),
+	windowMs(DEFAULT_WINDOW_MS),
+	burstCount(DEFAULT_BURST_COUNT),
+	burstPeriodMs(DEFAULT_BURST_PERIOD_MS),
+	burstErrors(0),
+	burstStart(0),
+	dumping(false),
+	lastDump(0)
+{
+	for (size_t n = 0; n < capacity; ++n)
+		slots[n].seq.store(0, boost::memory_order_relaxed);
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	if (dumpThread.joinable())
+		dumpThread.join();
+}
+
+/** Set dump file prefix, files are named <prefix>-<time>-<reason>.log
+ */
+void FlightRecorder::setDumpPrefix(const std::string &prefix)
+{
+	dumpPrefix = prefix;
+}
+
+/** Set how many last milliseconds are written to the dump
+ */
+void FlightRecorder::setWindow(uint32_t windowMs)
+{
+	this->windowMs = windowMs;
+}
+
+/** Dump automatically if there are count CRC/length errors within periodMs
+ */
+void FlightRecorder::setErrorBurst(uint32_t count, uint32_t periodMs)
+{
+	burstCount = count;
+	burstPeriodMs = periodMs;
+}
+
+/** Record frame
+ * \param[in] dir REC_RX_FRAME or REC_TX_FRAME
+ * \param[in] type UAVTalk frame type
+ * \param[in] objId Object ID
+ * \param[in] instId Instance ID
+ * \param[in] data Payload
+ * \param[in] length Payload length
+ */
+void FlightRecorder::recordFrame(RecordType dir, uint8_t type, uint32_t objId, uint16_t instId,
+		const uint8_t *data, size_t length)
+{
+	uint64_t idx;
+	Record *rec = beginWrite(idx);
+
+	if (length > MAX_DATA_LENGTH)
+		length = MAX_DATA_LENGTH;
+
+	rec->recType = dir;
+	rec->type    = type;
+	rec->objId   = objId;
+	rec->instId  = instId;
+	rec->length  = length;
+	if (length > 0)
+		memcpy(rec->data, data, length);
+
+	endWrite(idx);
+}
+
+/** Record link event.
+ * Disconnect and bursts of RX errors trigger dump.
+ */
+void FlightRecorder::recordEvent(Event ev, uint32_t objId)
+{
+	uint64_t idx;
+	Record *rec = beginWrite(idx);
+
+	rec->recType = REC_EVENT;
+	rec->type    = ev;
+	rec->objId   = objId;
+	rec->instId  = 0;
+	rec->length  = 0;
+	uint64_t stamp = rec->stamp;
+
+	endWrite(idx);
+
+	if (ev == EV_CRC_ERROR || ev == EV_LENGTH_ERROR) {
+		if (burstCount == 0)
+			return;
+
+		if (stamp - burstStart > uint64_t(burstPeriodMs) * 1000000) {
+			burstStart = stamp;
+			burstErrors = 0;
+		}
+
+		if (++burstErrors >= burstCount) {
+			burstErrors = 0;
+			autoDump("rxerrors");
+		}
+	} else if (ev == EV_DISCONNECTED) {
+		dump("disconnect");
+	}
+}
+
+/** Write last window to the dump file (in background)
+ */
+void FlightRecorder::dump(const std::string &reason)
+{
+	if (dumping.exchange(true))
+		return; // previous dump still in progress
+
+	if (dumpThread.joinable())
+		dumpThread.join();
+
+	lastDump.store(UAVTalkIOBase::monotonicNs());
+	boost::thread t(boost::bind(&FlightRecorder::writeDump, this, reason));
+	dumpThread.swap(t);
+}
+
+/** Rate limited dump
+ */
+void FlightRecorder::autoDump(const std::string &reason)
+{
+	uint64_t last = lastDump.load();
+	if (last != 0 && UAVTalkIOBase::monotonicNs() - last < uint64_t(DUMP_HOLDOFF_MS) * 1000000)
+		return;
+
+	dump(reason);
+}
+
+FlightRecorder::Record *FlightRecorder::beginWrite(uint64_t &idx)
+{
+	idx = head.fetch_add(1, boost::memory_order_relaxed);
+	Slot &slot = slots[idx % capacity];
+
+	slot.seq.store(2 * idx + 1, boost::memory_order_relaxed);
+	boost::atomic_thread_fence(boost::memory_order_release);
+
+	slot.rec.stamp = UAVTalkIOBase::monotonicNs();
+	return &slot.rec;
+}
+
+void FlightRecorder::endWrite(uint64_t idx)
+{
+	slots[idx % capacity].seq.store(2 * idx + 2, boost::memory_order_release);
+}
+
+void FlightRecorder::writeDump(std::string reason)
+{
+	std::vector<Record> recs;
+	uint64_t end = head.load(boost::memory_order_acquire);
+	uint64_t begin = (end > capacity) ? end - capacity : 0;
+	uint64_t now = UAVTalkIOBase::monotonicNs();
+	uint64_t window = uint64_t(windowMs) * 1000000;
+	boost::posix_time::ptime wall_now = boost::posix_time::microsec_clock::local_time();
+
+	// Snapshot ring, skip slots which are rewritten meanwhile
+	recs.reserve(end - begin);
+	for (uint64_t idx = begin; idx < end; ++idx) {
+		Slot &slot = slots[idx % capacity];
+		uint64_t seq = slot.seq.load(boost::memory_order_acquire);
+		if (seq != 2 * idx + 2)
+			continue;
+
+		Record rec = slot.rec;
+		boost::atomic_thread_fence(boost::memory_order_acquire);
+		if (slot.seq.load(boost::memory_order_relaxed) != seq)
+			continue;
+
+		if (now - rec.stamp <= window)
+			recs.push_back(rec);
+	}
+
+	std::string path = dumpPrefix + "-" + boost::posix_time::to_iso_string(wall_now) + "-" + reason + ".log";
+	std::ofstream out(path.c_str());
+	if (!out) {
+		ROS_ERROR_NAMED("FlightRecorder", "Can't write dump %s", path.c_str());
+		dumping.store(false);
+		return;
+	}
+
+	out << "# FlightRecorder dump: " << reason << ", " << recs.size() << " records, last "
+		<< windowMs << " ms" << std::endl;
+
+	for (std::vector<Record>::iterator it = recs.begin(); it != recs.end(); ++it) {
+		boost::posix_time::ptime t = wall_now - boost::posix_time::microseconds((now - it->stamp) / 1000);
+		UAVObject *obj = (objMngr != NULL && it->objId != 0) ? objMngr->getObject(it->objId) : NULL;
+
+		out << boost::posix_time::to_simple_string(t.time_of_day());
+		if (it->recType == REC_EVENT) {
+			out << " EV " << event_name(it->type);
+		} else {
+			out << ((it->recType == REC_RX_FRAME) ? " RX " : " TX ") << frame_type_name(it->type);
+		}
+
+		out << " 0x" << std::hex << std::setw(8) << std::setfill('0') << it->objId << std::dec
+			<< " " << ((obj != NULL) ? obj->getName() : "?");
+
+		if (it->recType != REC_EVENT) {
+			out << " inst " << it->instId << " len " << it->length << " :" << std::hex;
+			for (uint16_t n = 0; n < it->length; ++n)
+				out << " " << std::setw(2) << std::setfill('0') << unsigned(it->data[n]);
+			out << std::dec;
+		}
+
+		out << std::endl;
+	}
+
+	ROS_INFO_NAMED("FlightRecorder", "Flight recorder dump (%s): %s", reason.c_str(), path.c_str());
+	dumping.store(false);
+}
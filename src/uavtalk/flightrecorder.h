@@ -0,0 +1,118 @@
+/**
+ ******************************************************************************
+ * @file       flightrecorder.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief In-memory recorder of the last UAVTalk frames and link events
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef FLIGHTRECORDER_H
+#define FLIGHTRECORDER_H
+
+#include <string>
+#include <boost/atomic.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/scoped_array.hpp>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Always-on ring of recent frames and events.
+ *
+ * Writers only do one atomic increment and a copy into a preallocated
+ * slot, so it may be called from the IO threads. Each slot is guarded
+ * by a sequence number (seqlock), readers skip slots being rewritten.
+ * Dumps are written to a text file by a separate thread.
+ */
+class FlightRecorder {
+public:
+	typedef enum {
+		REC_RX_FRAME,
+		REC_TX_FRAME,
+		REC_EVENT
+	} RecordType;
+
+	typedef enum {
+		EV_CRC_ERROR,
+		EV_LENGTH_ERROR,
+		EV_UNKNOWN_OBJECT,
+		EV_TX_ERROR,
+		EV_CONNECTED,
+		EV_DISCONNECTED
+	} Event;
+
+	FlightRecorder(size_t capacity = DEFAULT_CAPACITY, UAVObjectManager *objMngr = NULL);
+	~FlightRecorder();
+
+	void setDumpPrefix(const std::string &prefix);
+	void setWindow(uint32_t windowMs);
+	void setErrorBurst(uint32_t count, uint32_t periodMs);
+
+	void recordFrame(RecordType dir, uint8_t type, uint32_t objId, uint16_t instId,
+			const uint8_t *data, size_t length);
+	void recordEvent(Event ev, uint32_t objId = 0);
+	void dump(const std::string &reason);
+
+private:
+	static const size_t DEFAULT_CAPACITY = 4096;
+	static const size_t MAX_DATA_LENGTH = 256;
+	static const uint32_t DEFAULT_WINDOW_MS = 10000;
+	static const uint32_t DUMP_HOLDOFF_MS = 10000;
+	static const uint32_t DEFAULT_BURST_COUNT = 10;
+	static const uint32_t DEFAULT_BURST_PERIOD_MS = 1000;
+
+	typedef struct {
+		uint64_t stamp;	/** monotonic time, ns */
+		uint8_t recType;
+		uint8_t type;	/** frame type or event code */
+		uint16_t instId;
+		uint32_t objId;
+		uint16_t length;
+		uint8_t data[MAX_DATA_LENGTH];
+	} Record;
+
+	typedef struct {
+		boost::atomic<uint64_t> seq;
+		Record rec;
+	} Slot;
+
+	size_t capacity;
+	boost::scoped_array<Slot> slots;
+	boost::atomic<uint64_t> head;
+	UAVObjectManager *objMngr;
+	std::string dumpPrefix;
+	uint32_t windowMs;
+
+	// CRC error burst detector, updated only from the RX thread
+	uint32_t burstCount;
+	uint32_t burstPeriodMs;
+	uint32_t burstErrors;
+	uint64_t burstStart;
+
+	boost::atomic<bool> dumping;
+	boost::atomic<uint64_t> lastDump;
+	boost::thread dumpThread;
+
+	Record *beginWrite(uint64_t &idx);
+	void endWrite(uint64_t idx);
+	void autoDump(const std::string &reason);
+	void writeDump(std::string reason);
+};
+
+} // namespace openpilot
+
+#endif // FLIGHTRECORDER_H
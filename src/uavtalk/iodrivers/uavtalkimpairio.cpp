@@ -0,0 +1,235 @@
+/**
+ ******************************************************************************
+ * @file       uavtalkimpairio.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Link impairment shim: loss, latency and bandwidth emulation
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "uavtalkimpairio.h"
+#include <boost/random/geometric_distribution.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+
+using namespace openpilot;
+
+/** Constructor
+ * \param[in] iodev Wrapped driver
+ * \param[in] seed Random seed
+ */
+UAVTalkImpairIO::UAVTalkImpairIO(UAVTalkIOBase *iodev, uint32_t seed) :
+	dev(iodev),
+	io_service(),
+	io_work(new boost::asio::io_service::work(io_service))
+{
+	for (int dir = DIR_TX; dir <= DIR_RX; ++dir) {
+		Channel &ch = channels[dir];
+
+		memset(&ch.imp, 0, sizeof(ch.imp));
+		memset(&ch.stats, 0, sizeof(ch.stats));
+		ch.rng.seed(seed * 2 + dir);
+		ch.jitterRng.seed(~(seed * 2 + dir));
+		ch.bitsToError = 0;
+		ch.bytesToDrop = 0;
+		ch.timer.reset(new boost::asio::deadline_timer(io_service));
+	}
+
+	dev->sig_read.connect(boost::bind(&UAVTalkImpairIO::devRead, this, _1, _2));
+	dev->sig_closed.connect(boost::bind(&UAVTalkImpairIO::devClosed, this));
+
+	// run io_service for delayed delivery
+	boost::thread t(boost::bind(&boost::asio::io_service::run, &this->io_service));
+	io_thread.swap(t);
+}
+
+UAVTalkImpairIO::~UAVTalkImpairIO()
+{
+	dev->sig_read.disconnect(boost::bind(&UAVTalkImpairIO::devRead, this, _1, _2));
+	dev->sig_closed.disconnect(boost::bind(&UAVTalkImpairIO::devClosed, this));
+
+	io_work.reset();
+	io_service.stop();
+	io_thread.join();
+}
+
+/** Set impairment for one direction.
+ * Resets error and drop generators, so the same seed gives the same errors.
+ */
+void UAVTalkImpairIO::setImpairment(Direction dir, const Impairment &imp)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	Channel &ch = channels[dir];
+
+	ch.imp = imp;
+	nextBitError(ch);
+	nextDrop(ch);
+}
+
+UAVTalkImpairIO::ImpairStats UAVTalkImpairIO::getImpairStats(Direction dir)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return channels[dir].stats;
+}
+
+void UAVTalkImpairIO::write(const uint8_t *data, size_t length)
+{
+	impair(DIR_TX, data, length);
+}
+
+void UAVTalkImpairIO::devRead(uint8_t *data, size_t length)
+{
+	impair(DIR_RX, data, length);
+}
+
+void UAVTalkImpairIO::devClosed()
+{
+	sig_closed();
+}
+
+void UAVTalkImpairIO::nextBitError(Channel &ch)
+{
+	if (ch.imp.bitErrorRate > 0 && ch.imp.bitErrorRate < 1)
+		ch.bitsToError = boost::random::geometric_distribution<uint64_t>(ch.imp.bitErrorRate)(ch.rng);
+	else
+		ch.bitsToError = 0;
+}
+
+void UAVTalkImpairIO::nextDrop(Channel &ch)
+{
+	if (ch.imp.dropRate > 0 && ch.imp.dropRate < 1)
+		ch.bytesToDrop = boost::random::geometric_distribution<uint64_t>(ch.imp.dropRate)(ch.rng);
+	else
+		ch.bytesToDrop = 0;
+}
+
+/** Apply errors and drops, then deliver now or queue for later
+ */
+void UAVTalkImpairIO::impair(Direction dir, const uint8_t *data, size_t length)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	Channel &ch = channels[dir];
+	Chunk chunk;
+
+	chunk.data.reserve(length);
+	for (size_t n = 0; n < length; ++n) {
+		uint8_t byte = data[n];
+		ch.stats.bytes++;
+
+		if (ch.imp.dropRate > 0) {
+			if (ch.bytesToDrop == 0) {
+				ch.stats.bytesDropped++;
+				nextDrop(ch);
+				continue;
+			}
+			ch.bytesToDrop--;
+		}
+
+		if (ch.imp.bitErrorRate > 0) {
+			uint64_t bit = 0;
+			while (ch.bitsToError < 8 - bit) {
+				bit += ch.bitsToError;
+				byte ^= 1 << bit;
+				ch.stats.bitsFlipped++;
+				bit++;
+				nextBitError(ch);
+			}
+			ch.bitsToError -= 8 - bit;
+		}
+
+		chunk.data.push_back(byte);
+	}
+
+	if (chunk.data.empty())
+		return;
+
+	// Fast path: link without delay
+	if (ch.imp.latencyMs == 0 && ch.imp.jitterMs == 0 && ch.imp.baudrate == 0 && ch.queue.empty()) {
+		lock.unlock();
+		deliver(dir, &chunk.data[0], chunk.data.size());
+		return;
+	}
+
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+	// Serialization delay: bytes are sent one after another
+	if (ch.linkFree.is_not_a_date_time() || ch.linkFree < now)
+		ch.linkFree = now;
+	if (ch.imp.baudrate > 0)
+		ch.linkFree += boost::posix_time::microseconds(int64_t(chunk.data.size()) * 10 * 1000000 / ch.imp.baudrate);
+
+	// Propagation delay, never overtake previous chunk
+	uint32_t delayMs = ch.imp.latencyMs;
+	if (ch.imp.jitterMs > 0)
+		delayMs += boost::random::uniform_int_distribution<uint32_t>(0, ch.imp.jitterMs)(ch.jitterRng);
+
+	chunk.release = ch.linkFree + boost::posix_time::milliseconds(delayMs);
+	if (!ch.lastRelease.is_not_a_date_time() && chunk.release < ch.lastRelease)
+		chunk.release = ch.lastRelease;
+	ch.lastRelease = chunk.release;
+
+	bool wasEmpty = ch.queue.empty();
+	ch.queue.push_back(chunk);
+	if (wasEmpty)
+		io_service.post(boost::bind(&UAVTalkImpairIO::scheduleRelease, this, dir));
+}
+
+void UAVTalkImpairIO::deliver(Direction dir, uint8_t *data, size_t length)
+{
+	if (dir == DIR_TX)
+		dev->write(data, length);
+	else {
+		rxStamp = monotonicNs();
+		sig_read(data, length);
+	}
+}
+
+void UAVTalkImpairIO::scheduleRelease(Direction dir)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	Channel &ch = channels[dir];
+
+	if (ch.queue.empty())
+		return;
+
+	ch.timer->expires_at(ch.queue.front().release);
+	ch.timer->async_wait(boost::bind(&UAVTalkImpairIO::releaseChunks, this, boost::asio::placeholders::error, dir));
+}
+
+void UAVTalkImpairIO::releaseChunks(boost::system::error_code error, Direction dir)
+{
+	std::deque<Chunk> due;
+
+	if (error)
+		return;
+
+	{
+		boost::recursive_mutex::scoped_lock lock(mutex);
+		Channel &ch = channels[dir];
+		boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+		while (!ch.queue.empty() && ch.queue.front().release <= now) {
+			due.push_back(ch.queue.front());
+			ch.queue.pop_front();
+		}
+	}
+
+	// Deliver unlocked: receivers lock UAVTalk, which may be writing to us
+	for (std::deque<Chunk>::iterator it = due.begin(); it != due.end(); ++it)
+		deliver(dir, &it->data[0], it->data.size());
+
+	scheduleRelease(dir);
+}
@@ -0,0 +1,110 @@
+/**
+ ******************************************************************************
+ * @file       uavtalkimpairio.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Link impairment shim: loss, latency and bandwidth emulation
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef UAVTALKIOIMPAIR_H
+#define UAVTALKIOIMPAIR_H
+
+#include "uavtalkiobase.h"
+#include <deque>
+#include <memory>
+#include <boost/random/mersenne_twister.hpp>
+
+namespace openpilot
+{
+
+/** Wraps other driver and degrades the link in both directions:
+ * bit errors, byte drops, latency with jitter and baud rate limit.
+ *
+ * Which bits are flipped and which bytes are dropped depends only on the
+ * seed and the byte stream, not on timing. Delayed data is never reordered.
+ */
+class UAVTalkImpairIO : public UAVTalkIOBase
+{
+public:
+	typedef enum {
+		DIR_TX,	/** write() -> wrapped driver */
+		DIR_RX	/** wrapped driver -> sig_read */
+	} Direction;
+
+	typedef struct {
+		double bitErrorRate;	/** probability of bit flip */
+		double dropRate;	/** probability of byte loss */
+		uint32_t latencyMs;
+		uint32_t jitterMs;	/** uniform 0..jitterMs added to latency */
+		uint32_t baudrate;	/** 10 bits per byte, 0 - unlimited */
+	} Impairment;
+
+	typedef struct {
+		uint32_t bytes;
+		uint32_t bitsFlipped;
+		uint32_t bytesDropped;
+	} ImpairStats;
+
+	UAVTalkImpairIO(UAVTalkIOBase *iodev, uint32_t seed = 0);
+	~UAVTalkImpairIO();
+
+	void setImpairment(Direction dir, const Impairment &imp);
+	ImpairStats getImpairStats(Direction dir);
+
+	void write(const uint8_t *data, size_t length);
+	inline bool is_open() { return dev->is_open(); };
+
+private:
+	typedef struct {
+		boost::posix_time::ptime release;
+		std::vector<uint8_t> data;
+	} Chunk;
+
+	typedef struct {
+		Impairment imp;
+		ImpairStats stats;
+		boost::random::mt19937 rng;		/** errors and drops */
+		boost::random::mt19937 jitterRng;
+		uint64_t bitsToError;	/** bits until next flip */
+		uint64_t bytesToDrop;	/** bytes until next drop */
+		boost::posix_time::ptime linkFree;	/** end of the last byte on the wire */
+		boost::posix_time::ptime lastRelease;
+		std::deque<Chunk> queue;
+		std::auto_ptr<boost::asio::deadline_timer> timer;
+	} Channel;
+
+	UAVTalkIOBase *dev;
+	boost::asio::io_service io_service;
+	std::auto_ptr<boost::asio::io_service::work> io_work;
+	boost::thread io_thread;
+	Channel channels[2];
+	boost::recursive_mutex mutex;
+
+	void impair(Direction dir, const uint8_t *data, size_t length);
+	void deliver(Direction dir, uint8_t *data, size_t length);
+	void scheduleRelease(Direction dir);
+	void releaseChunks(boost::system::error_code error, Direction dir);
+	void nextBitError(Channel &ch);
+	void nextDrop(Channel &ch);
+
+	// slots:
+	void devRead(uint8_t *data, size_t length);
+	void devClosed();
+};
+
+} // namespace openpilot
+
+#endif // UAVTALKIOIMPAIR_H
@@ -0,0 +1,142 @@
+/**
+ ******************************************************************************
+ * @file       uavtalkptyio.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Pseudo terminal IO, used to run the autopilot emulator
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "uavtalkptyio.h"
+#include "ros/console.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+using namespace openpilot;
+
+UAVTalkPtyIO::UAVTalkPtyIO() :
+	io_service(),
+	master_dev(io_service),
+	slave_fd(-1),
+	tx_buf_size(0)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0)
+		throw boost::system::system_error(errno, boost::system::system_category(), "posix_openpt");
+
+	slave_name = ptsname(fd);
+	master_dev.assign(fd);
+
+	// Hold slave open: master reads fail with EIO while no one has it open.
+	// Also switch it to raw mode before the other side opens it.
+	slave_fd = open(slave_name.c_str(), O_RDWR | O_NOCTTY);
+	if (slave_fd < 0)
+		throw boost::system::system_error(errno, boost::system::system_category(), "open " + slave_name);
+
+	struct termios tio;
+	tcgetattr(slave_fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(slave_fd, TCSANOW, &tio);
+
+	// give some work to io_service before start
+	io_service.post(boost::bind(&UAVTalkPtyIO::do_read, this));
+
+	// run io_service for async io
+	boost::thread t(boost::bind(&boost::asio::io_service::run, &this->io_service));
+	io_thread.swap(t);
+}
+
+UAVTalkPtyIO::~UAVTalkPtyIO()
+{
+	io_service.stop();
+	io_thread.join();
+	close(slave_fd);
+}
+
+void UAVTalkPtyIO::write(const uint8_t *data, size_t length)
+{
+	{
+		boost::recursive_mutex::scoped_lock lock(mutex);
+		tx_q.insert(tx_q.end(), data, data + length);
+	}
+	io_service.post(boost::bind(&UAVTalkPtyIO::do_write, this));
+}
+
+void UAVTalkPtyIO::do_read(void)
+{
+	master_dev.async_read_some(
+			boost::asio::buffer(rx_buf, sizeof(rx_buf)),
+			boost::bind(&UAVTalkPtyIO::async_read_end,
+				this,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
+}
+
+void UAVTalkPtyIO::async_read_end(boost::system::error_code error, size_t bytes_transfered)
+{
+	if (error) {
+		if (master_dev.is_open()) {
+			master_dev.close();
+			sig_closed();
+			ROS_DEBUG_NAMED("UAVTalk", "async_read_end: error! pty closed.");
+		}
+	} else {
+		rxStamp = monotonicNs();
+		sig_read(rx_buf, bytes_transfered);
+		do_read();
+	}
+}
+
+void UAVTalkPtyIO::do_write(void)
+{
+	// if write not in progress
+	if (tx_buf == 0) {
+		boost::recursive_mutex::scoped_lock lock(mutex);
+
+		if (tx_q.empty())
+			return;
+
+		tx_buf_size = tx_q.size();
+		tx_buf.reset(new uint8_t[tx_buf_size]);
+		std::copy(tx_q.begin(), tx_q.end(), tx_buf.get());
+		tx_q.clear();
+
+		boost::asio::async_write(master_dev,
+				boost::asio::buffer(tx_buf.get(), tx_buf_size),
+				boost::bind(&UAVTalkPtyIO::async_write_end,
+					this,
+					boost::asio::placeholders::error));
+	}
+}
+
+void UAVTalkPtyIO::async_write_end(boost::system::error_code error)
+{
+	if (!error) {
+		boost::recursive_mutex::scoped_lock lock(mutex);
+
+		tx_buf.reset();
+		tx_buf_size = 0;
+		do_write();
+	} else {
+		if (master_dev.is_open()) {
+			master_dev.close();
+			sig_closed();
+			ROS_DEBUG_NAMED("UAVTalk", "async_write_end: error! pty closed.");
+		}
+	}
+}
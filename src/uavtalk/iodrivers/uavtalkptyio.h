@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * @file       uavtalkptyio.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Pseudo terminal IO, used to run the autopilot emulator
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef UAVTALKIOPTY_H
+#define UAVTALKIOPTY_H
+
+#include "uavtalkiobase.h"
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/shared_array.hpp>
+
+namespace openpilot
+{
+
+/** Master side of a pseudo terminal pair.
+ * The other side is opened by name (getSlaveName()) as a usual serial port,
+ * e.g. by UAVTalkSerialIO.
+ */
+class UAVTalkPtyIO : public UAVTalkIOBase
+{
+public:
+	UAVTalkPtyIO();
+	~UAVTalkPtyIO();
+
+	void write(const uint8_t *data, size_t length);
+	inline bool is_open() { return master_dev.is_open(); };
+	inline std::string getSlaveName() { return slave_name; };
+
+private:
+	boost::asio::io_service io_service;
+	boost::thread io_thread;
+	boost::asio::posix::stream_descriptor master_dev;
+	std::string slave_name;
+	int slave_fd;
+
+	static const size_t RX_BUFSIZE = 10 + 256 + 1;
+	uint8_t rx_buf[RX_BUFSIZE];
+	std::vector<uint8_t> tx_q;
+	boost::shared_array<uint8_t> tx_buf;
+	size_t tx_buf_size;
+	boost::recursive_mutex mutex;
+
+	void do_read(void);
+	void async_read_end(boost::system::error_code ec, size_t bytes_transfered);
+	void do_write(void);
+	void async_write_end(boost::system::error_code ec);
+};
+
+} // namespace openpilot
+
+#endif // UAVTALKIOPTY_H
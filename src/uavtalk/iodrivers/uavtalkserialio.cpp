@@ -44,8 +44,18 @@ UAVTalkSerialIO::UAVTalkSerialIO(std::string device, unsigned int baudrate) :
 }
 
 UAVTalkSerialIO::~UAVTalkSerialIO()
+{
+	stop();
+}
+
+/** Stop IO thread, sig_read is not emitted after return.
+ * write() may still be called, data is not sent.
+ */
+void UAVTalkSerialIO::stop()
 {
 	io_service.stop();
+	if (io_thread.joinable())
+		io_thread.join();
 }
 
 void UAVTalkSerialIO::write(const uint8_t *data, size_t length)
@@ -76,6 +86,7 @@ void UAVTalkSerialIO::async_read_end(boost::system::error_code error, size_t byt
 			ROS_DEBUG_NAMED("UAVTalk", "async_read_end: error! port closed.");
 		}
 	} else {
+		rxStamp = monotonicNs();
 		sig_read(rx_buf, bytes_transfered);
 		do_read();
 	}
@@ -40,6 +40,7 @@ public:
 	UAVTalkSerialIO(std::string device, unsigned int baudrate);
 	~UAVTalkSerialIO();
 
+	void stop();
 	void write(const uint8_t *data, size_t length);
 	//ssize_t read(uint8_t *data, size_t length);
 	//size_t available();
@@ -40,9 +40,19 @@ UAVTalkUDPIO::UAVTalkUDPIO(std::string server_addr, unsigned int server_port) :
 }
 
 UAVTalkUDPIO::~UAVTalkUDPIO()
+{
+	stop();
+}
+
+/** Stop IO thread, sig_read is not emitted after return.
+ * write() may still be called, data is not sent.
+ */
+void UAVTalkUDPIO::stop()
 {
 	io_work.reset();
 	io_service.stop();
+	if (io_thread.joinable())
+		io_thread.join();
 }
 
 void UAVTalkUDPIO::write(const uint8_t *data, size_t length)
@@ -75,6 +85,7 @@ void UAVTalkUDPIO::async_read_end(boost::system::error_code error, size_t bytes_
 		}
 	} else {
 		sender_exists = true;
+		rxStamp = monotonicNs();
 		sig_read(rx_buf, bytes_transfered);
 		do_read();
 	}
@@ -36,6 +36,7 @@ public:
 	UAVTalkUDPIO(std::string server_addr, unsigned int server_port);
 	~UAVTalkUDPIO();
 
+	void stop();
 	void write(const uint8_t *data, size_t length);
 	//ssize_t read(uint8_t *data, size_t length);
 	//size_t available();
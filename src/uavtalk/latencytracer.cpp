@@ -0,0 +1,273 @@
+/**
+ ******************************************************************************
+ * @file       latencytracer.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Per-object receive latency histograms
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "latencytracer.h"
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+using namespace openpilot;
+
+const uint64_t LatencyHistogram::MAX_VALUE;
+
+LatencyHistogram::LatencyHistogram() :
+	count(0),
+	sum(0),
+	min(~uint64_t(0)),
+	max(0)
+{
+	for (size_t n = 0; n < NUM_BUCKETS; ++n)
+		buckets[n].store(0, boost::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+	if (value < 2 * SUB_BUCKETS)
+		return value;
+
+	// keep SUB_BUCKET_BITS + 1 most significant bits
+	int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+	return (shift + 1) * SUB_BUCKETS + (value >> shift) - SUB_BUCKETS;
+}
+
+/** Highest value which falls into bucket
+ */
+uint64_t LatencyHistogram::bucketValue(size_t idx)
+{
+	if (idx < 2 * SUB_BUCKETS)
+		return idx;
+
+	int shift = idx / SUB_BUCKETS - 1;
+	uint64_t sub = idx % SUB_BUCKETS + SUB_BUCKETS;
+	return ((sub + 1) << shift) - 1;
+}
+
+/** Add value, should be called from one thread only
+ */
+void LatencyHistogram::record(uint64_t value)
+{
+	if (value > MAX_VALUE)
+		value = MAX_VALUE;
+
+	buckets[bucketIndex(value)].fetch_add(1, boost::memory_order_relaxed);
+	sum.fetch_add(value, boost::memory_order_relaxed);
+	if (value < min.load(boost::memory_order_relaxed))
+		min.store(value, boost::memory_order_relaxed);
+	if (value > max.load(boost::memory_order_relaxed))
+		max.store(value, boost::memory_order_relaxed);
+	count.fetch_add(1, boost::memory_order_release);
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+	return count.load(boost::memory_order_acquire);
+}
+
+uint64_t LatencyHistogram::getMin() const
+{
+	return (getCount() > 0) ? min.load(boost::memory_order_relaxed) : 0;
+}
+
+uint64_t LatencyHistogram::getMax() const
+{
+	return max.load(boost::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMean() const
+{
+	uint64_t n = getCount();
+	return (n > 0) ? sum.load(boost::memory_order_relaxed) / n : 0;
+}
+
+/** Value at percentile (0..100), within one bucket width
+ */
+uint64_t LatencyHistogram::getPercentile(double percentile) const
+{
+	uint64_t counts[NUM_BUCKETS];
+	uint64_t total = 0;
+
+	// buckets may change while reading, so sum what we have seen
+	for (size_t n = 0; n < NUM_BUCKETS; ++n) {
+		counts[n] = buckets[n].load(boost::memory_order_relaxed);
+		total += counts[n];
+	}
+
+	if (total == 0)
+		return 0;
+
+	uint64_t rank = std::ceil(percentile / 100.0 * total);
+	if (rank < 1)
+		rank = 1;
+
+	uint64_t seen = 0;
+	for (size_t n = 0; n < NUM_BUCKETS; ++n) {
+		seen += counts[n];
+		if (seen >= rank)
+			return std::min(bucketValue(n), getMax());
+	}
+
+	return getMax();
+}
+
+
+LatencyTracer::LatencyTracer(UAVObjectManager *objMngr_) :
+	objMngr(objMngr_)
+{
+	for (size_t n = 0; n < MAX_TYPES; ++n)
+		entries[n].store(NULL);
+}
+
+LatencyTracer::~LatencyTracer()
+{
+	for (size_t n = 0; n < MAX_TYPES; ++n)
+		delete entries[n].load();
+}
+
+const char *LatencyTracer::getStageName(Stage stage)
+{
+	switch (stage) {
+	case STAGE_DECODE:   return "decode";
+	case STAGE_UPDATE:   return "update";
+	case STAGE_DISPATCH: return "dispatch";
+	case STAGE_TOTAL:    return "total";
+	default:             return "?";
+	}
+}
+
+/** Entry of object type, allocated on first frame.
+ * Only the RX thread records, so no race on allocation.
+ * \return NULL if object has no type index
+ */
+LatencyTracer::Entry *LatencyTracer::getEntry(UAVObject *obj)
+{
+	uint32_t idx = obj->getTypeIndex();
+	if (idx >= MAX_TYPES)
+		return NULL;
+
+	Entry *entry = entries[idx].load(boost::memory_order_acquire);
+	if (entry != NULL)
+		return entry;
+
+	entry = new Entry;
+	entry->objId = obj->getObjID();
+	entries[idx].store(entry, boost::memory_order_release);
+	return entry;
+}
+
+/** Record received object update, called from the RX thread.
+ * \param[in] obj Object (any instance)
+ * \param[in] readStamp Monotonic time (ns) when IO read completed
+ * \param[in] decodedStamp When frame CRC was checked
+ * \param[in] updateStamp When instance was found and unpacking started
+ * \param[in] dispatchedStamp When all subscribers returned
+ */
+void LatencyTracer::recordFrame(UAVObject *obj, uint64_t readStamp, uint64_t decodedStamp,
+		uint64_t updateStamp, uint64_t dispatchedStamp)
+{
+	Entry *entry = getEntry(obj);
+	if (entry == NULL)
+		return;
+
+	entry->stages[STAGE_DECODE].record(decodedStamp - readStamp);
+	entry->stages[STAGE_UPDATE].record(updateStamp - decodedStamp);
+	entry->stages[STAGE_DISPATCH].record(dispatchedStamp - updateStamp);
+	entry->stages[STAGE_TOTAL].record(dispatchedStamp - readStamp);
+}
+
+/** IDs of all objects received so far, in type index order
+ */
+std::vector<uint32_t> LatencyTracer::getObjects()
+{
+	std::vector<uint32_t> ids;
+
+	for (size_t n = 0; n < MAX_TYPES; ++n) {
+		Entry *entry = entries[n].load(boost::memory_order_acquire);
+		if (entry != NULL)
+			ids.push_back(entry->objId);
+	}
+
+	return ids;
+}
+
+/** Get latency statistics of object stage
+ * \return false if object was not received
+ */
+bool LatencyTracer::getStats(uint32_t objId, Stage stage, Stats &stats)
+{
+	UAVObject *obj = objMngr->getObject(objId);
+	if (obj == NULL || obj->getTypeIndex() >= MAX_TYPES || stage >= STAGE_COUNT)
+		return false;
+
+	Entry *entry = entries[obj->getTypeIndex()].load(boost::memory_order_acquire);
+	if (entry == NULL)
+		return false;
+
+	LatencyHistogram *hist = &entry->stages[stage];
+
+	stats.count = hist->getCount();
+	stats.min = hist->getMin();
+	stats.max = hist->getMax();
+	stats.mean = hist->getMean();
+	stats.p50 = hist->getPercentile(50.0);
+	stats.p90 = hist->getPercentile(90.0);
+	stats.p99 = hist->getPercentile(99.0);
+	stats.p999 = hist->getPercentile(99.9);
+	return true;
+}
+
+/** Write table of all objects and stages, values in us
+ */
+void LatencyTracer::dump(std::ostream &out)
+{
+	std::vector<uint32_t> ids = getObjects();
+
+	out << std::left << std::setw(28) << "object" << std::setw(10) << "stage"
+		<< std::right << std::setw(10) << "count"
+		<< std::setw(10) << "min" << std::setw(10) << "mean"
+		<< std::setw(10) << "p50" << std::setw(10) << "p90"
+		<< std::setw(10) << "p99" << std::setw(10) << "p99.9"
+		<< std::setw(10) << "max" << std::endl;
+
+	for (std::vector<uint32_t>::iterator it = ids.begin(); it != ids.end(); ++it) {
+		std::ostringstream name;
+		UAVObject *obj = objMngr->getObject(*it);
+		if (obj)
+			name << obj->getName();
+		else
+			name << "0x" << std::hex << std::setw(8) << std::setfill('0') << *it;
+
+		for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+			Stats st;
+			if (!getStats(*it, Stage(stage), st))
+				continue;
+
+			out << std::left << std::setw(28) << ((stage == 0) ? name.str() : "")
+				<< std::setw(10) << getStageName(Stage(stage))
+				<< std::right << std::setw(10) << st.count << std::fixed << std::setprecision(1)
+				<< std::setw(10) << st.min / 1e3 << std::setw(10) << st.mean / 1e3
+				<< std::setw(10) << st.p50 / 1e3 << std::setw(10) << st.p90 / 1e3
+				<< std::setw(10) << st.p99 / 1e3 << std::setw(10) << st.p999 / 1e3
+				<< std::setw(10) << st.max / 1e3 << std::endl;
+		}
+	}
+}
@@ -0,0 +1,123 @@
+/**
+ ******************************************************************************
+ * @file       latencytracer.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Per-object receive latency histograms
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LATENCYTRACER_H
+#define LATENCYTRACER_H
+
+#include <vector>
+#include <ostream>
+#include <boost/atomic.hpp>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Log-linear (HDR-style) histogram of nanosecond values.
+ *
+ * Each power of two is split into SUB_BUCKETS linear buckets,
+ * so any value is kept with less than 1/SUB_BUCKETS relative error.
+ * Single writer, readers may query concurrently.
+ */
+class LatencyHistogram {
+public:
+	static const uint64_t MAX_VALUE = (uint64_t(1) << 36) - 1;	/** ~68 s, larger values are clamped */
+
+	LatencyHistogram();
+
+	void record(uint64_t value);
+	uint64_t getCount() const;
+	uint64_t getMin() const;
+	uint64_t getMax() const;
+	uint64_t getMean() const;
+	uint64_t getPercentile(double percentile) const;
+
+private:
+	static const int SUB_BUCKET_BITS = 5;
+	static const uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const size_t NUM_BUCKETS = (36 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	boost::atomic<uint32_t> buckets[NUM_BUCKETS];
+	boost::atomic<uint64_t> count;
+	boost::atomic<uint64_t> sum;
+	boost::atomic<uint64_t> min;
+	boost::atomic<uint64_t> max;
+
+	static size_t bucketIndex(uint64_t value);
+	static uint64_t bucketValue(size_t idx);
+};
+
+/** Receive path latency tracer.
+ *
+ * UAVTalk reports each received object update with the timestamps of
+ * its pipeline stages, the tracer keeps a histogram per object and stage.
+ * Entries are kept in a dense array indexed by UAVObject::getTypeIndex(),
+ * so recording costs an array access and a few relaxed atomic increments,
+ * histograms are allocated on the first frame of each object.
+ */
+class LatencyTracer {
+public:
+	typedef enum {
+		STAGE_DECODE,	/** IO read completed -> frame CRC checked */
+		STAGE_UPDATE,	/** -> object instance found (or created) */
+		STAGE_DISPATCH,	/** -> data unpacked and all subscribers returned */
+		STAGE_TOTAL,	/** IO read completed -> all subscribers returned */
+		STAGE_COUNT
+	} Stage;
+
+	typedef struct {
+		uint64_t count;
+		uint64_t min;	/** all values in ns */
+		uint64_t max;
+		uint64_t mean;
+		uint64_t p50;
+		uint64_t p90;
+		uint64_t p99;
+		uint64_t p999;
+	} Stats;
+
+	LatencyTracer(UAVObjectManager *objMngr);
+	~LatencyTracer();
+
+	void recordFrame(UAVObject *obj, uint64_t readStamp, uint64_t decodedStamp,
+			uint64_t updateStamp, uint64_t dispatchedStamp);
+	std::vector<uint32_t> getObjects();
+	bool getStats(uint32_t objId, Stage stage, Stats &stats);
+	void dump(std::ostream &out);
+
+	static const char *getStageName(Stage stage);
+
+private:
+	static const size_t MAX_TYPES = 1024;
+
+	typedef struct {
+		uint32_t objId;
+		LatencyHistogram stages[STAGE_COUNT];
+	} Entry;
+
+	UAVObjectManager *objMngr;
+	boost::atomic<Entry *> entries[MAX_TYPES];
+
+	Entry *getEntry(UAVObject *obj);
+};
+
+} // namespace openpilot
+
+#endif // LATENCYTRACER_H
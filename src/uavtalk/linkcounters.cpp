@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * @file       linkcounters.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Lock-free monotonic link counters
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "linkcounters.h"
+#include <new>
+
+using namespace openpilot;
+
+LinkCounters::LinkCounters() :
+	storage(new uint8_t[MAX_SLOTS * sizeof(Slot) + CACHE_LINE])
+{
+	uintptr_t base = reinterpret_cast<uintptr_t>(storage.get());
+	slots = reinterpret_cast<Slot *>((base + CACHE_LINE - 1) & ~uintptr_t(CACHE_LINE - 1));
+
+	for (size_t n = 0; n < MAX_SLOTS; ++n) {
+		new (&slots[n]) Slot;
+		for (size_t c = 0; c < COUNTER_COUNT; ++c)
+			slots[n].values[c].store(0, boost::memory_order_relaxed);
+	}
+}
+
+/** Sum of all slots
+ */
+uint64_t LinkCounters::get(Counter counter) const
+{
+	uint64_t sum = 0;
+
+	for (size_t n = 0; n < MAX_SLOTS; ++n)
+		sum += slots[n].values[counter].load(boost::memory_order_relaxed);
+
+	return sum;
+}
+
+/** Slot of calling thread, threads get slots in round robin order
+ */
+size_t LinkCounters::slotIndex()
+{
+	static boost::atomic<size_t> nextSlot(0);
+	static __thread size_t threadSlot = MAX_SLOTS;
+
+	if (threadSlot == MAX_SLOTS)
+		threadSlot = nextSlot.fetch_add(1, boost::memory_order_relaxed) % MAX_SLOTS;
+
+	return threadSlot;
+}
@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file       linkcounters.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Lock-free monotonic link counters
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef LINKCOUNTERS_H
+#define LINKCOUNTERS_H
+
+#include <stdint.h>
+#include <boost/atomic.hpp>
+#include <boost/scoped_array.hpp>
+
+namespace openpilot
+{
+
+/** 64-bit counters which are never reset.
+ *
+ * Each thread increments its own cache-line padded slot (threads are
+ * spread over MAX_SLOTS), readers sum all slots without any lock.
+ * Rates and per-period values are computed by the reader from
+ * the difference of two snapshots, so any number of observers
+ * may sample the same counters independently.
+ */
+class LinkCounters {
+public:
+	typedef enum {
+		TX_BYTES,
+		RX_BYTES,
+		TX_OBJECT_BYTES,
+		RX_OBJECT_BYTES,
+		RX_OBJECTS,
+		TX_OBJECTS,
+		TX_ERRORS,
+		RX_ERRORS,
+		RX_UNKNOWN,
+		TX_RETRIES,
+		COUNTER_COUNT
+	} Counter;
+
+	LinkCounters();
+
+	inline void add(Counter counter, uint64_t value = 1)
+	{
+		slots[slotIndex()].values[counter].fetch_add(value, boost::memory_order_relaxed);
+	}
+
+	uint64_t get(Counter counter) const;
+
+private:
+	static const size_t MAX_SLOTS = 8;
+	static const size_t CACHE_LINE = 64;
+
+	typedef struct {
+		boost::atomic<uint64_t> values[COUNTER_COUNT];
+		uint8_t pad[CACHE_LINE - (COUNTER_COUNT * sizeof(uint64_t)) % CACHE_LINE];
+	} Slot;
+
+	boost::scoped_array<uint8_t> storage;
+	Slot *slots;	/** MAX_SLOTS, aligned to CACHE_LINE in storage */
+
+	static size_t slotIndex();
+};
+
+} // namespace openpilot
+
+#endif // LINKCOUNTERS_H
@@ -0,0 +1,127 @@
+/**
+ ******************************************************************************
+ * @file       settingscache.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Persistent snapshot of retrieved settings and metadata
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "settingscache.h"
+#include "ros/console.h"
+#include <boost/bind.hpp>
+
+using namespace openpilot;
+
+SettingsCache::SettingsCache(UAVObjectManager *objMngr_, const std::string &path_) :
+	objMngr(objMngr_),
+	path(path_)
+{
+}
+
+/** Metaobjects and settings are cached, data objects are always retrieved
+ */
+bool SettingsCache::isCached(UAVObject *obj)
+{
+	UAVDataObject *dobj = UAVDataObject::cast(obj);
+
+	return obj->isMetaObject() || (dobj != NULL && dobj->isSettings());
+}
+
+/** Keep snapshot entry of a known cached object
+ */
+bool SettingsCache::addEntry(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length)
+{
+	UAVObject *obj = objMngr->getObject(objId);
+	if (obj == NULL || instId != 0 || obj->getNumBytes() != length || !isCached(obj))
+		return false;
+
+	entries[objId].assign(data, data + length);
+	return true;
+}
+
+/** Read snapshot file
+ * \return false if there is no file, it is damaged or has no entry for our objects
+ */
+bool SettingsCache::load()
+{
+	entries.clear();
+
+	ssize_t count = objMngr->readSnapshot(path, boost::bind(&SettingsCache::addEntry, this, _1, _2, _3, _4));
+	if (count < 0) {
+		ROS_DEBUG_NAMED("SettingsCache", "No valid snapshot %s", path.c_str());
+		return false;
+	}
+
+	return !entries.empty();
+}
+
+/** Write current metaobjects and settings (replaces the file atomically)
+ */
+bool SettingsCache::save()
+{
+	if (!objMngr->saveSnapshot(path, UAVObjectManager::SNAPSHOT_SETTINGS_METADATA)) {
+		ROS_ERROR_NAMED("SettingsCache", "Can't write snapshot %s", path.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+/** Forget loaded snapshot, the file is rewritten after the next retrieval
+ */
+void SettingsCache::invalidate()
+{
+	entries.clear();
+}
+
+bool SettingsCache::isLoaded()
+{
+	return !entries.empty();
+}
+
+/** Unpack metaobjects of loaded snapshot, as if they were received.
+ * Settings are only compared, they are always retrieved.
+ */
+void SettingsCache::applyMetadata()
+{
+	for (std::map<uint32_t, std::vector<uint8_t> >::iterator it = entries.begin(); it != entries.end(); ++it) {
+		UAVObject *obj = objMngr->getObject(it->first);
+		if (obj != NULL && obj->isMetaObject())
+			obj->deserialize(&it->second[0]);
+	}
+}
+
+/** Object is in the loaded snapshot
+ */
+bool SettingsCache::contains(UAVObject *obj)
+{
+	return entries.find(obj->getObjID()) != entries.end();
+}
+
+/** Compare current object data with the snapshot
+ */
+bool SettingsCache::matches(UAVObject *obj)
+{
+	std::map<uint32_t, std::vector<uint8_t> >::iterator it = entries.find(obj->getObjID());
+	if (it == entries.end())
+		return false;
+
+	std::vector<uint8_t> data(obj->getNumBytes());
+	obj->serialize(&data[0]);
+
+	return data == it->second;
+}
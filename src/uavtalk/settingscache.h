@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * @file       settingscache.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Persistent snapshot of retrieved settings and metadata
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef SETTINGSCACHE_H
+#define SETTINGSCACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Snapshot of metaobjects and settings objects retrieved from the autopilot.
+ *
+ * Saved after a full retrieval. On the next connect TelemetryMonitor
+ * applies its metaobjects at once, so telemetry runs with the autopilot
+ * metadata while the retrieval is in progress. Every settings object and
+ * metaobject is still requested and compared with the snapshot, nothing
+ * on the autopilot identifies its metadata. A stale snapshot is rewritten.
+ *
+ * Stored by UAVObjectManager::saveSnapshot() (SNAPSHOT_SETTINGS_METADATA),
+ * read back with readSnapshot() without touching the objects. Entries of
+ * objects unknown to the gateway or with another size are skipped.
+ */
+class SettingsCache {
+public:
+	SettingsCache(UAVObjectManager *objMngr, const std::string &path);
+
+	bool load();
+	bool save();
+	void invalidate();
+	bool isLoaded();
+
+	void applyMetadata();
+	bool contains(UAVObject *obj);
+	bool matches(UAVObject *obj);
+
+	static bool isCached(UAVObject *obj);
+
+private:
+	UAVObjectManager *objMngr;
+	std::string path;
+	std::map<uint32_t, std::vector<uint8_t> > entries;
+
+	bool addEntry(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length);
+};
+
+} // namespace openpilot
+
+#endif // SETTINGSCACHE_H
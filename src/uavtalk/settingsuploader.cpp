@@ -0,0 +1,207 @@
+/**
+ ******************************************************************************
+ * @file       settingsuploader.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Upload of changed settings objects
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "settingsuploader.h"
+#include "ros/console.h"
+#include <cstring>
+#include <algorithm>
+
+using namespace openpilot;
+
+SettingsUploader::SettingsUploader(UAVObjectManager *objMngr_, uint32_t window_) :
+	objMngr(objMngr_),
+	window(std::max(window_, uint32_t(1))),
+	uploaded(0),
+	unchanged(0),
+	failed(0)
+{
+	// Settings received from the autopilot are its current copy
+	UAVObjectManager::objects_map objs = objMngr->getObjects();
+	for (UAVObjectManager::objects_map::iterator it = objs.begin(); it != objs.end(); ++it)
+		newObject(it->second[0]);
+
+	// In lazy mode settings are created on first reception
+	objMngr->newObject.connect(boost::bind(&SettingsUploader::newObject, this, _1));
+}
+
+SettingsUploader::~SettingsUploader()
+{
+	objMngr->newObject.disconnect(boost::bind(&SettingsUploader::newObject, this, _1));
+
+	UAVObjectManager::objects_map objs = objMngr->getObjects();
+	for (UAVObjectManager::objects_map::iterator it = objs.begin(); it != objs.end(); ++it) {
+		UAVDataObject *dobj = UAVDataObject::cast(it->second[0]);
+		if (dobj != NULL && dobj->isSettings())
+			dobj->objectUnpacked.disconnect(boost::bind(&SettingsUploader::objectUnpacked, this, _1));
+	}
+
+	for (std::map<UAVObject *, std::vector<uint8_t> >::iterator it = inFlight.begin(); it != inFlight.end(); ++it)
+		it->first->transactionCompleted.disconnect(boost::bind(&SettingsUploader::transactionCompleted, this, _1, _2));
+}
+
+/** Called by UAVObjectManager for each new object type, also before the first unpack
+ */
+void SettingsUploader::newObject(UAVObject *obj)
+{
+	UAVDataObject *dobj = UAVDataObject::cast(obj);
+	if (dobj != NULL && dobj->isSettings())
+		dobj->objectUnpacked.connect(boost::bind(&SettingsUploader::objectUnpacked, this, _1));
+}
+
+void SettingsUploader::objectUnpacked(UAVObject *obj)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	std::vector<uint8_t> &data = known[obj];
+
+	data.resize(obj->getNumBytes());
+	obj->serialize(&data[0]);
+}
+
+/** Upload staged objects which differ from the autopilot copy
+ * \return Number of objects to be sent, 0 if nothing changed or a batch is in progress
+ */
+size_t SettingsUploader::apply()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	std::vector<UAVObject *> same;
+
+	if (isBusy())
+		return 0;
+
+	uploaded = 0;
+	unchanged = 0;
+	failed = 0;
+
+	for (std::map<UAVObject *, Staged>::iterator it = stagedObjects.begin(); it != stagedObjects.end(); ++it) {
+		const std::vector<uint8_t> *base = NULL;
+		if (known.find(it->first) != known.end())
+			base = &known[it->first];
+		else if (defaults.find(it->first) != defaults.end())
+			base = &defaults[it->first];
+
+		const std::vector<uint8_t> &data = it->second.data;
+		if (base != NULL && base->size() == data.size() &&
+				memcmp(&(*base)[0], &data[0], data.size()) == 0) {
+			same.push_back(it->first);
+		} else {
+			queue.push_back(*it);
+		}
+	}
+
+	stagedObjects.clear();
+	unchanged = same.size();
+	for (std::vector<UAVObject *>::iterator it = same.begin(); it != same.end(); ++it)
+		objectResult(*it, RESULT_UNCHANGED); // emit signal
+
+	ROS_DEBUG_NAMED("SettingsUploader", "Uploading %zu settings objects, %zu unchanged", queue.size(), unchanged);
+
+	size_t count = queue.size();
+	if (count == 0)
+		batchCompleted(0, unchanged, 0); // emit signal
+	else
+		uploadNext();
+
+	return count;
+}
+
+/** Batch is in progress
+ */
+bool SettingsUploader::isBusy()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return !queue.empty() || !inFlight.empty();
+}
+
+/** Forget autopilot copies, e.g. after the autopilot was reflashed
+ */
+void SettingsUploader::forget()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	known.clear();
+}
+
+/** Write queued objects until the window is full
+ */
+void SettingsUploader::uploadNext()
+{
+	while (!queue.empty() && inFlight.size() < window) {
+		UAVObject *obj = queue.front().first;
+		Staged staged = queue.front().second;
+		queue.pop_front();
+
+		UAVObject::Metadata mdata = obj->getMetadata();
+		UAVObject::UpdateMode mode = UAVObject::GetGcsTelemetryUpdateMode(mdata);
+		bool acked = UAVObject::GetGcsTelemetryAcked(mdata);
+
+		if (acked) {
+			obj->transactionCompleted.connect(boost::bind(&SettingsUploader::transactionCompleted, this, _1, _2));
+			inFlight[obj] = staged.data;
+		}
+
+		// setData() is sent by Telemetry only in on change and throttled modes
+		staged.write();
+		if (mode == UAVObject::UPDATEMODE_PERIODIC || mode == UAVObject::UPDATEMODE_MANUAL)
+			obj->updated();
+
+		if (!acked) {
+			known[obj] = staged.data;
+			finish(obj, RESULT_SENT);
+		}
+	}
+}
+
+void SettingsUploader::finish(UAVObject *obj, Result result)
+{
+	if (result == RESULT_FAILED)
+		failed++;
+	else
+		uploaded++;
+
+	objectResult(obj, result); // emit signal
+
+	if (queue.empty() && inFlight.empty()) {
+		ROS_DEBUG_NAMED("SettingsUploader", "Upload completed: %zu uploaded, %zu unchanged, %zu failed",
+				uploaded, unchanged, failed);
+		batchCompleted(uploaded, unchanged, failed); // emit signal
+	}
+}
+
+/** Called by Telemetry when the object is acknowledged or failed
+ */
+void SettingsUploader::transactionCompleted(UAVObject *obj, bool success)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	std::map<UAVObject *, std::vector<uint8_t> >::iterator it = inFlight.find(obj);
+	if (it == inFlight.end())
+		return;
+
+	obj->transactionCompleted.disconnect(boost::bind(&SettingsUploader::transactionCompleted, this, _1, _2));
+	if (success)
+		known[obj].swap(it->second);
+	inFlight.erase(it);
+
+	finish(obj, (success) ? RESULT_UPLOADED : RESULT_FAILED);
+	uploadNext();
+}
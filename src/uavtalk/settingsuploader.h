@@ -0,0 +1,120 @@
+/**
+ ******************************************************************************
+ * @file       settingsuploader.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Upload of changed settings objects
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef SETTINGSUPLOADER_H
+#define SETTINGSUPLOADER_H
+
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Applies a batch of settings, only objects which differ from the autopilot are sent.
+ *
+ * Known autopilot copy of each settings object is taken from received
+ * data (retrieval on connect, snapshot) and from acknowledged uploads;
+ * if nothing is known yet, object defaults are assumed.
+ * Changed objects are written through Telemetry with several
+ * transactions in flight, result of each object is reported by
+ * objectResult, end of the batch by batchCompleted.
+ */
+class SettingsUploader {
+public:
+	typedef enum {
+		RESULT_UNCHANGED,	/** equal to the autopilot copy, not sent */
+		RESULT_UPLOADED,	/** acknowledged */
+		RESULT_SENT,		/** not acked object, sent without confirmation */
+		RESULT_FAILED		/** NACK or timeout */
+	} Result;
+
+	static const uint32_t UPLOAD_WINDOW = 4;
+
+	SettingsUploader(UAVObjectManager *objMngr, uint32_t window = UPLOAD_WINDOW);
+	~SettingsUploader();
+
+	/** Stage desired data of settings object T (instance 0)
+	 */
+	template<class T>
+	void set(const typename T::DataFields &data)
+	{
+		T *obj = T::GetInstance(objMngr);
+		if (obj == NULL)
+			return;
+
+		boost::recursive_mutex::scoped_lock lock(mutex);
+
+		if (known.find(obj) == known.end() && defaults.find(obj) == defaults.end()) {
+			T def;	// as dirtyClone(), but not on the heap
+			defaults[obj].resize(T::NUMBYTES);
+			def.serialize(&defaults[obj][0]);
+		}
+
+		// compared in wire format, as received copies
+		Staged &staged = stagedObjects[obj];
+		staged.data.resize(T::NUMBYTES);
+		T::PackData(data, &staged.data[0]);
+		staged.write = boost::bind(&T::setData, obj, data);
+	}
+
+	size_t apply();
+	bool isBusy();
+	void forget();
+
+	// signals:
+	boost::signals2::signal<void(UAVObject *obj, Result result)> objectResult;
+	boost::signals2::signal<void(size_t uploaded, size_t unchanged, size_t failed)> batchCompleted;
+
+private:
+	typedef struct {
+		std::vector<uint8_t> data;
+		boost::function<void()> write;	/** setData() of the typed object */
+	} Staged;
+
+	UAVObjectManager *objMngr;
+	uint32_t window;
+	boost::recursive_mutex mutex;
+	std::map<UAVObject *, std::vector<uint8_t> > known;	/** last autopilot copy */
+	std::map<UAVObject *, std::vector<uint8_t> > defaults;
+	std::map<UAVObject *, Staged> stagedObjects;
+	std::deque<std::pair<UAVObject *, Staged> > queue;
+	std::map<UAVObject *, std::vector<uint8_t> > inFlight;
+	size_t uploaded;
+	size_t unchanged;
+	size_t failed;
+
+	void uploadNext();
+	void finish(UAVObject *obj, Result result);
+
+	// slots:
+	void newObject(UAVObject *obj);
+	void objectUnpacked(UAVObject *obj);
+	void transactionCompleted(UAVObject *obj, bool success);
+};
+
+} // namespace openpilot
+
+#endif // SETTINGSUPLOADER_H
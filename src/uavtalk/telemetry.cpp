@@ -26,7 +26,8 @@
 #include "oplinksettings.h"
 #include "objectpersistence.h"
 #include <ros/console.h>
-#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
 
 using namespace openpilot;
 
@@ -34,7 +35,19 @@ using namespace openpilot;
  */
 Telemetry::Telemetry(boost::asio::io_service &io, UAVTalk *utalk, UAVObjectManager *objMngr) :
 	io_service(io),
-	updateTimer(io_service)
+	updateTimer(io_service),
+	reqTimeoutMs(REQ_TIMEOUT_MS),
+	maxRetries(MAX_RETRIES),
+	adaptive(false),
+	adaptTimer(io_service),
+	lastRetries(0),
+	lastErrors(0),
+	srttMs(-1),
+	minRttMs(-1),
+	backoffs(0),
+	inPeriodicUpdates(false),
+	phaseSeq(0),
+	transSeq(0)
 {
 	this->utalk   = utalk;
 	this->objMngr = objMngr;
@@ -49,22 +62,19 @@ Telemetry::Telemetry(boost::asio::io_service &io, UAVTalk *utalk, UAVObjectManag
 	objMngr->newObject.connect(boost::bind(&Telemetry::newObject, this, _1));
 	objMngr->newInstance.connect(boost::bind(&Telemetry::newInstance, this, _1));
 	// Listen to transaction completions
-	utalk->transactionCompleted.connect(boost::bind(&Telemetry::transactionCompleted, this, _1, _2));
+	utalk->transactionCompleted.connect(boost::bind(&Telemetry::transactionCompletedSlot, this, _1, _2));
 	// Get GCS stats object
 	gcsStatsObj = GCSTelemetryStats::GetInstance(objMngr);
-	// Setup and start the periodic timer
-	timeToNextUpdateMs = 0;
-	updateTimer.expires_from_now(boost::posix_time::seconds(1));
-	updateTimer.async_wait(boost::bind(&Telemetry::processPeriodicUpdates, this, boost::asio::placeholders::error));
-	// Setup and start the stats timer
-	txErrors  = 0;
-	txRetries = 0;
+	// Congestion check
+	adaptTimer.expires_from_now(boost::posix_time::milliseconds(ADAPT_INTERVAL_MS));
+	adaptTimer.async_wait(boost::bind(&Telemetry::adaptPeriods, this, boost::asio::placeholders::error));
 }
 
 Telemetry::~Telemetry()
 {
 	updateTimer.cancel();
-	for (std::map<uint32_t, ObjectTransactionInfo *>::iterator itr = transMap.begin(); itr != transMap.end(); ++itr) {
+	adaptTimer.cancel();
+	for (trans_map::iterator itr = transMap.begin(); itr != transMap.end(); ++itr) {
 		itr->second->timer.cancel();
 		delete itr->second;
 	}
@@ -96,8 +106,14 @@ void Telemetry::addObject(UAVObject *obj)
 	// If this point is reached, then the object type is new, let's add it
 	ObjectTimeInfo timeInfo;
 	timeInfo.obj = obj;
-	timeInfo.timeToNextUpdateMs = 0;
+	timeInfo.index              = objList.size();
 	timeInfo.updatePeriodMs     = 0;
+	timeInfo.basePeriodMs       = 0;
+	timeInfo.backoff            = 1.0;
+	timeInfo.scheduled          = false;
+	timeInfo.lateness.reset(new LatencyHistogram());
+	timeInfo.updates            = 0;
+	timeInfo.misses             = 0;
 	objList.push_back(timeInfo);
 }
 
@@ -107,9 +123,11 @@ void Telemetry::setUpdatePeriod(UAVObject *obj, int32_t periodMs)
 {
 	// Find object type (not instance!) and update its period
 	for (int n = 0; n < objList.size(); ++n) {
-		if (objList[n].obj->getObjID() == obj->getObjID()) {
-			objList[n].updatePeriodMs     = periodMs;
-			objList[n].timeToNextUpdateMs = uint32_t((float)periodMs * (float)rand() / (float)RAND_MAX); // avoid bunching of updates
+		// updateObject() is called after each event, keep phase unless the period is changed
+		if (objList[n].obj->getObjID() == obj->getObjID() && objList[n].basePeriodMs != periodMs) {
+			objList[n].basePeriodMs = periodMs;
+			unschedule(objList[n]);
+			applyBackoff(objList[n]);
 		}
 	}
 }
@@ -161,7 +179,7 @@ void Telemetry::updateObject(UAVObject *obj, uint32_t eventType)
 		setUpdatePeriod(obj, metadata.gcsTelemetryUpdatePeriod);
 		// Connect signals for all instances
 		eventMask = EV_UPDATED_MANUAL | EV_UPDATE_REQ | EV_UPDATED_PERIODIC;
-		if (dynamic_cast<UAVMetaObject *>(obj) != NULL) {
+		if (obj->isMetaObject()) {
 			eventMask |= EV_UNPACKED; // we also need to act on remote updates (unpack events)
 		}
 		connectToObjectInstances(obj, eventMask);
@@ -171,7 +189,7 @@ void Telemetry::updateObject(UAVObject *obj, uint32_t eventType)
 		setUpdatePeriod(obj, 0);
 		// Connect signals for all instances
 		eventMask = EV_UPDATED | EV_UPDATED_MANUAL | EV_UPDATE_REQ;
-		if (dynamic_cast<UAVMetaObject *>(obj) != NULL) {
+		if (obj->isMetaObject()) {
 			eventMask |= EV_UNPACKED; // we also need to act on remote updates (unpack events)
 		}
 		connectToObjectInstances(obj, eventMask);
@@ -192,7 +210,7 @@ void Telemetry::updateObject(UAVObject *obj, uint32_t eventType)
 			// Connect signals for all instances
 			eventMask = EV_UPDATED | EV_UPDATED_MANUAL | EV_UPDATE_REQ;
 		}
-		if (dynamic_cast<UAVMetaObject *>(obj) != NULL) {
+		if (obj->isMetaObject()) {
 			eventMask |= EV_UNPACKED; // we also need to act on remote updates (unpack events)
 		}
 		connectToObjectInstances(obj, eventMask);
@@ -202,7 +220,7 @@ void Telemetry::updateObject(UAVObject *obj, uint32_t eventType)
 		setUpdatePeriod(obj, 0);
 		// Connect signals for all instances
 		eventMask = EV_UPDATED_MANUAL | EV_UPDATE_REQ;
-		if (dynamic_cast<UAVMetaObject *>(obj) != NULL) {
+		if (obj->isMetaObject()) {
 			eventMask |= EV_UNPACKED; // we also need to act on remote updates (unpack events)
 		}
 		connectToObjectInstances(obj, eventMask);
@@ -211,14 +229,24 @@ void Telemetry::updateObject(UAVObject *obj, uint32_t eventType)
 
 /** Called when a transaction is successfully completed (uavtalk event)
  */
+void Telemetry::transactionCompletedSlot(UAVObject *obj, bool success)
+{
+	// Called from the UAVTalk RX thread, see objectUpdatedAuto()
+	io_service.post(boost::bind(&Telemetry::transactionCompleted, this, obj, success));
+}
+
 void Telemetry::transactionCompleted(UAVObject *obj, bool success)
 {
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
 	// Lookup the transaction in the transaction map.
 	uint32_t objId = obj->getObjID();
 
-	std::map<uint32_t, ObjectTransactionInfo *>::iterator itr = transMap.find(objId);
+	trans_map::iterator itr = transMap.find(objId);
 	if (itr != transMap.end()) {
 		ObjectTransactionInfo *transInfo = itr->second;
+		if (success)
+			sampleRtt(transInfo);
 		// Remove this transaction as it's complete.
 		transInfo->timer.cancel();
 		transMap.erase(itr);
@@ -234,16 +262,28 @@ void Telemetry::transactionCompleted(UAVObject *obj, bool success)
 
 /** Called when a transaction is not completed within the timeout period (timer event)
  */
-void Telemetry::transactionTimeout(boost::system::error_code error, ObjectTransactionInfo *transInfo)
+void Telemetry::transactionTimeout(boost::system::error_code error, uint32_t objId, uint32_t seq)
 {
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
 	if (error)
 		return;
 
+	// Timer may expire just before the transaction is completed. Then the handler is
+	// already queued and cancel() has no effect, the record may even be reused by the
+	// next transaction of the object, so it is matched by the sequence number.
+	trans_map::iterator itr = transMap.find(objId);
+	if (itr == transMap.end() || itr->second->seq != seq)
+		return;
+
+	ObjectTransactionInfo *transInfo = itr->second;
+
 	// Check if more retries are pending
 	if (transInfo->retriesRemaining > 0) {
 		--transInfo->retriesRemaining;
+		transInfo->retried = true;
 		processObjectTransaction(transInfo);
-		++txRetries;
+		counters.add(LinkCounters::TX_RETRIES);
 
 	} else {
 		// Terminate transaction
@@ -251,11 +291,11 @@ void Telemetry::transactionTimeout(boost::system::error_code error, ObjectTransa
 		// Send signal
 		transInfo->obj->transactionCompleted(transInfo->obj, false);
 		// Remove this transaction as it's complete.
-		transMap.erase(transInfo->obj->getObjID());
+		transMap.erase(itr);
 		delete transInfo;
 		// Process new object updates from queue
 		processObjectQueue();
-		++txErrors;
+		counters.add(LinkCounters::TX_ERRORS);
 	}
 }
 
@@ -264,6 +304,7 @@ void Telemetry::transactionTimeout(boost::system::error_code error, ObjectTransa
 void Telemetry::processObjectTransaction(ObjectTransactionInfo *transInfo)
 {
 	// Initiate transaction
+	transInfo->started = TelemetryClock::now();
 	if (transInfo->objRequest) {
 		utalk->sendObjectRequest(transInfo->obj, transInfo->allInstances);
 	} else {
@@ -272,9 +313,9 @@ void Telemetry::processObjectTransaction(ObjectTransactionInfo *transInfo)
 
 	// Start timer if a response is expected
 	if (transInfo->objRequest || transInfo->acked) {
-		transInfo->timer.expires_from_now(boost::posix_time::milliseconds(REQ_TIMEOUT_MS));
+		transInfo->timer.expires_from_now(boost::posix_time::milliseconds(reqTimeoutMs));
 		transInfo->timer.async_wait(boost::bind(&Telemetry::transactionTimeout, this,
-					boost::asio::placeholders::error, transInfo));
+					boost::asio::placeholders::error, transInfo->obj->getObjID(), transInfo->seq));
 	} else {
 		// Otherwise, remove this transaction as it's complete.
 		transMap.erase(transInfo->obj->getObjID());
@@ -283,8 +324,10 @@ void Telemetry::processObjectTransaction(ObjectTransactionInfo *transInfo)
 }
 
 /** Process the event received from an object
+ * \param[in] timeIndex, release Periodic update: index in objList and release time
  */
-void Telemetry::processObjectUpdates(UAVObject *obj, EventMask event, bool allInstances, bool priority)
+void Telemetry::processObjectUpdates(UAVObject *obj, EventMask event, bool allInstances, bool priority,
+		int32_t timeIndex, const TelemetryClock::time_type &release)
 {
 	// Push event into queue
 	ObjectQueueInfo objInfo;
@@ -292,12 +335,14 @@ void Telemetry::processObjectUpdates(UAVObject *obj, EventMask event, bool allIn
 	objInfo.obj   = obj;
 	objInfo.event = event;
 	objInfo.allInstances = allInstances;
+	objInfo.timeIndex = timeIndex;
+	objInfo.release = release;
 
 	if (priority) {
 		if (objPriorityQueue.size() < MAX_QUEUE_SIZE) {
 			objPriorityQueue.push(objInfo);
 		} else {
-			++txErrors;
+			counters.add(LinkCounters::TX_ERRORS);
 			obj->transactionCompleted(obj, false); // emit
 			ROS_WARN_STREAM_NAMED("Telemetry", "Telemetry: priority event queue is full, event lost (" << obj->getName() << ")");
 		}
@@ -306,7 +351,7 @@ void Telemetry::processObjectUpdates(UAVObject *obj, EventMask event, bool allIn
 		if (objQueue.size() < MAX_QUEUE_SIZE) {
 			objQueue.push(objInfo);
 		} else {
-			++txErrors;
+			counters.add(LinkCounters::TX_ERRORS);
 			obj->transactionCompleted(obj, false); // emit
 		}
 	}
@@ -321,10 +366,12 @@ void Telemetry::processObjectQueue()
 {
 	// Get object information from queue (first the priority and then the regular queue)
 	ObjectQueueInfo objInfo;
+	bool priority = false;
 
 	if (!objPriorityQueue.empty()) {
 		objInfo = objPriorityQueue.front();
 		objPriorityQueue.pop();
+		priority = true;
 	} else if (!objQueue.empty()) {
 		objInfo = objQueue.front();
 		objQueue.pop();
@@ -354,17 +401,28 @@ void Telemetry::processObjectQueue()
 	if ((objInfo.event != EV_UNPACKED) &&
 			((objInfo.event != EV_UPDATED_PERIODIC) || (updateMode != UAVObject::UPDATEMODE_THROTTLED))) {
 
-		std::map<uint32_t, ObjectTransactionInfo *>::iterator itr = transMap.find(objInfo.obj->getObjID());
+		trans_map::iterator itr = transMap.find(objInfo.obj->getObjID());
 		if (itr != transMap.end()) {
-			ROS_DEBUG_STREAM_NAMED("Telemetry", "!!!!!! Making request for an object: " << objInfo.obj->getName() << " for which a request is already in progress!!!!!!");
+			// Starting new transaction would drop the one in progress (and leak it).
+			// Periodic update is skipped, others wait for the transaction completion.
+			ROS_DEBUG_STREAM_NAMED("Telemetry", "Transaction for " << objInfo.obj->getName() << " is in progress, "
+					<< ((objInfo.event == EV_UPDATED_PERIODIC) ? "skip update" : "requeue"));
+			if (objInfo.event != EV_UPDATED_PERIODIC) {
+				if (priority)
+					objPriorityQueue.push(objInfo);
+				else
+					objQueue.push(objInfo);
+			}
+			return;
 		}
 
 		UAVObject::Metadata metadata     = objInfo.obj->getMetadata();
 		ObjectTransactionInfo *transInfo = new ObjectTransactionInfo(io_service);
 		transInfo->obj                   = objInfo.obj;
 		transInfo->allInstances          = objInfo.allInstances;
-		transInfo->retriesRemaining      = MAX_RETRIES;
+		transInfo->retriesRemaining      = maxRetries;
 		transInfo->acked                 = UAVObject::GetGcsTelemetryAcked(metadata);
+		transInfo->seq                   = ++transSeq;
 
 		if (objInfo.event == EV_UPDATED || objInfo.event == EV_UPDATED_MANUAL || objInfo.event == EV_UPDATED_PERIODIC) {
 			transInfo->objRequest = false;
@@ -372,13 +430,20 @@ void Telemetry::processObjectQueue()
 			transInfo->objRequest = true;
 		}
 
+		// Periodic update lateness is measured at transmission
+		if (objInfo.timeIndex >= 0) {
+			ObjectTimeInfo &timeInfo = objList[objInfo.timeIndex];
+			boost::posix_time::time_duration lateness = TelemetryClock::now() - objInfo.release;
+			timeInfo.lateness->record(lateness.total_microseconds() * 1000);
+		}
+
 		// Insert the transaction into the transaction map.
 		transMap[objInfo.obj->getObjID()] = transInfo;
 		processObjectTransaction(transInfo);
 	}
 
 	// If this is a metaobject then make necessary telemetry updates
-	UAVMetaObject *metaobj = dynamic_cast<UAVMetaObject *>(objInfo.obj);
+	UAVMetaObject *metaobj = UAVMetaObject::cast(objInfo.obj);
 	if (metaobj != NULL) {
 		updateObject(metaobj->getParentObject(), EV_NONE);
 	} else if (updateMode != UAVObject::UPDATEMODE_THROTTLED) {
@@ -394,8 +459,8 @@ void Telemetry::processObjectQueue()
 	}
 }
 
-/** Check is any objects are pending for periodic updates
- * TODO: Clean-up
+/** Send periodic updates which are due, earliest deadline first,
+ * then sleep until the next release
  */
 void Telemetry::processPeriodicUpdates(boost::system::error_code error)
 {
@@ -404,56 +469,201 @@ void Telemetry::processPeriodicUpdates(boost::system::error_code error)
 	if (error)
 		return;
 
-	// Iterate through each object and update its timer, if zero then transmit object.
-	// Also calculate smallest delay to next update (will be used for setting timeToNextUpdateMs)
-	int32_t minDelay  = MAX_UPDATE_PERIOD_MS;
-	ObjectTimeInfo *objinfo;
-	int32_t offset;
-	boost::posix_time::ptime start_time, end_time;
-	boost::posix_time::time_duration elapsed;
-
-	for (int n = 0; n < objList.size(); ++n) {
-		objinfo = &objList[n];
-		// If object is configured for periodic updates
-		if (objinfo->updatePeriodMs > 0) {
-			objinfo->timeToNextUpdateMs -= timeToNextUpdateMs;
-			// Check if time for the next update
-			if (objinfo->timeToNextUpdateMs <= 0) {
-				// Reset timer
-				offset = (-objinfo->timeToNextUpdateMs) % objinfo->updatePeriodMs;
-				objinfo->timeToNextUpdateMs = objinfo->updatePeriodMs - offset;
-				// Send object
-				start_time = boost::posix_time::microsec_clock::universal_time();
-				processObjectUpdates(objinfo->obj, EV_UPDATED_PERIODIC, true, false);
-				end_time = boost::posix_time::microsec_clock::universal_time();
-				elapsed = end_time - start_time;
-				// Update timeToNextUpdateMs with the elapsed delay of sending the object;
-				timeToNextUpdateMs += elapsed.total_milliseconds();
-			}
-			// Update minimum delay
-			if (objinfo->timeToNextUpdateMs < minDelay) {
-				minDelay = objinfo->timeToNextUpdateMs;
-			}
+	timerExpiry = TelemetryClock::time_type();
+	inPeriodicUpdates = true;
+
+	TelemetryClock::time_type now = TelemetryClock::now();
+	while (!schedule.empty() && schedule.begin()->first <= now) {
+		TelemetryClock::time_type release = schedule.begin()->first;
+		int n = schedule.begin()->second;
+
+		schedule.erase(schedule.begin());
+		objList[n].scheduled = false;
+
+		// Send object
+		objList[n].updates++;
+		processObjectUpdates(objList[n].obj, EV_UPDATED_PERIODIC, true, false, n, release);
+
+		// Period may be changed by the update, then it is already scheduled
+		ObjectTimeInfo &info = objList[n];
+		if (info.scheduled || info.updatePeriodMs <= 0)
+			continue;
+
+		// Next release, whole periods which are already over are skipped
+		boost::posix_time::time_duration period = boost::posix_time::milliseconds(info.updatePeriodMs);
+		release += period;
+		if (release <= now) {
+			int64_t missed = (now - release).total_microseconds() / period.total_microseconds() + 1;
+			release += period * missed;
+			info.misses += missed;
 		}
+		setRelease(info, release);
+	}
+
+	inPeriodicUpdates = false;
+
+	// Restart timer
+	if (!schedule.empty()) {
+		timerExpiry = schedule.begin()->first;
+		updateTimer.expires_at(timerExpiry);
+		updateTimer.async_wait(boost::bind(&Telemetry::processPeriodicUpdates, this, boost::asio::placeholders::error));
 	}
+}
 
-	// Check if delay for the next update is too short
-	if (minDelay < MIN_UPDATE_PERIOD_MS) {
-		minDelay = MIN_UPDATE_PERIOD_MS;
+/** Keep object release in the schedule consistent with its period.
+ * Newly periodic objects get a phase within the period from the golden
+ * ratio sequence, so releases of objects with equal periods are spread
+ * evenly and deterministically. Shortened period pulls the release in.
+ */
+void Telemetry::schedulePeriodic(ObjectTimeInfo &info)
+{
+	if (info.updatePeriodMs <= 0) {
+		unschedule(info);
+		return;
 	}
 
-	// Done
-	timeToNextUpdateMs = minDelay;
+	TelemetryClock::time_type now = TelemetryClock::now();
+	boost::posix_time::time_duration period = boost::posix_time::milliseconds(info.updatePeriodMs);
 
-	// Restart timer
-	updateTimer.expires_from_now(boost::posix_time::milliseconds(timeToNextUpdateMs));
-	updateTimer.async_wait(boost::bind(&Telemetry::processPeriodicUpdates, this, boost::asio::placeholders::error));
+	if (!info.scheduled) {
+		double phase = std::fmod(phaseSeq++ * 0.6180339887498949, 1.0);
+		setRelease(info, now + boost::posix_time::microseconds(int64_t(phase * period.total_microseconds())));
+	} else if (info.release->first > now + period) {
+		setRelease(info, now + period);
+	}
 }
 
-Telemetry::TelemetryStats Telemetry::getStats()
+void Telemetry::setRelease(ObjectTimeInfo &info, const TelemetryClock::time_type &release)
+{
+	unschedule(info);
+	info.release = schedule.insert(std::make_pair(release, info.index));
+	info.scheduled = true;
+
+	// processPeriodicUpdates() restarts the timer itself
+	if (!inPeriodicUpdates && (timerExpiry.is_not_a_date_time() || release < timerExpiry)) {
+		timerExpiry = release;
+		updateTimer.expires_at(timerExpiry);
+		updateTimer.async_wait(boost::bind(&Telemetry::processPeriodicUpdates, this, boost::asio::placeholders::error));
+	}
+}
+
+void Telemetry::unschedule(ObjectTimeInfo &info)
+{
+	if (info.scheduled) {
+		schedule.erase(info.release);
+		info.scheduled = false;
+	}
+}
+
+/** Critical objects keep their period, GCSTelemetryStats is always critical (connection handshake)
+ */
+bool Telemetry::isCritical(UAVObject *obj)
+{
+	uint32_t objId = obj->getObjID();
+	return objId == GCSTelemetryStats::OBJID || criticalObjects.count(objId) > 0;
+}
+
+/** Compute effective period from base period, backoff and limits
+ */
+void Telemetry::applyBackoff(ObjectTimeInfo &info)
+{
+	if (info.basePeriodMs <= 0 || !adaptive || isCritical(info.obj)) {
+		info.backoff = 1.0;
+		info.updatePeriodMs = info.basePeriodMs;
+		schedulePeriodic(info);
+		return;
+	}
+
+	int32_t minPeriodMs = info.basePeriodMs;
+	int32_t maxPeriodMs = info.basePeriodMs * MAX_BACKOFF;
+	std::map<uint32_t, std::pair<int32_t, int32_t> >::iterator it = periodLimits.find(info.obj->getObjID());
+	if (it != periodLimits.end()) {
+		if (it->second.first > 0)
+			minPeriodMs = it->second.first;
+		if (it->second.second > 0)
+			maxPeriodMs = std::max(it->second.second, minPeriodMs);
+	}
+
+	float period = info.basePeriodMs * info.backoff;
+	if (period < minPeriodMs)
+		period = minPeriodMs;
+	if (period > maxPeriodMs)
+		period = maxPeriodMs;
+
+	// backoff does not grow past the limit, so recovery starts at once
+	info.backoff = std::max(period / info.basePeriodMs, 1.0f);
+	info.updatePeriodMs = int32_t(period + 0.5f);
+	schedulePeriodic(info);
+}
+
+/** Update smoothed RTT, retransmitted transactions are ambiguous and not sampled (Karn)
+ */
+void Telemetry::sampleRtt(ObjectTransactionInfo *transInfo)
+{
+	if (transInfo->retried || !(transInfo->objRequest || transInfo->acked))
+		return;
+
+	int32_t rtt = (TelemetryClock::now() - transInfo->started).total_milliseconds();
+	if (srttMs < 0)
+		srttMs = rtt;
+	else
+		srttMs += (rtt - srttMs) / 8;
+
+	if (minRttMs < 0 || rtt < minRttMs)
+		minRttMs = rtt;
+}
+
+/** AIMD of periodic updates, called each ADAPT_INTERVAL_MS.
+ * Link is congested if there were retries or timeouts since last check,
+ * the event queue is half full or smoothed RTT is well above the minimum.
+ * Then periods of non-critical objects are doubled, otherwise their rate
+ * grows by 1/RECOVERY_STEPS of the base rate until the base period is reached.
+ */
+void Telemetry::adaptPeriods(boost::system::error_code error)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
+	if (error)
+		return;
+
+	uint64_t retries = counters.get(LinkCounters::TX_RETRIES);
+	uint64_t errors  = counters.get(LinkCounters::TX_ERRORS);
+	bool congested = retries > lastRetries || errors > lastErrors
+		|| objQueue.size() >= MAX_QUEUE_SIZE / 2
+		|| (srttMs >= 0 && srttMs > 2 * minRttMs + RTT_SLACK_MS);
+
+	lastRetries = retries;
+	lastErrors  = errors;
+
+	if (adaptive) {
+		bool changed = false;
+		for (int n = 0; n < objList.size(); ++n) {
+			ObjectTimeInfo &info = objList[n];
+			if (info.basePeriodMs <= 0 || isCritical(info.obj))
+				continue;
+
+			int32_t period = info.updatePeriodMs;
+			if (congested)
+				info.backoff *= 2;
+			else if (info.backoff > 1.0f)
+				info.backoff = 1.0f / (1.0f / info.backoff + 1.0f / RECOVERY_STEPS);
+
+			applyBackoff(info);
+			changed |= info.updatePeriodMs > period;
+		}
+
+		if (changed)
+			backoffs.fetch_add(1, boost::memory_order_relaxed);
+	}
+
+	adaptTimer.expires_from_now(boost::posix_time::milliseconds(ADAPT_INTERVAL_MS));
+	adaptTimer.async_wait(boost::bind(&Telemetry::adaptPeriods, this, boost::asio::placeholders::error));
+}
+
+/** Get link and transaction counters, does not lock telemetry or UAVTalk
+ */
+Telemetry::TelemetryStats Telemetry::getStats()
+{
 	// Get UAVTalk stats
 	UAVTalk::ComStats utalkStats = utalk->getStats();
 
@@ -466,66 +676,163 @@ Telemetry::TelemetryStats Telemetry::getStats()
 	stats.rxObjectBytes = utalkStats.rxObjectBytes;
 	stats.rxObjects     = utalkStats.rxObjects;
 	stats.txObjects     = utalkStats.txObjects;
-	stats.txErrors      = utalkStats.txErrors + txErrors;
+	stats.txErrors      = utalkStats.txErrors + counters.get(LinkCounters::TX_ERRORS);
 	stats.rxErrors      = utalkStats.rxErrors;
-	stats.txRetries     = txRetries;
+	stats.txRetries     = counters.get(LinkCounters::TX_RETRIES);
+	stats.backoffs      = backoffs.load(boost::memory_order_relaxed);
 
 	// Done
 	return stats;
 }
 
-void Telemetry::resetStats()
+/** Set transaction (ack or object request) timeout and number of retries
+ */
+void Telemetry::setTransactionTimeout(uint32_t timeoutMs, int32_t retries)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	utalk->resetStats();
-	txErrors  = 0;
-	txRetries = 0;
+	reqTimeoutMs = timeoutMs;
+	maxRetries   = retries;
 }
 
-void Telemetry::objectUpdatedAuto(UAVObject *obj)
+/** Enable congestion-adaptive update periods (disabled by default)
+ */
+void Telemetry::setAdaptivePeriods(bool enable)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	processObjectUpdates(obj, EV_UPDATED, false, true);
+	adaptive = enable;
+	for (int n = 0; n < objList.size(); ++n)
+		applyBackoff(objList[n]);
 }
 
-void Telemetry::objectUpdatedManual(UAVObject *obj)
+/** Limit effective period of object type while backed off
+ * \param[in] minPeriodMs Lower limit, 0 for base period
+ * \param[in] maxPeriodMs Upper limit, 0 for MAX_BACKOFF times base period
+ */
+void Telemetry::setPeriodLimits(uint32_t objId, int32_t minPeriodMs, int32_t maxPeriodMs)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	processObjectUpdates(obj, EV_UPDATED_MANUAL, false, true);
+	periodLimits[objId] = std::make_pair(minPeriodMs, maxPeriodMs);
+	for (int n = 0; n < objList.size(); ++n)
+		if (objList[n].obj->getObjID() == objId)
+			applyBackoff(objList[n]);
 }
 
-void Telemetry::objectUpdatedPeriodic(UAVObject *obj)
+/** Critical objects are never slowed down
+ */
+void Telemetry::setCritical(uint32_t objId, bool critical)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	processObjectUpdates(obj, EV_UPDATED_PERIODIC, false, true);
+	if (critical)
+		criticalObjects.insert(objId);
+	else
+		criticalObjects.erase(objId);
+
+	for (int n = 0; n < objList.size(); ++n)
+		if (objList[n].obj->getObjID() == objId)
+			applyBackoff(objList[n]);
 }
 
-void Telemetry::objectUnpacked(UAVObject *obj)
+/** Base and effective periods of all periodic objects
+ */
+std::vector<Telemetry::PeriodInfo> Telemetry::getPeriods()
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
+	std::vector<PeriodInfo> periods;
 
-	processObjectUpdates(obj, EV_UNPACKED, false, true);
+	for (int n = 0; n < objList.size(); ++n) {
+		if (objList[n].basePeriodMs <= 0)
+			continue;
+
+		PeriodInfo info;
+		info.objId = objList[n].obj->getObjID();
+		info.basePeriodMs = objList[n].basePeriodMs;
+		info.effectivePeriodMs = objList[n].updatePeriodMs;
+		info.critical = isCritical(objList[n].obj);
+		periods.push_back(info);
+	}
+
+	return periods;
 }
 
-void Telemetry::updateRequested(UAVObject *obj)
+/** Lateness, slack and misses of periodic objects
+ */
+std::vector<Telemetry::ScheduleStats> Telemetry::getScheduleStats()
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
+	std::vector<ScheduleStats> all;
+
+	for (int n = 0; n < objList.size(); ++n) {
+		ObjectTimeInfo &info = objList[n];
+		if (info.updates == 0)
+			continue;
+
+		ScheduleStats stats;
+		stats.objId = info.obj->getObjID();
+		stats.periodMs = info.updatePeriodMs;
+		stats.updates = info.updates;
+		stats.misses = info.misses;
+		stats.latenessP50Us = info.lateness->getPercentile(50) / 1000;
+		stats.latenessP99Us = info.lateness->getPercentile(99) / 1000;
+		stats.latenessMaxUs = info.lateness->getMax() / 1000;
+		stats.minSlackUs = int64_t(info.updatePeriodMs) * 1000 - int64_t(stats.latenessMaxUs);
+		all.push_back(stats);
+	}
 
-	processObjectUpdates(obj, EV_UPDATE_REQ, false, true);
+	return all;
+}
+
+/* Object signals may come from any thread, often from UAVTalk RX thread
+ * with UAVTalk locked, so they are processed in the telemetry thread.
+ * Otherwise there is lock order inversion with processObjectTransaction().
+ */
+
+void Telemetry::objectUpdatedAuto(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processObjectEvent, this, obj, EV_UPDATED));
+}
+
+void Telemetry::objectUpdatedManual(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processObjectEvent, this, obj, EV_UPDATED_MANUAL));
+}
+
+void Telemetry::objectUpdatedPeriodic(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processObjectEvent, this, obj, EV_UPDATED_PERIODIC));
+}
+
+void Telemetry::objectUnpacked(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processObjectEvent, this, obj, EV_UNPACKED));
+}
+
+void Telemetry::updateRequested(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processObjectEvent, this, obj, EV_UPDATE_REQ));
 }
 
 void Telemetry::newObject(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processNewObject, this, obj));
+}
+
+void Telemetry::newInstance(UAVObject *obj)
+{
+	io_service.post(boost::bind(&Telemetry::processNewObject, this, obj));
+}
+
+void Telemetry::processObjectEvent(UAVObject *obj, EventMask event)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	registerObject(obj);
+	processObjectUpdates(obj, event, false, true);
 }
 
-void Telemetry::newInstance(UAVObject *obj)
+void Telemetry::processNewObject(UAVObject *obj)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
@@ -540,5 +847,7 @@ ObjectTransactionInfo::ObjectTransactionInfo(boost::asio::io_service &io) :
 	objRequest       = false;
 	retriesRemaining = 0;
 	acked = false;
+	retried = false;
+	seq = 0;
 }
 
@@ -24,17 +24,21 @@
 #ifndef TELEMETRY_H
 #define TELEMETRY_H
 
+#include <set>
+#include <boost/shared_ptr.hpp>
 #include <boost/pending/queue.hpp>
+#include <boost/atomic.hpp>
 #include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "uavtalk.h"
+#include "telemetryclock.h"
 #include "uavobjectmanager.h"
 #include "gcstelemetrystats.h"
 
 namespace openpilot
 {
 
-class ObjectTransactionInfo {
+class ObjectTransactionInfo : public PoolAllocated<ObjectTransactionInfo> {
 public:
 	ObjectTransactionInfo(boost::asio::io_service &io);
 
@@ -43,35 +47,73 @@ public:
 	bool objRequest;
 	int32_t retriesRemaining;
 	bool acked;
-	boost::asio::deadline_timer timer;
+	bool retried;
+	uint32_t seq;		/** identifies the transaction, records are reused by the pool */
+	boost::posix_time::ptime started;	/** last send, for RTT */
+	telemetry_timer timer;
 };
 
 class Telemetry {
 public:
+	/** Totals since construction, never reset */
 	typedef struct {
-		uint32_t txBytes;
-		uint32_t rxBytes;
-		uint32_t txObjectBytes;
-		uint32_t rxObjectBytes;
-		uint32_t rxObjects;
-		uint32_t txObjects;
-		uint32_t txErrors;
-		uint32_t rxErrors;
-		uint32_t txRetries;
+		uint64_t txBytes;
+		uint64_t rxBytes;
+		uint64_t txObjectBytes;
+		uint64_t rxObjectBytes;
+		uint64_t rxObjects;
+		uint64_t txObjects;
+		uint64_t txErrors;
+		uint64_t rxErrors;
+		uint64_t txRetries;
+		uint64_t backoffs;	/** congestion events which slowed periodic objects */
 	} TelemetryStats;
 
+	/** Periodic update of object type, see setAdaptivePeriods() */
+	typedef struct {
+		uint32_t objId;
+		int32_t basePeriodMs;		/** from metadata */
+		int32_t effectivePeriodMs;	/** currently used */
+		bool critical;
+	} PeriodInfo;
+
+	/** Timing of periodic updates of object type.
+	 * Lateness is time from the release to the update being transmitted,
+	 * so it includes waiting in the object queue behind other events;
+	 * slack is the rest of the period (deadline is the next release).
+	 */
+	typedef struct {
+		uint32_t objId;
+		int32_t periodMs;
+		uint64_t updates;
+		uint64_t misses;	/** releases skipped, update was a whole period late */
+		uint64_t latenessP50Us;
+		uint64_t latenessP99Us;
+		uint64_t latenessMaxUs;
+		int64_t minSlackUs;	/** period - max lateness */
+	} ScheduleStats;
+
 	Telemetry(boost::asio::io_service &io, UAVTalk *utalk, UAVObjectManager *objMngr);
 	~Telemetry();
 	TelemetryStats getStats();
-	void resetStats();
+	void setTransactionTimeout(uint32_t timeoutMs, int32_t retries);
+
+	void setAdaptivePeriods(bool enable);
+	void setPeriodLimits(uint32_t objId, int32_t minPeriodMs, int32_t maxPeriodMs);
+	void setCritical(uint32_t objId, bool critical);
+	std::vector<PeriodInfo> getPeriods();
+	std::vector<ScheduleStats> getScheduleStats();
 
 private:
 	// Constants
 	static const int REQ_TIMEOUT_MS = 250;
 	static const int MAX_RETRIES    = 2;
-	static const int MAX_UPDATE_PERIOD_MS = 1000;
-	static const int MIN_UPDATE_PERIOD_MS = 1;
 	static const int MAX_QUEUE_SIZE = 20;
+	// AIMD of periodic updates
+	static const int ADAPT_INTERVAL_MS = 1000;
+	static const int MAX_BACKOFF = 16;		/** default upper limit, times base period */
+	static const int RECOVERY_STEPS = 8;		/** rate increase per interval, 1/N of base rate */
+	static const int RTT_SLACK_MS = 20;
 
 	// Types
 	/** Events generated by objects
@@ -85,16 +127,28 @@ private:
 		EV_UPDATE_REQ       = 0x10  /** Request to update object data */
 	} EventMask;
 
+	/** Release time -> index in objList, earliest deadline first */
+	typedef std::multimap<TelemetryClock::time_type, int> Schedule;
+
 	typedef struct {
 		UAVObject *obj;
+		int32_t    index; /** in objList */
 		int32_t    updatePeriodMs; /** Update period in ms or 0 if no periodic updates are needed */
-		int32_t    timeToNextUpdateMs; /** Time delay to the next update */
+		int32_t    basePeriodMs; /** Period set by metadata, updatePeriodMs is larger while backed off */
+		float      backoff; /** Period multiplier, >= 1 */
+		bool       scheduled; /** release is in the schedule */
+		Schedule::iterator release;
+		boost::shared_ptr<LatencyHistogram> lateness; /** ns */
+		uint64_t   updates;
+		uint64_t   misses;
 	} ObjectTimeInfo;
 
 	typedef struct {
 		UAVObject *obj;
 		EventMask event;
 		bool allInstances;
+		int32_t timeIndex; /** in objList for periodic updates, else -1 */
+		TelemetryClock::time_type release; /** of periodic update */
 	} ObjectQueueInfo;
 
 	// Variables
@@ -105,12 +159,29 @@ private:
 	std::vector<ObjectTimeInfo> objList;
 	boost::queue<ObjectQueueInfo> objQueue;
 	boost::queue<ObjectQueueInfo> objPriorityQueue;
-	std::map<uint32_t, ObjectTransactionInfo *> transMap;
+	typedef std::map<uint32_t, ObjectTransactionInfo *, std::less<uint32_t>,
+		boost::fast_pool_allocator<std::pair<const uint32_t, ObjectTransactionInfo *> > > trans_map;
+
+	trans_map transMap;
 	boost::recursive_mutex mutex;
-	boost::asio::deadline_timer updateTimer;
-	int32_t timeToNextUpdateMs;
-	uint32_t txErrors;
-	uint32_t txRetries;
+	telemetry_timer updateTimer;
+	uint32_t reqTimeoutMs;
+	int32_t maxRetries;
+	LinkCounters counters;	/** transaction errors and retries */
+	bool adaptive;
+	telemetry_timer adaptTimer;
+	std::map<uint32_t, std::pair<int32_t, int32_t> > periodLimits;
+	std::set<uint32_t> criticalObjects;
+	uint64_t lastRetries;
+	uint64_t lastErrors;
+	int32_t srttMs;		/** smoothed RTT of acks and requests, -1 if no sample */
+	int32_t minRttMs;
+	boost::atomic<uint64_t> backoffs;
+	Schedule schedule;
+	TelemetryClock::time_type timerExpiry;	/** not_a_date_time if updateTimer is not armed */
+	bool inPeriodicUpdates;
+	uint32_t phaseSeq;
+	uint32_t transSeq;
 
 	// Methods
 	void registerObject(UAVObject *obj);
@@ -118,9 +189,16 @@ private:
 	void setUpdatePeriod(UAVObject *obj, int32_t periodMs);
 	void connectToObjectInstances(UAVObject *obj, uint32_t eventMask);
 	void updateObject(UAVObject *obj, uint32_t eventMask);
-	void processObjectUpdates(UAVObject *obj, EventMask event, bool allInstances, bool priority);
+	void processObjectUpdates(UAVObject *obj, EventMask event, bool allInstances, bool priority,
+			int32_t timeIndex = -1, const TelemetryClock::time_type &release = TelemetryClock::time_type());
 	void processObjectTransaction(ObjectTransactionInfo *transInfo);
 	void processObjectQueue();
+	bool isCritical(UAVObject *obj);
+	void applyBackoff(ObjectTimeInfo &info);
+	void schedulePeriodic(ObjectTimeInfo &info);
+	void setRelease(ObjectTimeInfo &info, const TelemetryClock::time_type &release);
+	void unschedule(ObjectTimeInfo &info);
+	void sampleRtt(ObjectTransactionInfo *transInfo);
 
 private: // slots:
 	void objectUpdatedAuto(UAVObject *obj);
@@ -130,11 +208,17 @@ private: // slots:
 	void updateRequested(UAVObject *obj);
 	void newObject(UAVObject *obj);
 	void newInstance(UAVObject *obj);
+	void transactionCompletedSlot(UAVObject *obj, bool success);
+
+	// handlers posted to io_service
+	void processObjectEvent(UAVObject *obj, EventMask event);
+	void processNewObject(UAVObject *obj);
 	void transactionCompleted(UAVObject *obj, bool success);
 
 	// timer handlers
 	void processPeriodicUpdates(boost::system::error_code ec);
-	void transactionTimeout(boost::system::error_code ec, ObjectTransactionInfo *info);
+	void adaptPeriods(boost::system::error_code ec);
+	void transactionTimeout(boost::system::error_code ec, uint32_t objId, uint32_t seq);
 };
 
 } // namespace openpilot
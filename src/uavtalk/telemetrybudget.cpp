@@ -0,0 +1,198 @@
+/**
+ ******************************************************************************
+ * @file       telemetrybudget.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Link bandwidth budget of periodic telemetry
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "telemetrybudget.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace openpilot;
+
+// Frame: sync(1), type(1), size(2), object ID(4), [instance ID(2)], data, checksum(1)
+static const double HEADER_LENGTH = 8;
+static const double INSTID_LENGTH = 2;
+static const double CHECKSUM_LENGTH = 1;
+
+TelemetryBudget::TelemetryBudget(UAVObjectManager *objMngr_, uint32_t baudrate_) :
+	objMngr(objMngr_),
+	baudrate(baudrate_),
+	utilization(0.8)
+{
+}
+
+/** Set part of the link capacity available for periodic telemetry (0..1)
+ */
+void TelemetryBudget::setUtilization(double utilization_)
+{
+	utilization = utilization_;
+}
+
+void TelemetryBudget::setPriority(uint32_t objId, Priority priority)
+{
+	priorities[objId] = priority;
+}
+
+/** Priority class of object, PRIORITY_NORMAL if not set
+ */
+TelemetryBudget::Priority TelemetryBudget::getPriority(uint32_t objId)
+{
+	std::map<uint32_t, Priority>::iterator it = priorities.find(objId);
+	return (it != priorities.end()) ? it->second : PRIORITY_NORMAL;
+}
+
+void TelemetryBudget::addItem(Report &report, UAVObject *obj, Direction dir, uint16_t periodMs, bool acked)
+{
+	double instances = objMngr->getNumInstances(obj->getObjID());
+	double header = HEADER_LENGTH + (obj->isSingleInstance() ? 0 : INSTID_LENGTH);
+	Item item;
+
+	item.obj = obj;
+	item.dir = dir;
+	item.priority = getPriority(obj->getObjID());
+	item.periodMs = periodMs;
+	item.proposedMs = periodMs;
+	item.frameBytes = instances * (header + obj->getNumBytes() + CHECKSUM_LENGTH);
+	item.ackBytes = (acked) ? instances * (header + CHECKSUM_LENGTH) : 0;
+	item.bytesPerSec = 1000.0 / periodMs * (item.frameBytes + item.ackBytes);
+
+	report.items.push_back(item);
+}
+
+double TelemetryBudget::bytesOn(const Item &item, Direction dir)
+{
+	return (item.dir == dir) ? item.frameBytes : item.ackBytes;
+}
+
+void TelemetryBudget::computeLoad(const Report &report, bool proposed, double load[DIR_COUNT])
+{
+	for (int d = 0; d < DIR_COUNT; ++d)
+		load[d] = 0;
+
+	for (std::vector<Item>::const_iterator it = report.items.begin(); it != report.items.end(); ++it) {
+		double rate = 1000.0 / ((proposed) ? it->proposedMs : it->periodMs);
+		for (int d = 0; d < DIR_COUNT; ++d)
+			load[d] += rate * bytesOn(*it, Direction(d));
+	}
+}
+
+/** Compute expected load and propose periods which fit.
+ * Lowest priority class is slowed down first, a class is scaled
+ * by a common factor (up to MAX_PERIOD_MS).
+ */
+TelemetryBudget::Report TelemetryBudget::solve()
+{
+	Report report;
+	UAVObjectManager::objects_map objects = objMngr->getObjects();
+
+	report.capacity = baudrate / 10.0;
+
+	for (UAVObjectManager::objects_map::iterator it = objects.begin(); it != objects.end(); ++it) {
+		UAVObject *obj = it->second[0];
+		if (obj->isMetaObject())
+			continue;
+
+		UAVObject::Metadata mdata = obj->getMetadata();
+		UAVObject::UpdateMode gcsMode = UAVObject::GetGcsTelemetryUpdateMode(mdata);
+		UAVObject::UpdateMode flightMode = UAVObject::GetFlightTelemetryUpdateMode(mdata);
+
+		if ((gcsMode == UAVObject::UPDATEMODE_PERIODIC || gcsMode == UAVObject::UPDATEMODE_THROTTLED) &&
+				mdata.gcsTelemetryUpdatePeriod > 0)
+			addItem(report, obj, DIR_TX, mdata.gcsTelemetryUpdatePeriod,
+					UAVObject::GetGcsTelemetryAcked(mdata));
+
+		if ((flightMode == UAVObject::UPDATEMODE_PERIODIC || flightMode == UAVObject::UPDATEMODE_THROTTLED) &&
+				mdata.flightTelemetryUpdatePeriod > 0)
+			addItem(report, obj, DIR_RX, mdata.flightTelemetryUpdatePeriod,
+					UAVObject::GetFlightTelemetryAcked(mdata));
+	}
+
+	computeLoad(report, false, report.load);
+
+	double budget = report.capacity * utilization;
+
+	for (int p = PRIORITY_LOW; p < PRIORITY_CRITICAL; ++p) {
+		for (int d = 0; d < DIR_COUNT; ++d) {
+			// periods are rounded and capped, so repeat until it fits or nothing is left to scale
+			for (int iter = 0; iter < MAX_ITERATIONS; ++iter) {
+				double load[DIR_COUNT];
+				computeLoad(report, true, load);
+
+				double excess = load[d] - budget;
+				if (excess <= 0)
+					break;
+
+				double scalable = 0;
+				for (std::vector<Item>::iterator it = report.items.begin(); it != report.items.end(); ++it)
+					if (it->priority == p && it->proposedMs < MAX_PERIOD_MS)
+						scalable += 1000.0 / it->proposedMs * bytesOn(*it, Direction(d));
+
+				if (scalable <= 0)
+					break;
+
+				double k = (excess < scalable) ? scalable / (scalable - excess) : double(MAX_PERIOD_MS);
+				for (std::vector<Item>::iterator it = report.items.begin(); it != report.items.end(); ++it) {
+					if (it->priority != p || bytesOn(*it, Direction(d)) == 0)
+						continue;
+
+					double period = std::ceil(it->proposedMs * k);
+					it->proposedMs = uint16_t(std::min(period, double(MAX_PERIOD_MS)));
+				}
+			}
+		}
+	}
+
+	computeLoad(report, true, report.proposedLoad);
+
+	report.fits = true;
+	report.solved = true;
+	for (int d = 0; d < DIR_COUNT; ++d) {
+		report.fits &= report.load[d] <= budget;
+		report.solved &= report.proposedLoad[d] <= budget;
+	}
+
+	for (std::vector<Item>::iterator it = report.items.begin(); it != report.items.end(); ++it)
+		it->bytesPerSec = 1000.0 / it->proposedMs * (it->frameBytes + it->ackBytes);
+
+	return report;
+}
+
+/** Set proposed periods to object metadata
+ */
+void TelemetryBudget::apply(const Report &report)
+{
+	std::map<UAVObject *, UAVObject::Metadata> changed;
+
+	for (std::vector<Item>::const_iterator it = report.items.begin(); it != report.items.end(); ++it) {
+		if (it->proposedMs == it->periodMs)
+			continue;
+
+		if (changed.find(it->obj) == changed.end())
+			changed[it->obj] = it->obj->getMetadata();
+
+		if (it->dir == DIR_TX)
+			changed[it->obj].gcsTelemetryUpdatePeriod = it->proposedMs;
+		else
+			changed[it->obj].flightTelemetryUpdatePeriod = it->proposedMs;
+	}
+
+	for (std::map<UAVObject *, UAVObject::Metadata>::iterator it = changed.begin(); it != changed.end(); ++it)
+		it->first->setMetadata(it->second);
+}
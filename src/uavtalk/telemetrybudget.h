@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * @file       telemetrybudget.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Link bandwidth budget of periodic telemetry
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef TELEMETRYBUDGET_H
+#define TELEMETRYBUDGET_H
+
+#include <map>
+#include <vector>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Checks that periodic telemetry fits on the link.
+ *
+ * Expected load of each direction is computed from object metadata:
+ * frames of PERIODIC and THROTTLED objects (worst case for throttled)
+ * times the number of instances, plus ACK frames of acked objects on
+ * the opposite direction. GCS periods load the uplink (TX), flight
+ * periods the downlink (RX); serial link carries baudrate / 10 bytes/s
+ * each way.
+ *
+ * If the load is above the target utilization, periods are scaled
+ * starting from the lowest priority class; critical objects are never
+ * scaled. Proposal may be applied through setMetadata(), flight
+ * periods then reach the autopilot with the metaobject update.
+ */
+class TelemetryBudget {
+public:
+	typedef enum {
+		PRIORITY_LOW,
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+		PRIORITY_CRITICAL,	/** never scaled */
+		PRIORITY_COUNT
+	} Priority;
+
+	typedef enum {
+		DIR_TX,		/** GCS -> autopilot, gcsTelemetryUpdatePeriod */
+		DIR_RX,		/** autopilot -> GCS, flightTelemetryUpdatePeriod */
+		DIR_COUNT
+	} Direction;
+
+	typedef struct {
+		UAVObject *obj;
+		Direction dir;
+		Priority priority;
+		uint16_t periodMs;	/** configured */
+		uint16_t proposedMs;	/** equal to periodMs if not scaled */
+		double frameBytes;	/** per update, all instances */
+		double ackBytes;	/** per update on the opposite direction */
+		double bytesPerSec;	/** load at proposed period, acks included */
+	} Item;
+
+	typedef struct {
+		double capacity;		/** bytes/s per direction */
+		double load[DIR_COUNT];		/** at configured periods */
+		double proposedLoad[DIR_COUNT];
+		bool fits;			/** configured periods fit */
+		bool solved;			/** proposed periods fit */
+		std::vector<Item> items;
+	} Report;
+
+	static const uint16_t MAX_PERIOD_MS = 65535;
+
+	TelemetryBudget(UAVObjectManager *objMngr, uint32_t baudrate);
+
+	void setUtilization(double utilization);
+	void setPriority(uint32_t objId, Priority priority);
+	Priority getPriority(uint32_t objId);
+
+	Report solve();
+	void apply(const Report &report);
+
+private:
+	static const int MAX_ITERATIONS = 16;
+
+	UAVObjectManager *objMngr;
+	uint32_t baudrate;
+	double utilization;
+	std::map<uint32_t, Priority> priorities;
+
+	void addItem(Report &report, UAVObject *obj, Direction dir, uint16_t periodMs, bool acked);
+	static void computeLoad(const Report &report, bool proposed, double load[DIR_COUNT]);
+	static double bytesOn(const Item &item, Direction dir);
+};
+
+} // namespace openpilot
+
+#endif // TELEMETRYBUDGET_H
@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * @file       telemetryclock.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Clock and timer type for telemetry scheduling
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "telemetryclock.h"
+
+using namespace openpilot;
+
+boost::atomic<int64_t> TelemetryClock::virtualUs(TelemetryClock::REAL_TIME);
+
+static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+TelemetryClock::time_type TelemetryClock::now()
+{
+	int64_t us = virtualUs.load(boost::memory_order_acquire);
+
+	if (us == REAL_TIME)
+		return boost::posix_time::microsec_clock::universal_time();
+
+	return epoch + boost::posix_time::microseconds(us);
+}
+
+bool TelemetryClock::isVirtual()
+{
+	return virtualUs.load(boost::memory_order_relaxed) != REAL_TIME;
+}
+
+/** Switch to virtual time
+ * \param[in] start Initial time
+ */
+void TelemetryClock::setVirtual(const time_type &start)
+{
+	virtualUs.store((start - epoch).total_microseconds(), boost::memory_order_release);
+}
+
+/** Switch back to the system clock
+ */
+void TelemetryClock::setReal()
+{
+	virtualUs.store(REAL_TIME, boost::memory_order_release);
+}
+
+/** Move virtual time forward, ignored for the system clock
+ */
+void TelemetryClock::advance(const duration_type &duration)
+{
+	int64_t us = virtualUs.load(boost::memory_order_acquire);
+
+	while (us != REAL_TIME &&
+			!virtualUs.compare_exchange_weak(us, us + duration.total_microseconds(), boost::memory_order_acq_rel));
+}
@@ -0,0 +1,95 @@
+/**
+ ******************************************************************************
+ * @file       telemetryclock.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Clock and timer type for telemetry scheduling
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef TELEMETRYCLOCK_H
+#define TELEMETRYCLOCK_H
+
+#include <boost/asio.hpp>
+#include <boost/atomic.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace openpilot
+{
+
+/** Time source of Telemetry, TelemetryMonitor and AutopilotEmulator.
+ *
+ * By default it is the system clock. In virtual mode time stands still
+ * until advance() is called, so long runs (hours of periodic updates,
+ * timeouts and reconnections) may be simulated in seconds.
+ * Virtual time is process wide, it is meant for tests and benchmarks.
+ */
+class TelemetryClock {
+public:
+	typedef boost::posix_time::ptime time_type;
+	typedef boost::posix_time::time_duration duration_type;
+
+	static time_type now();
+	static bool isVirtual();
+	static void setVirtual(const time_type &start);
+	static void setReal();
+	static void advance(const duration_type &duration);
+
+private:
+	static const int64_t REAL_TIME = -1;
+	static boost::atomic<int64_t> virtualUs; /** microseconds since epoch or REAL_TIME */
+};
+
+/** Asio time traits for TelemetryClock.
+ *
+ * In virtual mode the reactor is told that timers are due immediately,
+ * and it checks them against virtual time. The io_service should then be
+ * driven by poll() after each advance(), run() would spin.
+ */
+struct TelemetryTimeTraits {
+	typedef TelemetryClock::time_type time_type;
+	typedef TelemetryClock::duration_type duration_type;
+
+	static time_type now()
+	{
+		return TelemetryClock::now();
+	}
+
+	static time_type add(const time_type &t, const duration_type &d)
+	{
+		return t + d;
+	}
+
+	static duration_type subtract(const time_type &t1, const time_type &t2)
+	{
+		return t1 - t2;
+	}
+
+	static bool less_than(const time_type &t1, const time_type &t2)
+	{
+		return t1 < t2;
+	}
+
+	static boost::posix_time::time_duration to_posix_duration(const duration_type &d)
+	{
+		return TelemetryClock::isVirtual() ? boost::posix_time::time_duration() : d;
+	}
+};
+
+typedef boost::asio::basic_deadline_timer<TelemetryClock::time_type, TelemetryTimeTraits> telemetry_timer;
+
+} // namespace openpilot
+
+#endif // TELEMETRYCLOCK_H
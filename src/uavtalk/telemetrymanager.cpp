@@ -33,17 +33,27 @@ TelemetryManager::TelemetryManager(UAVObjectManager *objMngr_) :
 	io_service(),
 	io_work(new boost::asio::io_service::work(io_service)),
 	autopilotConnected(false),
-	objMngr(objMngr_)
+	objMngr(objMngr_),
+	utalk(NULL),
+	telemetry(NULL),
+	telemetryMon(NULL),
+	recorder(NULL),
+	tracer(NULL),
+	shaper(NULL)
 {
 	// run io_service for uavtalk && telemetry timers
 	boost::thread t(boost::bind(&boost::asio::io_service::run, &this->io_service));
 	io_thread.swap(t);
 }
 
+/** Destructor, timers of UAVTalk and Telemetry do not run after return
+ */
 TelemetryManager::~TelemetryManager()
 {
 	io_work.reset();
 	io_service.stop();
+	if (io_thread.joinable())
+		io_thread.join();
 }
 
 bool TelemetryManager::isConnected()
@@ -51,6 +61,48 @@ bool TelemetryManager::isConnected()
 	return autopilotConnected;
 }
 
+/** Set flight recorder, should be called before start()
+ */
+void TelemetryManager::setFlightRecorder(FlightRecorder *recorder_)
+{
+	recorder = recorder_;
+}
+
+/** Set latency tracer, should be called before start()
+ */
+void TelemetryManager::setLatencyTracer(LatencyTracer *tracer_)
+{
+	tracer = tracer_;
+}
+
+/** Set traffic shaper of the device, should be called before start()
+ */
+void TelemetryManager::setTrafficShaper(TrafficShaper *shaper_)
+{
+	shaper = shaper_;
+}
+
+/** Per-object traffic of the autopilot link, NULL before start()
+ */
+TrafficStats *TelemetryManager::getTrafficStats()
+{
+	return (utalk != NULL) ? &utalk->getTrafficStats() : NULL;
+}
+
+/** Telemetry of the autopilot link, NULL before start()
+ */
+Telemetry *TelemetryManager::getTelemetry()
+{
+	return telemetry;
+}
+
+/** Connection monitor of the autopilot link, NULL before start()
+ */
+TelemetryMonitor *TelemetryManager::getTelemetryMonitor()
+{
+	return telemetryMon;
+}
+
 void TelemetryManager::start(UAVTalkIOBase *dev)
 {
 	device = dev;
@@ -60,6 +112,9 @@ void TelemetryManager::start(UAVTalkIOBase *dev)
 void TelemetryManager::onStart()
 {
 	utalk        = new UAVTalk(device, objMngr);
+	utalk->setFlightRecorder(recorder);
+	utalk->setLatencyTracer(tracer);
+	utalk->setTrafficShaper(shaper);
 	telemetry    = new Telemetry(io_service, utalk, objMngr);
 	telemetryMon = new TelemetryMonitor(io_service, objMngr, telemetry);
 
@@ -79,20 +134,30 @@ void TelemetryManager::onStop()
 	telemetryMon->disconnected.disconnect(boost::bind(&TelemetryManager::onDisconnect, this));
 
 	delete telemetryMon;
+	telemetryMon = NULL;
 	delete telemetry;
+	telemetry = NULL;
 	delete utalk;
+	utalk = NULL;
 
 	onDisconnect();
 }
 
 void TelemetryManager::onConnect()
 {
+	if (recorder)
+		recorder->recordEvent(FlightRecorder::EV_CONNECTED);
+
 	autopilotConnected = true;
 	connected(); // emit signal
 }
 
 void TelemetryManager::onDisconnect()
 {
+	// dumps last frames if the link was lost
+	if (recorder && autopilotConnected)
+		recorder->recordEvent(FlightRecorder::EV_DISCONNECTED);
+
 	autopilotConnected = false;
 	disconnected(); // emit signal
 }
@@ -29,6 +29,8 @@
 #include "telemetrymonitor.h"
 #include "telemetry.h"
 #include "uavtalk.h"
+#include "flightrecorder.h"
+#include "latencytracer.h"
 #include "uavobjectmanager.h"
 
 namespace openpilot
@@ -42,6 +44,12 @@ public:
 	void start(UAVTalkIOBase *dev);
 	void stop();
 	bool isConnected();
+	void setFlightRecorder(FlightRecorder *recorder);
+	void setLatencyTracer(LatencyTracer *tracer);
+	void setTrafficShaper(TrafficShaper *shaper);
+	TrafficStats *getTrafficStats();
+	Telemetry *getTelemetry();
+	TelemetryMonitor *getTelemetryMonitor();
 
 	// signals:
 	boost::signals2::signal<void(void)> connected;
@@ -64,6 +72,9 @@ private:
 	Telemetry *telemetry;
 	TelemetryMonitor *telemetryMon;
 	UAVTalkIOBase *device;
+	FlightRecorder *recorder;
+	LatencyTracer *tracer;
+	TrafficShaper *shaper;
 	bool autopilotConnected;
 };
 
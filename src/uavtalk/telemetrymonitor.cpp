@@ -23,6 +23,7 @@
 
 #include "telemetrymonitor.h"
 #include "ros/console.h"
+#include <algorithm>
 
 using namespace openpilot;
 
@@ -31,13 +32,24 @@ using namespace openpilot;
 TelemetryMonitor::TelemetryMonitor(boost::asio::io_service &io, UAVObjectManager *objMngr, Telemetry *tel) :
 	io_service(io),
 	statsTimer(io_service),
-	connectionTimer(io_service)
+	connectionTimer(io_service),
+	statsUpdatePeriodMs(STATS_UPDATE_PERIOD_MS),
+	statsConnectPeriodMs(STATS_CONNECT_PERIOD_MS),
+	connectionTimeoutMs(CONNECTION_TIMEOUT_MS),
+	retrieveWindow(RETRIEVE_WINDOW),
+	retrieveTotal(0),
+	retrieveDone(0),
+	retrieveFailed(0),
+	cache(NULL),
+	cacheVerifying(false),
+	cacheFailed(0)
 {
 	this->objMngr    = objMngr;
 	this->tel        = tel;
-	this->objPending = NULL;
+	this->connectionTimeout = false;
 
-	start_time = boost::posix_time::microsec_clock::universal_time();
+	start_time = TelemetryClock::now();
+	memset(&lastStats, 0, sizeof(lastStats));
 
 	// Get stats objects
 	gcsStatsObj    = GCSTelemetryStats::GetInstance(objMngr);
@@ -47,7 +59,7 @@ TelemetryMonitor::TelemetryMonitor(boost::asio::io_service &io, UAVObjectManager
 	flightStatsObj->objectUpdated.connect(boost::bind(&TelemetryMonitor::flightStatsUpdated, this, _1));
 
 	// Start update timer
-	stats_interval = boost::posix_time::milliseconds(STATS_CONNECT_PERIOD_MS);
+	stats_interval = boost::posix_time::milliseconds(statsConnectPeriodMs);
 	statsTimer.expires_from_now(stats_interval);
 	statsTimer.async_wait(boost::bind(&TelemetryMonitor::processStatsUpdates, this, boost::asio::placeholders::error));
 }
@@ -56,6 +68,7 @@ TelemetryMonitor::~TelemetryMonitor()
 {
 	statsTimer.cancel();
 	connectionTimer.cancel();
+	stopRetrievingObjects();
 
 	// Before saying goodbye, set the GCS connection status to disconnected too:
 	GCSTelemetryStats::DataFields gcsStats = gcsStatsObj->getData();
@@ -65,36 +78,112 @@ TelemetryMonitor::~TelemetryMonitor()
 	gcsStatsObj->setData(gcsStats);
 }
 
+/** Set stats update periods (connected and while connecting) and the connection timeout.
+ * New periods are used from the next stats update.
+ */
+void TelemetryMonitor::setPeriods(uint32_t statsUpdateMs, uint32_t statsConnectMs, uint32_t connectionTimeoutMs)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	statsUpdatePeriodMs  = statsUpdateMs;
+	statsConnectPeriodMs = statsConnectMs;
+	this->connectionTimeoutMs = connectionTimeoutMs;
+
+	GCSTelemetryStats::DataFields gcsStats = gcsStatsObj->getData();
+	stats_interval = boost::posix_time::milliseconds(
+			(gcsStats.Status == GCSTelemetryStats::STATUS_CONNECTED) ? statsUpdatePeriodMs : statsConnectPeriodMs);
+}
+
+/** Set number of object requests in flight during retrieval (1 - one by one)
+ */
+void TelemetryMonitor::setRetrieveWindow(uint32_t requests)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	retrieveWindow = std::max(requests, uint32_t(1));
+}
+
+/** Use settings snapshot on connect: its metaobjects are applied at once,
+ * retrieved objects are compared with it and a stale snapshot is rewritten
+ * \param[in] cache Snapshot, NULL - no snapshot
+ */
+void TelemetryMonitor::setSettingsCache(SettingsCache *cache_)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	cache = cache_;
+}
+
 /** Initiate object retrieval, initialize queue with objects to be retrieved.
+ * Metaobjects go first (they set up telemetry of their parents), then settings,
+ * then data objects with OnChange update mode. Metaobjects already applied
+ * from the settings snapshot go last.
  */
 void TelemetryMonitor::startRetrievingObjects()
 {
 	// Clear object queue
-	while (!queue.empty())
-		queue.pop();
+	stopRetrievingObjects();
 
 	// Get all objects, add metaobjects, settings and data objects with OnChange update mode to the queue
+	std::deque<UAVObject *> settings, onchange;
 	UAVObjectManager::objects_map objs = objMngr->getObjects();
 	for (UAVObjectManager::objects_map::iterator it = objs.begin(); it != objs.end(); ++it) {
 
 		UAVObject *obj = it->second[0];
-		UAVMetaObject *mobj = dynamic_cast<UAVMetaObject *>(obj);
-		UAVDataObject *dobj = dynamic_cast<UAVDataObject *>(obj);
+		UAVMetaObject *mobj = UAVMetaObject::cast(obj);
+		UAVDataObject *dobj = UAVDataObject::cast(obj);
 		UAVObject::Metadata mdata = obj->getMetadata();
 
 		if (mobj != NULL) {
-			queue.push(obj);
+			queue.push_back(obj);
 		} else if (dobj != NULL) {
-			if (dobj->isSettings() ||
-				UAVObject::GetFlightTelemetryUpdateMode(mdata) == UAVObject::UPDATEMODE_ONCHANGE) {
-				queue.push(obj);
+			if (dobj->isSettings()) {
+				settings.push_back(obj);
+			} else if (UAVObject::GetFlightTelemetryUpdateMode(mdata) == UAVObject::UPDATEMODE_ONCHANGE) {
+				onchange.push_back(obj);
 			}
 		}
 	}
+	queue.insert(queue.end(), settings.begin(), settings.end());
+
+	queue.insert(queue.end(), onchange.begin(), onchange.end());
+
+	cacheVerifying = false;
+	cacheFailed = 0;
+	cachePending.clear();
+	if (cache != NULL && cache->load()) {
+		// Metaobjects in the snapshot set up telemetry at once. The autopilot may have
+		// other metadata with the same settings, so they are still retrieved (last)
+		// and compared with the snapshot like the settings.
+		std::deque<UAVObject *> retrieve, cached;
+
+		cache->applyMetadata();
+		cacheVerifying = true;
+		for (std::deque<UAVObject *>::iterator it = queue.begin(); it != queue.end(); ++it) {
+			if ((*it)->isMetaObject() && cache->contains(*it)) {
+				cachePending.insert(*it);
+				cached.push_back(*it);
+				continue;
+			}
+
+			if (SettingsCache::isCached(*it))
+				cachePending.insert(*it);
+			retrieve.push_back(*it);
+		}
+
+		retrieve.insert(retrieve.end(), cached.begin(), cached.end());
+		queue.swap(retrieve);
+		ROS_DEBUG_NAMED("TelemetryMonitor", "Settings snapshot loaded, verifying %zu objects", cachePending.size());
+	}
+
+	retrieveTotal  = queue.size();
+	retrieveDone   = 0;
+	retrieveFailed = 0;
+	retrieveStart  = TelemetryClock::now();
 
 	// Start retrieving
-	ROS_DEBUG_NAMED("TelemetryMonitor", "Starting to retrieve meta and settings objects from the autopilot (%zu objects)",
-			queue.size());
+	ROS_DEBUG_NAMED("TelemetryMonitor", "Starting to retrieve meta and settings objects from the autopilot (%zu objects, %u in flight)",
+			queue.size(), retrieveWindow);
 	retrieveNextObject();
 }
 
@@ -102,29 +191,61 @@ void TelemetryMonitor::startRetrievingObjects()
  */
 void TelemetryMonitor::stopRetrievingObjects()
 {
-	ROS_DEBUG_NAMED("TelemetryMonitor", "Object retrieval has been cancelled");
-	while (!queue.empty())
-		queue.pop();
+	if (!queue.empty() || !inFlight.empty())
+		ROS_DEBUG_NAMED("TelemetryMonitor", "Object retrieval has been cancelled");
+
+	queue.clear();
+	for (std::set<UAVObject *>::iterator it = inFlight.begin(); it != inFlight.end(); ++it)
+		(*it)->transactionCompleted.disconnect(boost::bind(&TelemetryMonitor::transactionCompleted, this, _1, _2));
+	inFlight.clear();
 }
 
-/** Retrieve the next object in the queue
+/** Request objects from the queue until the window is full
  */
 void TelemetryMonitor::retrieveNextObject()
 {
-	// If queue is empty return
-	if (queue.empty()) {
-		ROS_DEBUG_NAMED("TelemetryMonitor", "Object retrieval completed");
+	while (!queue.empty() && inFlight.size() < retrieveWindow) {
+		// Get next object from the queue
+		UAVObject *obj = queue.front();
+		queue.pop_front();
+		// Connect to object
+		obj->transactionCompleted.connect(boost::bind(&TelemetryMonitor::transactionCompleted, this, _1, _2));
+		inFlight.insert(obj);
+		// Request update
+		obj->requestUpdate();
+	}
+
+	// All done
+	if (queue.empty() && inFlight.empty()) {
+		ROS_DEBUG_NAMED("TelemetryMonitor", "Object retrieval completed in %ld ms (%zu failed%s)",
+				long((TelemetryClock::now() - retrieveStart).total_milliseconds()), retrieveFailed,
+				(cacheVerifying) ? ", snapshot is current" : "");
+
+		// Fully retrieved, next connect may use it
+		if (cache != NULL && !cacheVerifying && cacheFailed == 0)
+			cache->save();
+
 		connected(); // emit signal
-		return;
 	}
-	// Get next object from the queue
-	UAVObject *obj = queue.front();
-	queue.pop();
-	// Connect to object
-	obj->transactionCompleted.connect(boost::bind(&TelemetryMonitor::transactionCompleted, this, _1, _2));
-	// Request update
-	obj->requestUpdate();
-	objPending = obj;
+}
+
+/** Compare retrieved settings object or metaobject with the snapshot.
+ * Retrieved data is already in the object, on mismatch the snapshot is
+ * rewritten after the retrieval.
+ */
+void TelemetryMonitor::verifyCached(UAVObject *obj, bool success)
+{
+	if (cachePending.erase(obj) == 0)
+		return;
+
+	if (success && cache->matches(obj))
+		return;
+
+	ROS_INFO_NAMED("TelemetryMonitor", "Settings snapshot is stale (%s differs)", obj->getName().c_str());
+
+	cacheVerifying = false;
+	cache->invalidate();
+	cachePending.clear();
 }
 
 /** Called by the retrieved object when a transaction is completed.
@@ -132,9 +253,22 @@ void TelemetryMonitor::retrieveNextObject()
 void TelemetryMonitor::transactionCompleted(UAVObject *obj, bool success)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	if (inFlight.erase(obj) == 0)
+		return;
+
 	// Disconnect from sending object
 	obj->transactionCompleted.disconnect(boost::bind(&TelemetryMonitor::transactionCompleted, this, _1, _2));
-	objPending = NULL;
+	retrieveDone++;
+	if (!success) {
+		retrieveFailed++;
+		if (SettingsCache::isCached(obj))
+			cacheFailed++;
+	}
+	if (cacheVerifying)
+		verifyCached(obj, success);
+	retrievalProgress(retrieveDone, retrieveFailed, retrieveTotal); // emit signal
+
 	// Process next object if telemetry is still available
 	GCSTelemetryStats::DataFields gcsStats = gcsStatsObj->getData();
 	if (gcsStats.Status == GCSTelemetryStats::STATUS_CONNECTED) {
@@ -147,6 +281,13 @@ void TelemetryMonitor::transactionCompleted(UAVObject *obj, bool success)
 /** Called each time the flight stats object is updated by the autopilot
  */
 void TelemetryMonitor::flightStatsUpdated(UAVObject *obj)
+{
+	// Called from the UAVTalk RX thread, process it in the telemetry thread
+	// (processStatsUpdates() sets GCSTelemetryStats, which is handled by Telemetry)
+	io_service.post(boost::bind(&TelemetryMonitor::processFlightStats, this));
+}
+
+void TelemetryMonitor::processFlightStats()
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
@@ -171,17 +312,30 @@ void TelemetryMonitor::processStatsUpdates(boost::system::error_code error)
 	// Get telemetry stats
 	GCSTelemetryStats::DataFields gcsStats = gcsStatsObj->getData();
 	FlightTelemetryStats::DataFields flightStats = flightStatsObj->getData();
-	Telemetry::TelemetryStats telStats     = tel->getStats();
-
-	tel->resetStats();
-
-	boost::posix_time::ptime end_time = boost::posix_time::microsec_clock::universal_time();
+	Telemetry::TelemetryStats totalStats   = tel->getStats();
+
+	// Counters are never reset, use what changed since the previous update
+	Telemetry::TelemetryStats telStats;
+	telStats.txBytes       = totalStats.txBytes - lastStats.txBytes;
+	telStats.rxBytes       = totalStats.rxBytes - lastStats.rxBytes;
+	telStats.txObjectBytes = totalStats.txObjectBytes - lastStats.txObjectBytes;
+	telStats.rxObjectBytes = totalStats.rxObjectBytes - lastStats.rxObjectBytes;
+	telStats.rxObjects     = totalStats.rxObjects - lastStats.rxObjects;
+	telStats.txObjects     = totalStats.txObjects - lastStats.txObjects;
+	telStats.txErrors      = totalStats.txErrors - lastStats.txErrors;
+	telStats.rxErrors      = totalStats.rxErrors - lastStats.rxErrors;
+	telStats.txRetries     = totalStats.txRetries - lastStats.txRetries;
+	lastStats = totalStats;
+
+	boost::posix_time::ptime end_time = TelemetryClock::now();
 	boost::posix_time::time_duration interval = end_time - start_time;
 	start_time = end_time;
 
-	// Update stats object
-	gcsStats.RxDataRate  = (float)telStats.rxBytes / ((float)interval.total_milliseconds() / 1000.0);
-	gcsStats.TxDataRate  = (float)telStats.txBytes / ((float)interval.total_milliseconds() / 1000.0);
+	// Update stats object (forced update may come at the same millisecond)
+	if (interval.total_milliseconds() > 0) {
+		gcsStats.RxDataRate  = (float)telStats.rxBytes / ((float)interval.total_milliseconds() / 1000.0);
+		gcsStats.TxDataRate  = (float)telStats.txBytes / ((float)interval.total_milliseconds() / 1000.0);
+	}
 	gcsStats.RxFailures += telStats.rxErrors;
 	gcsStats.TxFailures += telStats.txErrors;
 	gcsStats.TxRetries  += telStats.txRetries;
@@ -190,7 +344,7 @@ void TelemetryMonitor::processStatsUpdates(boost::system::error_code error)
 	if (telStats.rxObjects > 0) {
 		connectionTimer.cancel();
 		connectionTimeout = false;
-		connectionTimer.expires_from_now(boost::posix_time::milliseconds(CONNECTION_TIMEOUT_MS));
+		connectionTimer.expires_from_now(boost::posix_time::milliseconds(connectionTimeoutMs));
 		connectionTimer.async_wait(boost::bind(&TelemetryMonitor::connectionTimeoutHandler, this, boost::asio::placeholders::error));
 	}
 
@@ -224,12 +378,12 @@ void TelemetryMonitor::processStatsUpdates(boost::system::error_code error)
 
 	// Act on new connections or disconnections
 	if (gcsStats.Status == GCSTelemetryStats::STATUS_CONNECTED && gcsStats.Status != oldStatus) {
-		stats_interval = boost::posix_time::milliseconds(STATS_UPDATE_PERIOD_MS);
+		stats_interval = boost::posix_time::milliseconds(statsUpdatePeriodMs);
 		ROS_INFO_NAMED("TelemetryMonitor", "Connection with the autopilot established");
 		startRetrievingObjects();
 	}
 	if (gcsStats.Status == GCSTelemetryStats::STATUS_DISCONNECTED && gcsStats.Status != oldStatus) {
-		stats_interval = boost::posix_time::milliseconds(STATS_CONNECT_PERIOD_MS);
+		stats_interval = boost::posix_time::milliseconds(statsConnectPeriodMs);
 		ROS_INFO_NAMED("TelemetryMonitor", "Connection with the autopilot lost");
 		ROS_INFO_NAMED("TelemetryMonitor", "Trying to connect to the autopilot");
 		disconnected(); // emit signal
@@ -24,11 +24,14 @@
 #ifndef TELEMETRYMONITOR_H
 #define TELEMETRYMONITOR_H
 
+#include <deque>
+#include <set>
 #include "uavobjectmanager.h"
 #include "gcstelemetrystats.h"
 #include "flighttelemetrystats.h"
 #include "systemstats.h"
 #include "telemetry.h"
+#include "settingscache.h"
 
 namespace openpilot
 {
@@ -39,38 +42,60 @@ public:
 	TelemetryMonitor(boost::asio::io_service &io, UAVObjectManager *objMngr, Telemetry *tel);
 	~TelemetryMonitor();
 
+	void setPeriods(uint32_t statsUpdateMs, uint32_t statsConnectMs, uint32_t connectionTimeoutMs);
+	void setRetrieveWindow(uint32_t requests);
+	void setSettingsCache(SettingsCache *cache);
+
 	// signals:
 	boost::signals2::signal<void(void)> connected;
 	boost::signals2::signal<void(void)> disconnected;
 	boost::signals2::signal<void(double txRate, double rxRate)> telemetryUpdated;
+	/** Object retrieval after connect, emitted on each completed request */
+	boost::signals2::signal<void(size_t done, size_t failed, size_t total)> retrievalProgress;
 
 private:
 	static const int STATS_UPDATE_PERIOD_MS  = 4000;
 	static const int STATS_CONNECT_PERIOD_MS = 2000;
 	static const int CONNECTION_TIMEOUT_MS   = 8000;
+	static const int RETRIEVE_WINDOW         = 8;	/** below Telemetry event queue size */
 
 	boost::asio::io_service &io_service;
 	UAVObjectManager *objMngr;
 	Telemetry *tel;
-	boost::queue<UAVObject *> queue;
+	std::deque<UAVObject *> queue;
+	std::set<UAVObject *> inFlight;
 	GCSTelemetryStats *gcsStatsObj;
 	FlightTelemetryStats *flightStatsObj;
-	boost::asio::deadline_timer statsTimer;
-	boost::asio::deadline_timer connectionTimer;
+	telemetry_timer statsTimer;
+	telemetry_timer connectionTimer;
 	boost::recursive_mutex mutex;
-	UAVObject *objPending;
 	bool connectionTimeout;
 	boost::posix_time::ptime start_time;
+	Telemetry::TelemetryStats lastStats;	/** counters at previous stats update */
 	boost::posix_time::time_duration stats_interval; // desired interval
+	uint32_t statsUpdatePeriodMs;
+	uint32_t statsConnectPeriodMs;
+	uint32_t connectionTimeoutMs;
+	uint32_t retrieveWindow;
+	size_t retrieveTotal;
+	size_t retrieveDone;
+	size_t retrieveFailed;
+	TelemetryClock::time_type retrieveStart;
+	SettingsCache *cache;
+	bool cacheVerifying;		/** snapshot is loaded, retrieved objects are being compared */
+	size_t cacheFailed;		/** cached objects not retrieved */
+	std::set<UAVObject *> cachePending;	/** settings and metaobjects not compared yet */
 
 	void startRetrievingObjects();
 	void retrieveNextObject();
 	void stopRetrievingObjects();
+	void verifyCached(UAVObject *obj, bool success);
 
 	// slots:
 	void transactionCompleted(UAVObject *obj, bool success);
 	void processStatsUpdates(boost::system::error_code error);
 	void flightStatsUpdated(UAVObject *obj);
+	void processFlightStats();
 	void connectionTimeoutHandler(boost::system::error_code error);
 };
 
@@ -0,0 +1,287 @@
+/**
+ ******************************************************************************
+ * @file       trafficshaper.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Token bucket shaping of UAVTalk transmit
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "trafficshaper.h"
+#include <algorithm>
+
+using namespace openpilot;
+
+/** Constructor
+ * \param[in] iodev Device
+ * \param[in] baudrate Link rate, 10 bits per byte, 0 - unlimited (priorities only)
+ */
+TrafficShaper::TrafficShaper(UAVTalkIOBase *iodev, uint32_t baudrate) :
+	io(iodev),
+	capacity(baudrate / 10.0),
+	drrIndex(0),
+	lastRefillNs(UAVTalkIOBase::monotonicNs()),
+	processPending(false),
+	io_service(),
+	io_work(new boost::asio::io_service::work(io_service)),
+	timer(io_service)
+{
+	const double burst = BURST_FRAMES * MAX_FRAME_LENGTH;
+	const ClassConfig defaults[CLASS_COUNT] = {
+		// strict, weight, share, queueLimit
+		{ true,  0, 0.25, 1024 },	// CLASS_CONTROL
+		{ true,  0, 0.25, 1024 },	// CLASS_ACK
+		{ false, 1, 1.0,  4096 },	// CLASS_SETTINGS
+		{ false, 3, 1.0,  4096 },	// CLASS_BULK
+	};
+
+	link.rate = capacity;
+	link.tokens = burst;
+
+	for (int n = 0; n < CLASS_COUNT; ++n) {
+		ClassState &cs = classes[n];
+
+		cs.config = defaults[n];
+		cs.stats.frames = 0;
+		cs.stats.bytes = 0;
+		cs.stats.dropped = 0;
+		cs.stats.queuedBytes = 0;
+		cs.bucket.rate = capacity * cs.config.share;
+		cs.bucket.tokens = burst;
+		cs.deficit = 0;
+		cs.turn = false;
+	}
+
+	// run io_service for releasing frames
+	boost::thread t(boost::bind(&boost::asio::io_service::run, &this->io_service));
+	io_thread.swap(t);
+}
+
+TrafficShaper::~TrafficShaper()
+{
+	io_work.reset();
+	io_service.stop();
+	io_thread.join();
+}
+
+void TrafficShaper::setClassConfig(Class cls, const ClassConfig &config)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	classes[cls].config = config;
+	classes[cls].bucket.rate = capacity * config.share;
+}
+
+TrafficShaper::ClassConfig TrafficShaper::getClassConfig(Class cls)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return classes[cls].config;
+}
+
+TrafficShaper::ClassStats TrafficShaper::getClassStats(Class cls)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	return classes[cls].stats;
+}
+
+/** Queue frame for transmit
+ * \return false if the class queue is full and the frame is dropped
+ */
+bool TrafficShaper::enqueue(Class cls, const uint8_t *data, size_t length)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	ClassState &cs = classes[cls];
+
+	if (cs.stats.queuedBytes + length > cs.config.queueLimit) {
+		cs.stats.dropped++;
+		return false;
+	}
+
+	cs.queue.push_back(std::vector<uint8_t>(data, data + length));
+	cs.stats.queuedBytes += length;
+
+	if (!processPending) {
+		processPending = true;
+		io_service.post(boost::bind(&TrafficShaper::process, this));
+	}
+
+	return true;
+}
+
+void TrafficShaper::refill()
+{
+	const double burst = BURST_FRAMES * MAX_FRAME_LENGTH;
+	uint64_t now = UAVTalkIOBase::monotonicNs();
+	double dt = (now - lastRefillNs) / 1e9;
+
+	lastRefillNs = now;
+	link.tokens = std::min(link.tokens + link.rate * dt, burst);
+	for (int n = 0; n < CLASS_COUNT; ++n)
+		classes[n].bucket.tokens = std::min(classes[n].bucket.tokens + classes[n].bucket.rate * dt, burst);
+}
+
+bool TrafficShaper::fits(ClassState &cs, size_t length)
+{
+	return (link.rate <= 0 || link.tokens >= length) &&
+		(cs.bucket.rate <= 0 || cs.bucket.tokens >= length);
+}
+
+/** Time until both link and class buckets hold length bytes
+ */
+uint64_t TrafficShaper::waitNs(ClassState &cs, size_t length)
+{
+	double wait = 0;
+
+	if (link.rate > 0 && link.tokens < length)
+		wait = (length - link.tokens) / link.rate;
+	if (cs.bucket.rate > 0 && cs.bucket.tokens < length)
+		wait = std::max(wait, (length - cs.bucket.tokens) / cs.bucket.rate);
+
+	return uint64_t(wait * 1e9) + 1;
+}
+
+void TrafficShaper::nextDrr()
+{
+	classes[drrIndex].turn = false;
+	for (int n = 0; n < CLASS_COUNT; ++n) {
+		drrIndex = (drrIndex + 1) % CLASS_COUNT;
+		if (!classes[drrIndex].config.strict)
+			break;
+	}
+}
+
+/** Select class of the next frame
+ * \param[out] wait Time until some queued frame may be sent, 0 if all queues are empty
+ * \return class or -1 if nothing can be sent now
+ */
+int TrafficShaper::nextClass(uint64_t &wait)
+{
+	wait = 0;
+
+	// Strict priority
+	for (int n = 0; n < CLASS_COUNT; ++n) {
+		ClassState &cs = classes[n];
+		if (!cs.config.strict || cs.queue.empty())
+			continue;
+
+		size_t length = cs.queue.front().size();
+		if (fits(cs, length))
+			return n;
+
+		uint64_t w = waitNs(cs, length);
+		wait = (wait == 0) ? w : std::min(wait, w);
+
+		// link is reserved for it, smaller frames of other classes must not pass
+		if (link.rate > 0 && link.tokens < length)
+			return -1;
+	}
+
+	// Deficit round robin, quantum is one max frame per weight unit,
+	// two passes so every class gets its quantum once
+	if (classes[drrIndex].config.strict)
+		nextDrr();
+
+	for (int n = 0; n < 2 * CLASS_COUNT; ++n) {
+		ClassState &cs = classes[drrIndex];
+		if (cs.config.strict)
+			break;	// no weighted classes
+
+		if (cs.queue.empty()) {
+			cs.deficit = 0;
+			nextDrr();
+			continue;
+		}
+
+		size_t length = cs.queue.front().size();
+		if (cs.deficit < length) {
+			if (cs.turn) {
+				nextDrr();
+				continue;
+			}
+			// deficit of a class waiting for its bucket is limited to two quanta
+			size_t quantum = cs.config.weight * MAX_FRAME_LENGTH;
+			cs.deficit = std::min(cs.deficit + quantum, 2 * quantum);
+			cs.turn = true;
+		}
+
+		if (fits(cs, length))
+			return drrIndex;
+
+		// keep the deficit, bucket will be refilled
+		uint64_t w = waitNs(cs, length);
+		wait = (wait == 0) ? w : std::min(wait, w);
+
+		// nobody may send before the link bucket is refilled, keep the turn
+		if (link.rate > 0 && link.tokens < length)
+			break;
+
+		nextDrr();
+	}
+
+	return -1;
+}
+
+/** Send frames while the buckets allow, then wait for tokens
+ */
+void TrafficShaper::process()
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+	uint64_t wait;
+
+	processPending = false;
+
+	for (;;) {
+		refill();
+
+		int cls = nextClass(wait);
+		if (cls < 0)
+			break;
+
+		ClassState &cs = classes[cls];
+		std::vector<uint8_t> frame;
+		frame.swap(cs.queue.front());
+		cs.queue.pop_front();
+
+		size_t length = frame.size();
+		link.tokens -= length;
+		cs.bucket.tokens -= length;
+		cs.stats.queuedBytes -= length;
+		cs.stats.frames++;
+		cs.stats.bytes += length;
+		if (!cs.config.strict)
+			cs.deficit -= std::min(cs.deficit, length);
+
+		lock.unlock();
+		if (io->is_open())
+			io->write(&frame[0], length);
+		lock.lock();
+	}
+
+	if (wait > 0) {
+		timer.expires_from_now(boost::posix_time::microseconds((wait + 999) / 1000));
+		timer.async_wait(boost::bind(&TrafficShaper::timerExpired, this, boost::asio::placeholders::error));
+	}
+}
+
+void TrafficShaper::timerExpired(boost::system::error_code error)
+{
+	if (error)
+		return;
+
+	process();
+}
@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * @file       trafficshaper.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Token bucket shaping of UAVTalk transmit
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef TRAFFICSHAPER_H
+#define TRAFFICSHAPER_H
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include "uavtalkiobase.h"
+
+namespace openpilot
+{
+
+/** Queues outgoing frames per traffic class and releases them at link rate.
+ *
+ * Link token bucket is filled at baudrate / 10 bytes/s, so frames wait
+ * here instead of the driver buffer, where they could not be reordered.
+ * Each class has its own bucket (share of the link) and a byte limited
+ * queue. Strict classes are served first in class order, the rest share
+ * the remaining capacity by deficit round robin with per-class weights.
+ * Frames are written to the device from the shaper thread.
+ */
+class TrafficShaper {
+public:
+	typedef enum {
+		CLASS_CONTROL,	/** connection handshake and object requests */
+		CLASS_ACK,	/** ACK and NACK */
+		CLASS_SETTINGS,	/** settings and metaobjects */
+		CLASS_BULK,	/** telemetry */
+		CLASS_COUNT
+	} Class;
+
+	typedef struct {
+		bool strict;		/** served before weighted classes */
+		uint32_t weight;	/** DRR weight of non-strict class */
+		double share;		/** class bucket rate, part of link capacity */
+		size_t queueLimit;	/** bytes, frames above are dropped */
+	} ClassConfig;
+
+	typedef struct {
+		uint64_t frames;
+		uint64_t bytes;
+		uint64_t dropped;
+		size_t queuedBytes;
+	} ClassStats;
+
+	static const size_t MAX_FRAME_LENGTH = 267;	/** header(10), payload(256), checksum(1) */
+
+	TrafficShaper(UAVTalkIOBase *iodev, uint32_t baudrate);
+	~TrafficShaper();
+
+	void setClassConfig(Class cls, const ClassConfig &config);
+	ClassConfig getClassConfig(Class cls);
+	ClassStats getClassStats(Class cls);
+
+	bool enqueue(Class cls, const uint8_t *data, size_t length);
+
+private:
+	static const size_t BURST_FRAMES = 2;	/** bucket depth */
+
+	typedef struct {
+		double rate;	/** bytes/s, 0 - unlimited */
+		double tokens;
+	} Bucket;
+
+	typedef struct {
+		ClassConfig config;
+		ClassStats stats;
+		Bucket bucket;
+		std::deque<std::vector<uint8_t> > queue;
+		size_t deficit;
+		bool turn;	/** got DRR quantum in the current round */
+	} ClassState;
+
+	UAVTalkIOBase *io;
+	double capacity;
+	Bucket link;
+	ClassState classes[CLASS_COUNT];
+	int drrIndex;
+	uint64_t lastRefillNs;
+	bool processPending;
+	boost::recursive_mutex mutex;
+
+	boost::asio::io_service io_service;
+	std::auto_ptr<boost::asio::io_service::work> io_work;
+	boost::thread io_thread;
+	boost::asio::deadline_timer timer;
+
+	void refill();
+	bool fits(ClassState &cs, size_t length);
+	uint64_t waitNs(ClassState &cs, size_t length);
+	int nextClass(uint64_t &wait);
+	void nextDrr();
+	void process();
+	void timerExpired(boost::system::error_code error);
+};
+
+} // namespace openpilot
+
+#endif // TRAFFICSHAPER_H
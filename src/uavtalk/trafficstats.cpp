@@ -0,0 +1,234 @@
+/**
+ ******************************************************************************
+ * @file       trafficstats.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Per-object UAVTalk traffic accounting
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "trafficstats.h"
+
+using namespace openpilot;
+
+TrafficStats::TrafficStats(UAVObjectManager *objMngr_) :
+	objMngr(objMngr_),
+	perInstance(false)
+{
+	for (size_t n = 0; n < MAX_TYPES; ++n)
+		entries[n].store(NULL);
+
+	initEntry(&unknown, UNKNOWN_OBJECT);
+}
+
+TrafficStats::~TrafficStats()
+{
+	for (size_t n = 0; n < MAX_TYPES; ++n)
+		delete entries[n].load();
+}
+
+/** Enable per-instance frame and byte counters
+ */
+void TrafficStats::setPerInstance(bool enable)
+{
+	perInstance.store(enable);
+}
+
+void TrafficStats::initEntry(Entry *entry, uint32_t objId)
+{
+	entry->objId = objId;
+	entry->rxFrames.store(0);
+	entry->rxBytes.store(0);
+	entry->rxErrors.store(0);
+	entry->rxLastNs.store(0);
+	entry->rxIntervalNs.store(0);
+	entry->rxJitterNs.store(0);
+	entry->txFrames.store(0);
+	entry->txBytes.store(0);
+	entry->txErrors.store(0);
+}
+
+/** Entry of object type, allocated on first use
+ */
+TrafficStats::Entry *TrafficStats::getEntry(UAVObject *obj)
+{
+	uint32_t idx = (obj != NULL) ? obj->getTypeIndex() : UAVObject::INVALID_TYPE_INDEX;
+	if (idx >= MAX_TYPES)
+		return &unknown;
+
+	Entry *entry = entries[idx].load(boost::memory_order_acquire);
+	if (entry != NULL)
+		return entry;
+
+	// RX and TX threads may race here
+	Entry *newEntry = new Entry;
+	initEntry(newEntry, obj->getObjID());
+	if (entries[idx].compare_exchange_strong(entry, newEntry, boost::memory_order_acq_rel))
+		return newEntry;
+
+	delete newEntry;
+	return entry;
+}
+
+/** Account received frame
+ * \param[in] obj Object (any instance) or NULL if unknown
+ * \param[in] instId Instance ID
+ * \param[in] data Frame carries object data (OBJ or OBJ_ACK), used for rate and jitter
+ * \param[in] bytes Frame length
+ * \param[in] stampNs Monotonic time of arrival
+ */
+void TrafficStats::rxFrame(UAVObject *obj, uint16_t instId, bool data, size_t bytes, uint64_t stampNs)
+{
+	Entry *entry = getEntry(obj);
+
+	increment(entry->rxFrames);
+	increment(entry->rxBytes, bytes);
+
+	if (data) {
+		uint64_t last = entry->rxLastNs.load(boost::memory_order_relaxed);
+		entry->rxLastNs.store(stampNs, boost::memory_order_relaxed);
+
+		if (last != 0 && stampNs > last) {
+			int64_t interval = stampNs - last;
+			int64_t mean = entry->rxIntervalNs.load(boost::memory_order_relaxed);
+			int64_t jitter = entry->rxJitterNs.load(boost::memory_order_relaxed);
+			int64_t dev;
+
+			if (mean == 0)
+				mean = interval;
+			else
+				mean += (interval - mean) >> EWMA_SHIFT;
+
+			dev = interval - mean;
+			if (dev < 0)
+				dev = -dev;
+			jitter += (dev - jitter) >> EWMA_SHIFT;
+
+			entry->rxIntervalNs.store(mean, boost::memory_order_relaxed);
+			entry->rxJitterNs.store(jitter, boost::memory_order_relaxed);
+		}
+	}
+
+	if (obj != NULL && perInstance.load(boost::memory_order_relaxed)) {
+		boost::mutex::scoped_lock lock(instMutex);
+		InstanceStats &inst = instances[std::make_pair(obj->getObjID(), instId)];
+		inst.rxFrames++;
+		inst.rxBytes += bytes;
+	}
+}
+
+/** Account CRC or length error
+ * \param[in] obj Object from frame header or NULL if unknown
+ */
+void TrafficStats::rxError(UAVObject *obj)
+{
+	increment(getEntry(obj)->rxErrors);
+}
+
+void TrafficStats::txFrame(UAVObject *obj, uint16_t instId, size_t bytes)
+{
+	Entry *entry = getEntry(obj);
+
+	increment(entry->txFrames);
+	increment(entry->txBytes, bytes);
+
+	if (obj != NULL && perInstance.load(boost::memory_order_relaxed)) {
+		boost::mutex::scoped_lock lock(instMutex);
+		InstanceStats &inst = instances[std::make_pair(obj->getObjID(), instId)];
+		inst.txFrames++;
+		inst.txBytes += bytes;
+	}
+}
+
+void TrafficStats::txError(UAVObject *obj)
+{
+	increment(getEntry(obj)->txErrors);
+}
+
+void TrafficStats::fillStats(Entry *entry, ObjectStats &stats)
+{
+	uint64_t interval = entry->rxIntervalNs.load(boost::memory_order_relaxed);
+
+	stats.objId    = entry->objId;
+	stats.rxFrames = entry->rxFrames.load(boost::memory_order_relaxed);
+	stats.rxBytes  = entry->rxBytes.load(boost::memory_order_relaxed);
+	stats.rxErrors = entry->rxErrors.load(boost::memory_order_relaxed);
+	stats.txFrames = entry->txFrames.load(boost::memory_order_relaxed);
+	stats.txBytes  = entry->txBytes.load(boost::memory_order_relaxed);
+	stats.txErrors = entry->txErrors.load(boost::memory_order_relaxed);
+	stats.rxRate   = (interval > 0) ? 1e9 / interval : 0.0;
+	stats.rxJitterMs = entry->rxJitterNs.load(boost::memory_order_relaxed) / 1e6;
+}
+
+/** Get traffic of object type (all instances)
+ * \param[in] objId Object ID or UNKNOWN_OBJECT
+ * \return false if there was no traffic
+ */
+bool TrafficStats::getObjectStats(uint32_t objId, ObjectStats &stats)
+{
+	Entry *entry;
+
+	if (objId == UNKNOWN_OBJECT) {
+		entry = &unknown;
+	} else {
+		UAVObject *obj = objMngr->getObject(objId);
+		if (obj == NULL || obj->getTypeIndex() >= MAX_TYPES)
+			return false;
+
+		entry = entries[obj->getTypeIndex()].load(boost::memory_order_acquire);
+		if (entry == NULL)
+			return false;
+	}
+
+	fillStats(entry, stats);
+	return true;
+}
+
+/** Get traffic of one instance, only counted after setPerInstance(true)
+ */
+bool TrafficStats::getInstanceStats(uint32_t objId, uint16_t instId, InstanceStats &stats)
+{
+	boost::mutex::scoped_lock lock(instMutex);
+
+	std::map<std::pair<uint32_t, uint16_t>, InstanceStats>::iterator it = instances.find(std::make_pair(objId, instId));
+	if (it == instances.end())
+		return false;
+
+	stats = it->second;
+	return true;
+}
+
+/** Get all objects with traffic, unknown entry first
+ */
+std::vector<TrafficStats::ObjectStats> TrafficStats::getAll()
+{
+	std::vector<ObjectStats> all;
+	ObjectStats stats;
+
+	fillStats(&unknown, stats);
+	all.push_back(stats);
+
+	for (size_t n = 0; n < MAX_TYPES; ++n) {
+		Entry *entry = entries[n].load(boost::memory_order_acquire);
+		if (entry == NULL)
+			continue;
+
+		fillStats(entry, stats);
+		all.push_back(stats);
+	}
+
+	return all;
+}
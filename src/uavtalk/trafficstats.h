@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * @file       trafficstats.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Per-object UAVTalk traffic accounting
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef TRAFFICSTATS_H
+#define TRAFFICSTATS_H
+
+#include <map>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include "uavobjectmanager.h"
+
+namespace openpilot
+{
+
+/** Frames, bytes, update rate, jitter and errors of each object type.
+ *
+ * Entries are kept in a dense array indexed by UAVObject::getTypeIndex(),
+ * so accounting a frame is an array access and a few relaxed stores.
+ * RX side is updated only by the RX thread, TX side under UAVTalk mutex,
+ * readers may query at any time. Frames of unknown objects and errors
+ * before the object ID is received go to the unknown entry.
+ * Per-instance counting is optional (map lookup under a mutex).
+ */
+class TrafficStats {
+public:
+	typedef struct {
+		uint32_t objId;
+		uint64_t rxFrames;
+		uint64_t rxBytes;	/** whole frames, header and checksum included */
+		uint64_t rxErrors;	/** CRC and length errors */
+		uint64_t txFrames;
+		uint64_t txBytes;
+		uint64_t txErrors;
+		double rxRate;		/** Hz, from averaged inter-arrival time of data frames */
+		double rxJitterMs;	/** mean deviation of the inter-arrival time */
+	} ObjectStats;
+
+	typedef struct {
+		uint64_t rxFrames;
+		uint64_t rxBytes;
+		uint64_t txFrames;
+		uint64_t txBytes;
+	} InstanceStats;
+
+	static const uint32_t UNKNOWN_OBJECT = 0;	/** objId of the unknown entry */
+
+	TrafficStats(UAVObjectManager *objMngr);
+	~TrafficStats();
+
+	void setPerInstance(bool enable);
+
+	// RX thread
+	void rxFrame(UAVObject *obj, uint16_t instId, bool data, size_t bytes, uint64_t stampNs);
+	void rxError(UAVObject *obj);
+	// TX, under UAVTalk mutex
+	void txFrame(UAVObject *obj, uint16_t instId, size_t bytes);
+	void txError(UAVObject *obj);
+
+	bool getObjectStats(uint32_t objId, ObjectStats &stats);
+	bool getInstanceStats(uint32_t objId, uint16_t instId, InstanceStats &stats);
+	std::vector<ObjectStats> getAll();
+
+private:
+	static const size_t MAX_TYPES = 1024;
+	static const int EWMA_SHIFT = 4;	/** gain 1/16, as RFC 3550 jitter */
+
+	typedef boost::atomic<uint64_t> Counter;
+
+	typedef struct {
+		uint32_t objId;
+		Counter rxFrames;
+		Counter rxBytes;
+		Counter rxErrors;
+		Counter rxLastNs;
+		Counter rxIntervalNs;
+		Counter rxJitterNs;
+		Counter txFrames;
+		Counter txBytes;
+		Counter txErrors;
+	} Entry;
+
+	UAVObjectManager *objMngr;
+	boost::atomic<Entry *> entries[MAX_TYPES];
+	Entry unknown;
+	boost::atomic<bool> perInstance;
+	boost::mutex instMutex;
+	std::map<std::pair<uint32_t, uint16_t>, InstanceStats> instances;
+
+	Entry *getEntry(UAVObject *obj);
+	void fillStats(Entry *entry, ObjectStats &stats);
+	static void initEntry(Entry *entry, uint32_t objId);
+	static inline void increment(Counter &counter, uint64_t value = 1)
+	{
+		// single writer, no need for atomic add
+		counter.store(counter.load(boost::memory_order_relaxed) + value, boost::memory_order_relaxed);
+	}
+};
+
+} // namespace openpilot
+
+#endif // TRAFFICSTATS_H
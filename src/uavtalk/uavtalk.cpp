@@ -25,6 +25,8 @@
  * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
  */
 #include "uavtalk.h"
+#include "gcstelemetrystats.h"
+#include "flighttelemetrystats.h"
 
 //#define UAVTALK_DEBUG
 #ifdef UAVTALK_DEBUG
@@ -34,8 +36,6 @@
   #define UAVTALK_LOG_DEBUG(args...)
 #endif // UAVTALK_DEBUG
 
-#define SYNC_VAL 0x3C
-
 using namespace openpilot;
 
 const uint8_t UAVTalk::crc_table[256] = {
@@ -60,15 +60,20 @@ const uint8_t UAVTalk::crc_table[256] = {
 
 /** Constructor
  */
-UAVTalk::UAVTalk(UAVTalkIOBase *iodev, UAVObjectManager *objMngr)
+UAVTalk::UAVTalk(UAVTalkIOBase *iodev, UAVObjectManager *objMngr) :
+	trafficStats(objMngr)
 {
 	io = iodev;
 	this->objMngr  = objMngr;
 
 	rxState = STATE_SYNC;
 	rxPacketLength = 0;
-
-	memset(&stats, 0, sizeof(ComStats));
+	recorder = NULL;
+	tracer = NULL;
+	shaper = NULL;
+	rxReadStamp = 0;
+	rxObj = NULL;
+	rxDecodedStamp = 0;
 
 	io->sig_read.connect(boost::bind(&UAVTalk::processInputStream, this, _1, _2));
 }
@@ -82,21 +87,59 @@ UAVTalk::~UAVTalk()
 }
 
 
-/** Reset the statistics counters
+/** Attach flight recorder, all received and sent frames are recorded
+ * \param[in] recorder Recorder (NULL to detach)
  */
-void UAVTalk::resetStats()
+void UAVTalk::setFlightRecorder(FlightRecorder *recorder)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
-	memset(&stats, 0, sizeof(ComStats));
+	this->recorder = recorder;
 }
 
-/** Get the statistics counters
+/** Attach latency tracer, received object updates are timed from IO read to subscribers return
+ * \param[in] tracer Tracer (NULL to detach)
  */
-UAVTalk::ComStats UAVTalk::getStats()
+void UAVTalk::setLatencyTracer(LatencyTracer *tracer)
 {
 	boost::recursive_mutex::scoped_lock lock(mutex);
 
+	this->tracer = tracer;
+}
+
+/** Send frames through traffic shaper
+ * \param[in] shaper Shaper writing to the same device (NULL to write directly)
+ */
+void UAVTalk::setTrafficShaper(TrafficShaper *shaper)
+{
+	boost::recursive_mutex::scoped_lock lock(mutex);
+
+	this->shaper = shaper;
+}
+
+/** Get per-object traffic counters
+ */
+TrafficStats &UAVTalk::getTrafficStats()
+{
+	return trafficStats;
+}
+
+/** Get the statistics counters, does not lock the protocol
+ */
+UAVTalk::ComStats UAVTalk::getStats()
+{
+	ComStats stats;
+
+	stats.txBytes       = counters.get(LinkCounters::TX_BYTES);
+	stats.rxBytes       = counters.get(LinkCounters::RX_BYTES);
+	stats.txObjectBytes = counters.get(LinkCounters::TX_OBJECT_BYTES);
+	stats.rxObjectBytes = counters.get(LinkCounters::RX_OBJECT_BYTES);
+	stats.rxObjects     = counters.get(LinkCounters::RX_OBJECTS);
+	stats.txObjects     = counters.get(LinkCounters::TX_OBJECTS);
+	stats.txErrors      = counters.get(LinkCounters::TX_ERRORS);
+	stats.rxErrors      = counters.get(LinkCounters::RX_ERRORS);
+	stats.rxUnknown     = counters.get(LinkCounters::RX_UNKNOWN);
+
 	return stats;
 }
 
@@ -105,6 +148,10 @@ UAVTalk::ComStats UAVTalk::getStats()
 void UAVTalk::processInputStream(uint8_t *data, size_t length)
 {
     if (io && io->is_open()) {
+        // stamp of driver read completion, frames completed in this chunk use it
+        rxReadStamp = (io->rxStamp != 0) ? io->rxStamp : UAVTalkIOBase::monotonicNs();
+
+        counters.add(LinkCounters::RX_BYTES, length);
         for (size_t i = 0; i < length; i++)
             processInputByte(data[i]);
     }
@@ -151,10 +198,10 @@ void UAVTalk::cancelTransaction(UAVObject *obj)
 		return;
 	}
 
-	std::map<uint32_t, Transaction *>::iterator itr = transMap.find(objId);
+	trans_map::iterator itr = transMap.find(objId);
 	if (itr != transMap.end()) {
-		transMap.erase(objId);
 		delete itr->second;
+		transMap.erase(itr);
 	}
 }
 
@@ -194,9 +241,6 @@ bool UAVTalk::objectTransaction(UAVObject *obj, uint8_t type, bool allInstances)
  */
 bool UAVTalk::processInputByte(uint8_t rxbyte)
 {
-	// Update stats
-	stats.rxBytes++;
-
 	rxPacketLength++; // update packet byte count
 
 	// Receive state machine
@@ -277,18 +321,29 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 		// Search for object, if not found reset state machine
 		memcpy(&rxObjId, rxTmpBuffer, sizeof(rxObjId)); // XXX TODO make conversion for big endian hosts
 		{
-			UAVObject *rxObj = objMngr->getObject(rxObjId);
+			rxObj = objMngr->getObject(rxObjId);
 			if (rxObj == NULL && rxType != TYPE_OBJ_REQ) {
-				stats.rxErrors++;
-				rxState = STATE_SYNC;
-				UAVTALK_LOG_DEBUG("UAVTalk: ObjID->Sync (badtype) ObjID=0x%08x", rxObjId);
-				break;
+				if (recorder)
+					recorder->recordEvent(FlightRecorder::EV_UNKNOWN_OBJECT, rxObjId);
+
+				// Object not built in (see UAVOBJ_SUBSET), updates are skipped, not resynced
+				if (rxType != TYPE_OBJ && rxType != TYPE_OBJ_ACK) {
+					counters.add(LinkCounters::RX_ERRORS);
+					trafficStats.rxError(NULL);
+					rxState = STATE_SYNC;
+					UAVTALK_LOG_DEBUG("UAVTalk: ObjID->Sync (badtype) ObjID=0x%08x", rxObjId);
+					break;
+				}
 			}
 
 			// Determine data length
 			if (rxType == TYPE_OBJ_REQ || rxType == TYPE_ACK || rxType == TYPE_NACK) {
 				rxLength = 0;
 				rxInstanceLength = 0;
+			} else if (rxObj == NULL) {
+				// unknown layout: instance ID and data are skipped by the frame size
+				rxLength = (packetSize > rxPacketLength) ? packetSize - rxPacketLength : 0;
+				rxInstanceLength = 0;
 			} else {
 				rxLength = rxObj->getNumBytes();
 				rxInstanceLength = (rxObj->isSingleInstance() ? 0 : 2);
@@ -296,7 +351,8 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 
 			// Check length and determine next state
 			if (rxLength >= MAX_PAYLOAD_LENGTH) {
-				stats.rxErrors++;
+				counters.add(LinkCounters::RX_ERRORS);
+				trafficStats.rxError(rxObj);
 				rxState = STATE_SYNC;
 				UAVTALK_LOG_DEBUG("UAVTalk: ObjID->Sync (oversize)");
 				break;
@@ -304,7 +360,10 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 
 			// Check the lengths match
 			if ((rxPacketLength + rxInstanceLength + rxLength) != packetSize) { // packet error - mismatched packet size
-				stats.rxErrors++;
+				counters.add(LinkCounters::RX_ERRORS);
+				trafficStats.rxError(rxObj);
+				if (recorder)
+					recorder->recordEvent(FlightRecorder::EV_LENGTH_ERROR, rxObjId);
 				rxState = STATE_SYNC;
 				UAVTALK_LOG_DEBUG("UAVTalk: ObjID->Sync (length mismatch)");
 				break;
@@ -314,7 +373,7 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 			if (rxObj == NULL) {
 				// This is a non-existing object, just skip to checksum
 				// and we'll send a NACK next.
-				rxState  = STATE_CS;
+				rxState  = (rxLength > 0) ? STATE_DATA : STATE_CS;
 				UAVTALK_LOG_DEBUG("UAVTalk: ObjID->CSum (no obj)");
 				rxInstId = 0;
 				rxCount  = 0;
@@ -387,23 +446,44 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 		rxCSPacket = rxbyte;
 
 		if (rxCS != rxCSPacket) { // packet error - faulty CRC
-			stats.rxErrors++;
+			counters.add(LinkCounters::RX_ERRORS);
+			trafficStats.rxError(rxObj);
+			if (recorder)
+				recorder->recordEvent(FlightRecorder::EV_CRC_ERROR, rxObjId);
 			rxState = STATE_SYNC;
 			UAVTALK_LOG_DEBUG("UAVTalk: CSum->Sync (badcrc)");
 			break;
 		}
 
 		if (rxPacketLength != packetSize + 1) { // packet error - mismatched packet size
-			stats.rxErrors++;
+			counters.add(LinkCounters::RX_ERRORS);
+			trafficStats.rxError(rxObj);
+			if (recorder)
+				recorder->recordEvent(FlightRecorder::EV_LENGTH_ERROR, rxObjId);
 			rxState = STATE_SYNC;
 			UAVTALK_LOG_DEBUG("UAVTalk: CSum->Sync (length mismatch)");
 			break;
 		}
 
+		if (tracer)
+			rxDecodedStamp = UAVTalkIOBase::monotonicNs();
+
+		trafficStats.rxFrame(rxObj, rxInstId, rxType == TYPE_OBJ || rxType == TYPE_OBJ_ACK,
+				rxPacketLength, rxReadStamp);
+
+		if (recorder)
+			recorder->recordFrame(FlightRecorder::REC_RX_FRAME, rxType, rxObjId, rxInstId, rxBuffer, rxLength);
+
 		mutex.lock();
-		receiveObject(rxType, rxObjId, rxInstId, rxBuffer, rxLength);
-		stats.rxObjectBytes += rxLength;
-		stats.rxObjects++;
+		if (rxObj == NULL && rxType != TYPE_OBJ_REQ) {
+			counters.add(LinkCounters::RX_UNKNOWN);
+			if (rxType == TYPE_OBJ_ACK)
+				transmitNack(rxObjId); // sender stops retrying
+		} else {
+			receiveObject(rxType, rxObjId, rxInstId, rxBuffer, rxLength);
+			counters.add(LinkCounters::RX_OBJECT_BYTES, rxLength);
+			counters.add(LinkCounters::RX_OBJECTS);
+		}
 		mutex.unlock();
 
 		rxState = STATE_SYNC;
@@ -412,7 +492,8 @@ bool UAVTalk::processInputByte(uint8_t rxbyte)
 
 	default:
 		rxState = STATE_SYNC;
-		stats.rxErrors++;
+		counters.add(LinkCounters::RX_ERRORS);
+		trafficStats.rxError(NULL);
 		UAVTALK_LOG_DEBUG("UAVTalk: \?\?\?->Sync"); // Use the escape character for '?' so that the tripgraph isn't triggered.
 	}
 
@@ -541,7 +622,7 @@ UAVObject *UAVTalk::updateObject(uint32_t objId, uint16_t instId, uint8_t *data)
         }
 
         // Make sure this is a data object
-        UAVDataObject *dobj = dynamic_cast<UAVDataObject *>(tobj);
+        UAVDataObject *dobj = UAVDataObject::cast(tobj);
         if (dobj == NULL) {
             return NULL;
         }
@@ -552,17 +633,34 @@ UAVObject *UAVTalk::updateObject(uint32_t objId, uint16_t instId, uint8_t *data)
             return NULL;
         }
 
-        instobj->deserialize(data);
+        unpackObject(instobj, data);
 
         return instobj;
     } else {
         // Unpack data into object instance
-        obj->deserialize(data);
+        unpackObject(obj, data);
 
         return obj;
     }
 }
 
+/** Unpack received data, subscribers are called from deserialize().
+ * objectReceived subscribers get the payload before it is copied,
+ * objects with disabled data cache are not unpacked at all.
+ * Records the frame latency if tracer is attached.
+ */
+void UAVTalk::unpackObject(UAVObject *obj, uint8_t *data)
+{
+	uint64_t updateStamp = (tracer && rxReadStamp != 0) ? UAVTalkIOBase::monotonicNs() : 0;
+
+	obj->objectReceived(obj, data); // emit signal
+	if (obj->isDataCached())
+		obj->deserialize(data);
+
+	if (updateStamp != 0)
+		tracer->recordFrame(obj, rxReadStamp, rxDecodedStamp, updateStamp, UAVTalkIOBase::monotonicNs());
+}
+
 /** Check if a transaction is pending and if yes complete it.
  */
 void UAVTalk::updateNack(UAVObject *obj)
@@ -574,10 +672,10 @@ void UAVTalk::updateNack(UAVObject *obj)
 
 	uint32_t objId = obj->getObjID();
 
-	std::map<uint32_t, Transaction *>::iterator itr = transMap.find(objId);
+	trans_map::iterator itr = transMap.find(objId);
 	if (itr != transMap.end() && (itr->second->obj->getInstID() == obj->getInstID() || itr->second->allInstances)) {
-		transMap.erase(objId);
 		delete itr->second;
+		transMap.erase(itr);
 
 		transactionCompleted(obj, false); // emit signal
 	}
@@ -590,10 +688,10 @@ void UAVTalk::updateAck(UAVObject *obj)
 {
 	uint32_t objId = obj->getObjID();
 
-	std::map<uint32_t, Transaction *>::iterator itr = transMap.find(objId);
+	trans_map::iterator itr = transMap.find(objId);
 	if (itr != transMap.end() && (itr->second->obj->getInstID() == obj->getInstID() || itr->second->allInstances)) {
-		transMap.erase(objId);
 		delete itr->second;
+		transMap.erase(itr);
 
 		transactionCompleted(obj, true); // emit signal
 	}
@@ -643,6 +741,40 @@ bool UAVTalk::transmitObject(UAVObject *obj, uint8_t type, bool allInstances)
 	}
 }
 
+/** Write frame from txBuffer to the device or traffic shaper
+ * \return false if the shaper dropped the frame
+ */
+bool UAVTalk::writeFrame(uint8_t type, UAVObject *obj, size_t length)
+{
+	if (shaper == NULL) {
+		io->write(txBuffer, length);
+		return true;
+	}
+
+	return shaper->enqueue(trafficClass(type, obj), txBuffer, length);
+}
+
+/** Traffic class of frame, see TrafficShaper
+ */
+TrafficShaper::Class UAVTalk::trafficClass(uint8_t type, UAVObject *obj)
+{
+	if (type == TYPE_ACK || type == TYPE_NACK)
+		return TrafficShaper::CLASS_ACK;
+
+	if (type == TYPE_OBJ_REQ || (obj != NULL &&
+			(obj->getObjID() == GCSTelemetryStats::OBJID || obj->getObjID() == FlightTelemetryStats::OBJID)))
+		return TrafficShaper::CLASS_CONTROL;
+
+	if (obj->isMetaObject())
+		return TrafficShaper::CLASS_SETTINGS;
+
+	UAVDataObject *dobj = UAVDataObject::cast(obj);
+	if (dobj != NULL && dobj->isSettings())
+		return TrafficShaper::CLASS_SETTINGS;
+
+	return TrafficShaper::CLASS_BULK;
+}
+
 /** Transmit a NACK through the telemetry link.
  * \param[in] objId the ObjectID we rejected
  */
@@ -655,22 +787,28 @@ bool UAVTalk::transmitNack(uint32_t objId)
 	//qToLittleEndian<quint32>(objId, &txBuffer[4]);
 	memcpy(&txBuffer[4], &objId, sizeof(objId)); // XXX htole32
 
-	// Calculate checksum
-	txBuffer[dataOffset] = updateCRC(0, txBuffer, dataOffset);
-
 	//qToLittleEndian<quint16>(dataOffset, &txBuffer[2]);
 	memcpy(&txBuffer[2], &dataOffset, 2); // XXX
 
+	// Calculate checksum
+	txBuffer[dataOffset] = updateCRC(0, txBuffer, dataOffset);
+
 	// Send buffer, check that the transmit backlog does not grow above limit
-	if (io && io->is_open() /*&& io->bytesToWrite() < TX_BUFFER_SIZE*/) {
-		io->write(txBuffer, dataOffset + CHECKSUM_LENGTH);
+	if (io && io->is_open() && writeFrame(TYPE_NACK, objMngr->getObject(objId), dataOffset + CHECKSUM_LENGTH)) {
 	} else {
-		++stats.txErrors;
+		counters.add(LinkCounters::TX_ERRORS);
+		trafficStats.txError(objMngr->getObject(objId));
+		if (recorder)
+			recorder->recordEvent(FlightRecorder::EV_TX_ERROR, objId);
 		return false;
 	}
 
+	if (recorder)
+		recorder->recordFrame(FlightRecorder::REC_TX_FRAME, TYPE_NACK, objId, 0, NULL, 0);
+
 	// Update stats
-	stats.txBytes += 8 + CHECKSUM_LENGTH;
+	counters.add(LinkCounters::TX_BYTES, 8 + CHECKSUM_LENGTH);
+	trafficStats.txFrame(objMngr->getObject(objId), 0, 8 + CHECKSUM_LENGTH);
 
 	// Done
 	return true;
@@ -687,7 +825,7 @@ bool UAVTalk::transmitSingleObject(UAVObject *obj, uint8_t type, bool allInstanc
 	int32_t length;
 	int32_t dataOffset;
 	uint32_t objId;
-	uint16_t instId;
+	uint16_t instId = 0;
 	uint16_t allInstId = ALL_INSTANCES;
 
 	// Setup type and object id fields
@@ -740,17 +878,25 @@ bool UAVTalk::transmitSingleObject(UAVObject *obj, uint8_t type, bool allInstanc
 	txBuffer[dataOffset + length] = updateCRC(0, txBuffer, dataOffset + length);
 
 	// Send buffer, check that the transmit backlog does not grow above limit
-	if (io && io->is_open() /*&& io->bytesToWrite() < TX_BUFFER_SIZE*/) {
-		io->write(txBuffer, dataOffset + length + CHECKSUM_LENGTH);
+	if (io && io->is_open() && writeFrame(type, obj, dataOffset + length + CHECKSUM_LENGTH)) {
 	} else {
-		++stats.txErrors;
+		counters.add(LinkCounters::TX_ERRORS);
+		trafficStats.txError(obj);
+		if (recorder)
+			recorder->recordEvent(FlightRecorder::EV_TX_ERROR, objId);
 		return false;
 	}
 
+	if (recorder)
+		recorder->recordFrame(FlightRecorder::REC_TX_FRAME, type, objId,
+				obj->isSingleInstance() ? 0 : (allInstances ? allInstId : instId),
+				&txBuffer[dataOffset], length);
+
 	// Update stats
-	++stats.txObjects;
-	stats.txBytes += dataOffset + length + CHECKSUM_LENGTH;
-	stats.txObjectBytes += length;
+	counters.add(LinkCounters::TX_OBJECTS);
+	counters.add(LinkCounters::TX_BYTES, dataOffset + length + CHECKSUM_LENGTH);
+	trafficStats.txFrame(obj, instId, dataOffset + length + CHECKSUM_LENGTH);
+	counters.add(LinkCounters::TX_OBJECT_BYTES, length);
 
 	// Done
 	return true;
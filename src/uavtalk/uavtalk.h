@@ -23,23 +23,36 @@
 #ifndef UAVTALK_H
 #define UAVTALK_H
 
+#include <boost/pool/pool_alloc.hpp>
 #include "uavobjectmanager.h"
+#include "uavobjectpool.h"
 #include "uavtalkiobase.h"
+#include "flightrecorder.h"
+#include "latencytracer.h"
+#include "linkcounters.h"
+#include "trafficstats.h"
+#include "trafficshaper.h"
 
 namespace openpilot
 {
 
+class UAVTalkLogDecoder;
+
 class UAVTalk {
+	friend class UAVTalkLogDecoder;
+
 public:
+	/** Totals since construction, never reset */
 	typedef struct {
-		uint32_t txBytes;
-		uint32_t rxBytes;
-		uint32_t txObjectBytes;
-		uint32_t rxObjectBytes;
-		uint32_t rxObjects;
-		uint32_t txObjects;
-		uint32_t txErrors;
-		uint32_t rxErrors;
+		uint64_t txBytes;
+		uint64_t rxBytes;
+		uint64_t txObjectBytes;
+		uint64_t rxObjectBytes;
+		uint64_t rxObjects;
+		uint64_t txObjects;
+		uint64_t txErrors;
+		uint64_t rxErrors;
+		uint64_t rxUnknown;	/** updates of objects not in this build, skipped */
 	} ComStats;
 
 	UAVTalk(UAVTalkIOBase *iodev, UAVObjectManager *objMngr);
@@ -48,7 +61,10 @@ public:
 	bool sendObjectRequest(UAVObject *obj, bool allInstances);
 	void cancelTransaction(UAVObject *obj);
 	ComStats getStats();
-	void resetStats();
+	TrafficStats &getTrafficStats();
+	void setFlightRecorder(FlightRecorder *recorder);
+	void setLatencyTracer(LatencyTracer *tracer);
+	void setTrafficShaper(TrafficShaper *shaper);
 
 	// signals:
 	boost::signals2::signal<void(UAVObject *obj, bool success)> transactionCompleted;
@@ -57,12 +73,15 @@ private: // slots:
 	void processInputStream(uint8_t *data, size_t lenght);
 
 protected:
-	typedef struct {
+	struct Transaction : public PoolAllocated<Transaction> {
 		UAVObject *obj;
 		bool allInstances;
-	} Transaction;
+	};
+	typedef std::map<uint32_t, Transaction *, std::less<uint32_t>,
+		boost::fast_pool_allocator<std::pair<const uint32_t, Transaction *> > > trans_map;
 
 	// Constants
+	static const uint8_t SYNC_VAL = 0x3C;
 	static const int TYPE_MASK    = 0xF8;
 	static const int TYPE_VER     = 0x20;
 	static const int TYPE_OBJ     = (TYPE_VER | 0x00);
@@ -93,13 +112,14 @@ protected:
 	UAVTalkIOBase *io;
 	UAVObjectManager *objMngr;
 	boost::recursive_mutex mutex;
-	std::map<uint32_t, Transaction *> transMap;
+	trans_map transMap;
 	uint8_t rxBuffer[MAX_PACKET_LENGTH];
 	uint8_t txBuffer[MAX_PACKET_LENGTH];
 	// Variables used by the receive state machine
 	uint8_t  rxTmpBuffer[4];
 	uint8_t  rxType;
 	uint32_t rxObjId;
+	UAVObject *rxObj;
 	uint16_t rxInstId;
 	uint16_t rxLength;
 	uint16_t rxPacketLength;
@@ -109,20 +129,29 @@ protected:
 	int32_t rxCount;
 	int32_t packetSize;
 	RxStateType rxState;
-	ComStats stats;
+	LinkCounters counters;
+	TrafficStats trafficStats;
+	FlightRecorder *recorder;
+	LatencyTracer *tracer;
+	TrafficShaper *shaper;
+	uint64_t rxReadStamp;
+	uint64_t rxDecodedStamp;
 
 	// Methods
 	bool objectTransaction(UAVObject *obj, uint8_t type, bool allInstances);
 	bool processInputByte(uint8_t rxbyte);
 	virtual bool receiveObject(uint8_t type, uint32_t objId, uint16_t instId, uint8_t *data, size_t length);
 	UAVObject *updateObject(uint32_t objId, uint16_t instId, uint8_t *data);
+	void unpackObject(UAVObject *obj, uint8_t *data);
 	void updateAck(UAVObject *obj);
 	void updateNack(UAVObject *obj);
 	bool transmitNack(uint32_t objId);
 	bool transmitObject(UAVObject *obj, uint8_t type, bool allInstances);
 	bool transmitSingleObject(UAVObject *obj, uint8_t type, bool allInstances);
-	uint8_t updateCRC(uint8_t crc, const uint8_t data);
-	uint8_t updateCRC(uint8_t crc, const uint8_t *data, size_t length);
+	bool writeFrame(uint8_t type, UAVObject *obj, size_t length);
+	TrafficShaper::Class trafficClass(uint8_t type, UAVObject *obj);
+	static uint8_t updateCRC(uint8_t crc, const uint8_t data);
+	static uint8_t updateCRC(uint8_t crc, const uint8_t *data, size_t length);
 };
 
 } // namespace openpilot
@@ -23,6 +23,7 @@
 #ifndef UAVTALKIOBASE_H
 #define UAVTALKIOBASE_H
 
+#include <time.h>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/signals2.hpp>
@@ -38,11 +39,24 @@ public:
 	boost::signals2::signal<void(uint8_t *data, size_t lenght)> sig_read;
 	boost::signals2::signal<void()> sig_closed;
 
+	/** Monotonic time (ns) of the read completion being emitted by sig_read, 0 if unknown */
+	uint64_t rxStamp;
+
+	UAVTalkIOBase() : rxStamp(0) {}
+
 	virtual void write(const uint8_t *data, size_t length) = 0;
 	//ssize_t read(uint8_t *data, size_t length);
 	//size_t available();
 	virtual bool is_open() = 0;
 
+	static uint64_t monotonicNs()
+	{
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
 private:
 };
 
@@ -0,0 +1,301 @@
+/**
+ ******************************************************************************
+ * @file       uavtalklogdecoder.cpp
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Offline parallel decoder for UAVTalk captures
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "uavtalklogdecoder.h"
+#include "uavobjectcodec.h"
+#include <fstream>
+#include <algorithm>
+
+using namespace openpilot;
+
+static bool record_time_less(const UAVTalkLogDecoder::Record &a, const UAVTalkLogDecoder::Record &b)
+{
+	return a.timestamp < b.timestamp;
+}
+
+/** Constructor
+ * Object sizes are copied from the manager, so decoding threads
+ * do not touch the manager (and its mutex) at all.
+ */
+UAVTalkLogDecoder::UAVTalkLogDecoder(UAVObjectManager *objMngr)
+{
+	UAVObjectManager::objects_map objs = objMngr->getObjects();
+	for (UAVObjectManager::objects_map::iterator it = objs.begin(); it != objs.end(); ++it) {
+		ObjectInfo info;
+		info.numBytes = it->second[0]->getNumBytes();
+		info.isSingleInst = it->second[0]->isSingleInstance();
+		objInfo[it->first] = info;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+}
+
+UAVTalkLogDecoder::~UAVTalkLogDecoder()
+{
+}
+
+/** Load capture file into memory
+ * \param[in] path Capture file
+ * \param[in] format Capture format
+ * \return Success (true), Failure (false)
+ */
+bool UAVTalkLogDecoder::load(const std::string &path, LogFormat format)
+{
+	std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	stream.clear();
+	timeIndex.clear();
+	records.clear();
+
+	if (format == FORMAT_OPL)
+		return loadOPL(file);
+
+	stream.swap(file);
+	return true;
+}
+
+/** Unpack OpenPilot GCS log records into one continuous stream
+ * and remember where each record starts.
+ */
+bool UAVTalkLogDecoder::loadOPL(const std::vector<uint8_t> &file)
+{
+	size_t pos = 0;
+
+	stream.reserve(file.size());
+	while (pos + sizeof(uint32_t) + sizeof(int64_t) <= file.size()) {
+		uint32_t timestamp;
+		int64_t size;
+
+		// little endian, as written by GCS on x86
+		UAVObjectCodec::unpack(&timestamp, &file[pos], 1);
+		UAVObjectCodec::unpack(&size, &file[pos + sizeof(timestamp)], 1);
+		pos += sizeof(timestamp) + sizeof(size);
+
+		if (size < 0 || pos + size > file.size())
+			break; // truncated log
+
+		timeIndex.push_back(std::make_pair(stream.size(), timestamp));
+		stream.insert(stream.end(), file.begin() + pos, file.begin() + pos + size);
+		pos += size;
+	}
+
+	return !timeIndex.empty();
+}
+
+/** Decode loaded stream
+ * \param[in] threads Number of worker threads (0 - one per core)
+ */
+void UAVTalkLogDecoder::decode(unsigned int threads)
+{
+	if (threads == 0)
+		threads = boost::thread::hardware_concurrency();
+
+	size_t nchunks = std::max<size_t>(1, std::min<size_t>(threads, stream.size() / MIN_CHUNK_SIZE));
+	std::vector<Chunk> chunks(nchunks);
+
+	// Split at frame boundaries
+	size_t begin = 0;
+	for (size_t n = 0; n < nchunks; ++n) {
+		chunks[n].begin = begin;
+		chunks[n].badBytes = 0;
+		if (n + 1 < nchunks)
+			begin = findBoundary(std::max(begin, stream.size() * (n + 1) / nchunks), stream.size());
+		else
+			begin = stream.size();
+		chunks[n].end = begin;
+	}
+
+	if (nchunks == 1) {
+		decodeChunk(&chunks[0]);
+	} else {
+		boost::thread_group workers;
+		for (size_t n = 0; n < nchunks; ++n)
+			workers.create_thread(boost::bind(&UAVTalkLogDecoder::decodeChunk, this, &chunks[n]));
+		workers.join_all();
+	}
+
+	// Chunk after a false boundary is decoded again from the position
+	// where the single threaded decoder would be
+	size_t redecoded = 0;
+	for (size_t n = 1; n < nchunks; ++n) {
+		if (chunks[n].begin == chunks[n - 1].next)
+			continue;
+
+		chunks[n].begin = chunks[n - 1].next;
+		chunks[n].records.clear();
+		chunks[n].badBytes = 0;
+		decodeChunk(&chunks[n]);
+		redecoded++;
+	}
+
+	// Merge chunk results, chunks are already ordered by stream offset
+	size_t total = 0;
+	for (size_t n = 0; n < nchunks; ++n)
+		total += chunks[n].records.size();
+
+	records.clear();
+	records.reserve(total);
+	memset(&stats, 0, sizeof(stats));
+	for (size_t n = 0; n < nchunks; ++n) {
+		records.insert(records.end(), chunks[n].records.begin(), chunks[n].records.end());
+		stats.badBytes += chunks[n].badBytes;
+	}
+	std::stable_sort(records.begin(), records.end(), record_time_less);
+
+	stats.bytes = stream.size();
+	stats.frames = records.size();
+	stats.chunks = nchunks;
+	stats.redecoded = redecoded;
+}
+
+/** Get decoded records in timestamp order
+ */
+const std::vector<UAVTalkLogDecoder::Record> &UAVTalkLogDecoder::getRecords()
+{
+	return records;
+}
+
+/** Get decoding statistics
+ */
+UAVTalkLogDecoder::Stats UAVTalkLogDecoder::getStats()
+{
+	return stats;
+}
+
+/** Decode all frames starting inside the chunk.
+ * Last frame may end after chunk end, chunk->next is set to its end.
+ */
+void UAVTalkLogDecoder::decodeChunk(Chunk *chunk)
+{
+	Record rec;
+	size_t pos = chunk->begin;
+
+	chunk->records.reserve((chunk->end - chunk->begin) / (UAVTalk::MIN_HEADER_LENGTH + UAVTalk::CHECKSUM_LENGTH + 16));
+	while (pos < chunk->end) {
+		size_t length = parseFrame(pos, &rec);
+		if (length == 0) {
+			chunk->badBytes++;
+			pos++;
+			continue;
+		}
+
+		if (objInfo.find(rec.objId) != objInfo.end()) {
+			rec.timestamp = timestampAt(pos);
+			chunk->records.push_back(rec);
+		}
+		pos += length;
+	}
+
+	chunk->next = pos;
+}
+
+/** Find first position where two valid frames follow each other
+ * (or a valid frame ends exactly at stream end).
+ */
+size_t UAVTalkLogDecoder::findBoundary(size_t pos, size_t end)
+{
+	for (; pos < end; ++pos) {
+		size_t length = parseFrame(pos, NULL);
+		if (length > 0 && (pos + length >= stream.size() || parseFrame(pos + length, NULL) > 0))
+			return pos;
+	}
+
+	return end;
+}
+
+/** Validate frame at position
+ * \param[in] pos Stream offset
+ * \param[out] rec Decoded frame header (may be NULL)
+ * \return frame length including checksum or 0 if no valid frame
+ */
+size_t UAVTalkLogDecoder::parseFrame(size_t pos, Record *rec)
+{
+	const size_t avail = stream.size() - pos;
+	const uint8_t *buf = &stream[pos];
+	uint16_t packetSize;
+	uint32_t objId;
+
+	if (avail < UAVTalk::MIN_HEADER_LENGTH + UAVTalk::CHECKSUM_LENGTH)
+		return 0;
+
+	if (buf[0] != UAVTalk::SYNC_VAL || (buf[1] & UAVTalk::TYPE_MASK) != UAVTalk::TYPE_VER)
+		return 0;
+
+	UAVObjectCodec::unpack(&packetSize, &buf[2], 1);
+	if (packetSize < UAVTalk::MIN_HEADER_LENGTH ||
+			packetSize > UAVTalk::MAX_HEADER_LENGTH + UAVTalk::MAX_PAYLOAD_LENGTH ||
+			packetSize + UAVTalk::CHECKSUM_LENGTH > avail)
+		return 0;
+
+	if (UAVTalk::updateCRC(0, buf, packetSize) != buf[packetSize])
+		return 0;
+
+	if (rec == NULL)
+		return packetSize + UAVTalk::CHECKSUM_LENGTH;
+
+	UAVObjectCodec::unpack(&objId, &buf[4], 1);
+	rec->offset = pos;
+	rec->type   = buf[1];
+	rec->objId  = objId;
+	rec->instId = 0;
+	rec->data   = NULL;
+	rec->length = 0;
+
+	std::map<uint32_t, ObjectInfo>::const_iterator it = objInfo.find(objId);
+	if (it == objInfo.end())
+		return packetSize + UAVTalk::CHECKSUM_LENGTH; // unknown object, skip frame
+
+	size_t dataOffset = UAVTalk::MIN_HEADER_LENGTH;
+	if (!it->second.isSingleInst && packetSize >= UAVTalk::MAX_HEADER_LENGTH) {
+		UAVObjectCodec::unpack(&rec->instId, &buf[dataOffset], 1);
+		dataOffset = UAVTalk::MAX_HEADER_LENGTH;
+	}
+
+	if (rec->type == UAVTalk::TYPE_OBJ || rec->type == UAVTalk::TYPE_OBJ_ACK) {
+		if (dataOffset + it->second.numBytes != packetSize)
+			return 0; // length mismatch
+
+		rec->data   = &buf[dataOffset];
+		rec->length = it->second.numBytes;
+	}
+
+	return packetSize + UAVTalk::CHECKSUM_LENGTH;
+}
+
+/** Get log timestamp of the stream offset
+ */
+uint32_t UAVTalkLogDecoder::timestampAt(size_t offset)
+{
+	if (timeIndex.empty())
+		return 0;
+
+	std::vector<std::pair<size_t, uint32_t> >::iterator it =
+		std::upper_bound(timeIndex.begin(), timeIndex.end(), std::make_pair(offset, UINT32_MAX));
+	if (it == timeIndex.begin())
+		return it->second;
+
+	return (--it)->second;
+}
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * @file       uavtalklogdecoder.h
+ * @author     Vladimir Ermakov, Copyright (C) 2013.
+ * @brief Offline parallel decoder for UAVTalk captures
+ *****************************************************************************/
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+#ifndef UAVTALKLOGDECODER_H
+#define UAVTALKLOGDECODER_H
+
+#include "uavtalk.h"
+#include <vector>
+#include <string>
+
+namespace openpilot
+{
+
+/** Decodes a recorded UAVTalk stream without going through the byte-wise
+ * receive state machine of UAVTalk.
+ *
+ * The capture is split into chunks at validated frame boundaries
+ * (SYNC_VAL, type, size and CRC must all match, and the next frame must
+ * be valid too), then every chunk is decoded in its own thread.
+ * A boundary can still be false (e.g. frames embedded in a payload), so
+ * a chunk which does not start where the previous one stopped is decoded
+ * again from there; the result is the same as of a single thread.
+ * Frame payloads are not copied, records point into the loaded capture.
+ */
+class UAVTalkLogDecoder {
+public:
+	typedef enum {
+		FORMAT_RAW,	/** plain byte stream, no timestamps */
+		FORMAT_OPL	/** OpenPilot GCS log: uint32 time (ms), int64 size, data */
+	} LogFormat;
+
+	typedef struct {
+		uint32_t timestamp;	/** ms from log start (0 for raw captures) */
+		size_t offset;		/** frame offset in the decoded stream */
+		uint8_t type;
+		uint32_t objId;
+		uint16_t instId;
+		const uint8_t *data;	/** payload (DataFields image), NULL if none */
+		size_t length;
+	} Record;
+
+	typedef struct {
+		size_t bytes;
+		size_t frames;
+		size_t badBytes;	/** bytes skipped while resyncing */
+		size_t chunks;
+		size_t redecoded;	/** chunks decoded again after a false boundary */
+	} Stats;
+
+	UAVTalkLogDecoder(UAVObjectManager *objMngr);
+	~UAVTalkLogDecoder();
+
+	bool load(const std::string &path, LogFormat format);
+	void decode(unsigned int threads = 0);
+	const std::vector<Record> &getRecords();
+	Stats getStats();
+
+private:
+	typedef struct {
+		uint16_t numBytes;
+		bool isSingleInst;
+	} ObjectInfo;
+
+	typedef struct {
+		size_t begin;
+		size_t end;
+		size_t next;	/** where decoding stopped, the next chunk must start here */
+		std::vector<Record> records;
+		size_t badBytes;
+	} Chunk;
+
+	static const size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+	std::map<uint32_t, ObjectInfo> objInfo;
+	std::vector<uint8_t> stream;
+	std::vector<std::pair<size_t, uint32_t> > timeIndex; // stream offset -> timestamp
+	std::vector<Record> records;
+	Stats stats;
+
+	size_t parseFrame(size_t pos, Record *rec);
+	size_t findBoundary(size_t pos, size_t end);
+	void decodeChunk(Chunk *chunk);
+	uint32_t timestampAt(size_t offset);
+	bool loadOPL(const std::vector<uint8_t> &file);
+};
+
+} // namespace openpilot
+
+#endif // UAVTALKLOGDECODER_H
@@ -96,7 +96,7 @@ bool UAVTalkRelay::receiveObject(uint8_t type, uint32_t objId, uint16_t instId,
 
 			if (tobj != NULL)
 				tobj->objectUpdated.connect(boost::bind(&UAVTalkRelay::sendObjectSlot, this, _1));
-			if (dynamic_cast<UAVMetaObject *>(tobj) != NULL)
+			if (tobj->isMetaObject())
 				tobj->updated();
 
 			// Check if an ack is pending
@@ -124,7 +124,7 @@ bool UAVTalkRelay::receiveObject(uint8_t type, uint32_t objId, uint16_t instId,
 
 			if (tobj != NULL)
 				tobj->objectUpdated.connect(boost::bind(&UAVTalkRelay::sendObjectSlot, this, _1));
-			if (dynamic_cast<UAVMetaObject *>(tobj) != NULL)
+			if (tobj->isMetaObject())
 				tobj->updated();
 
 			// Transmit ACK
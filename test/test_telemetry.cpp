@@ -0,0 +1,744 @@
+/**
+ * Long-run test of Telemetry and TelemetryMonitor in virtual time
+ */
+
+#include <gtest/gtest.h>
+
+#include "uavobjectmanager.h"
+#include "uavobjectsinit.h"
+#include "telemetry.h"
+#include "telemetrymonitor.h"
+#include "telemetryclock.h"
+#include "telemetrybudget.h"
+#include "autopilotemulator.h"
+#include "systemstats.h"
+#include "accessorydesired.h"
+#include "attitudestate.h"
+#include "flightstatus.h"
+#include "stabilizationsettings.h"
+#include "settingscache.h"
+#include "settingsuploader.h"
+#include "oplinksettings.h"
+#include <boost/lambda/lambda.hpp>
+
+
+using namespace openpilot;
+
+
+/** One end of an in-process link.
+ * Data is delivered through io_service, so both sides run in one thread
+ * and never re-enter UAVTalk from write().
+ */
+class PipeIO : public UAVTalkIOBase {
+public:
+	PipeIO(boost::asio::io_service &io) : io(io), peer(NULL), linkUp(true) {}
+
+	void connect(PipeIO *other) { peer = other; other->peer = this; }
+	void setLinkUp(bool up) { linkUp = up; }
+	void setLatency(boost::posix_time::time_duration latency_) { latency = latency_; }
+
+	void write(const uint8_t *data, size_t length)
+	{
+		if (!linkUp || peer == NULL)
+			return;
+
+		boost::shared_ptr<std::vector<uint8_t> > buf(new std::vector<uint8_t>(data, data + length));
+		if (latency.ticks() == 0) {
+			io.post(boost::bind(&PipeIO::deliver, peer, buf));
+			return;
+		}
+
+		// timers of one step may fire in any order, the inbox keeps the byte order
+		boost::shared_ptr<telemetry_timer> timer(new telemetry_timer(io));
+		peer->inbox.push_back(std::make_pair(TelemetryClock::now() + latency, buf));
+		timer->expires_from_now(latency);
+		timer->async_wait(boost::bind(&PipeIO::deliverDue, peer, timer));
+	}
+
+	bool is_open() { return true; }
+
+private:
+	typedef boost::shared_ptr<std::vector<uint8_t> > Buffer;
+
+	boost::asio::io_service &io;
+	PipeIO *peer;
+	bool linkUp;
+	boost::posix_time::time_duration latency;
+	std::deque<std::pair<TelemetryClock::time_type, Buffer> > inbox;
+
+	void deliver(Buffer buf)
+	{
+		if (linkUp)
+			sig_read(&(*buf)[0], buf->size());
+	}
+
+	void deliverDue(boost::shared_ptr<telemetry_timer> timer)
+	{
+		while (!inbox.empty() && inbox.front().first <= TelemetryClock::now()) {
+			Buffer buf = inbox.front().second;
+			inbox.pop_front();
+			deliver(buf);
+		}
+	}
+};
+
+
+int connected, disconnected, streamed, periodic;
+
+void telConnected(void) { connected++; }
+void telDisconnected(void) { disconnected++; }
+void sysStatsUnpacked(UAVObject *obj) { streamed++; }
+void accessoryUnpacked(UAVObject *obj) { periodic++; }
+
+std::vector<std::pair<uint32_t, boost::posix_time::ptime> > arrivals;
+void periodicArrived(UAVObject *obj) { arrivals.push_back(std::make_pair(obj->getObjID(), TelemetryClock::now())); }
+
+/** Send AccessoryDesired from GCS every periodMs
+ */
+void setPeriodic(UAVObjectManager *objMngr, uint16_t periodMs)
+{
+	AccessoryDesired *acc = AccessoryDesired::GetInstance(objMngr);
+	UAVObject::Metadata mdata = acc->getMetadata();
+
+	UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_PERIODIC);
+	mdata.gcsTelemetryUpdatePeriod = periodMs;
+	acc->setMetadata(mdata);
+}
+
+/** Send AttitudeState from GCS every periodMs with ACK
+ */
+void setAckedPeriodic(UAVObjectManager *objMngr, uint16_t periodMs)
+{
+	AttitudeState *att = AttitudeState::GetInstance(objMngr);
+	UAVObject::Metadata mdata = att->getMetadata();
+
+	UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_PERIODIC);
+	UAVObject::SetGcsTelemetryAcked(mdata, true);
+	mdata.gcsTelemetryUpdatePeriod = periodMs;
+	att->setMetadata(mdata);
+}
+
+/** Send object from GCS every periodMs
+ */
+void setGcsPeriodic(UAVObject *obj, uint16_t periodMs)
+{
+	UAVObject::Metadata mdata = obj->getMetadata();
+
+	UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_PERIODIC);
+	mdata.gcsTelemetryUpdatePeriod = periodMs;
+	obj->setMetadata(mdata);
+}
+
+/** Advance virtual time and run everything that became due
+ */
+void runFor(boost::asio::io_service &io, boost::posix_time::time_duration duration)
+{
+	const boost::posix_time::time_duration step = boost::posix_time::milliseconds(10);
+
+	for (boost::posix_time::time_duration t; t < duration; t += step) {
+		TelemetryClock::advance(step);
+		while (io.poll() > 0);
+	}
+}
+
+TEST(Telemetry, virtual_hour)
+{
+	const int CUTS = 3;
+	const int CUT_SECONDS = 30;
+	const int PERIOD_MS = 100;
+	const int STREAM_RATE = 10;
+
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	// GCS side
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	setPeriodic(&objMngr, PERIOD_MS);
+	size_t numObjects = objMngr.getObjects().size();
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	TelemetryMonitor mon(io, &objMngr, &tel);
+	mon.connected.connect(telConnected);
+	mon.disconnected.connect(telDisconnected);
+	SystemStats::GetInstance(&objMngr)->objectUnpacked.connect(sysStatsUnpacked);
+
+	// Autopilot side, metadata is retrieved by the monitor so it should match
+	UAVObjectManager apObjMngr;
+	UAVObjectsInitialize(&apObjMngr);
+	setPeriodic(&apObjMngr, PERIOD_MS);
+	AccessoryDesired::GetInstance(&apObjMngr)->objectUnpacked.connect(accessoryUnpacked);
+
+	AutopilotEmulator autopilot(io, &apIO, &apObjMngr);
+	autopilot.setStream(SystemStats::OBJID, STREAM_RATE);
+
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	// An hour with link cuts in the middle of each 20 minutes
+	for (int n = 0; n < CUTS; ++n) {
+		runFor(io, boost::posix_time::seconds(600));
+		EXPECT_EQ(connected, n + 1);
+
+		gcsIO.setLinkUp(false);
+		apIO.setLinkUp(false);
+		runFor(io, boost::posix_time::seconds(CUT_SECONDS));
+		EXPECT_EQ(disconnected, n + 1);
+
+		gcsIO.setLinkUp(true);
+		apIO.setLinkUp(true);
+		runFor(io, boost::posix_time::seconds(1200 - 600 - CUT_SECONDS));
+	}
+
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+	std::cout << "[virtual hour] " << elapsed.total_milliseconds() << " ms, "
+		<< streamed << " streamed, " << periodic << " periodic, "
+		<< tel.getStats().txRetries << " retries" << std::endl;
+
+	EXPECT_EQ(connected, CUTS + 1);
+	EXPECT_EQ(disconnected, CUTS);
+
+	// Link is down CUT_SECONDS each cut, reconnection takes a few stats periods more
+	const int upSeconds = 3600 - CUTS * (CUT_SECONDS + 20);
+	EXPECT_GT(streamed, upSeconds * STREAM_RATE);
+	EXPECT_LE(streamed, 3600 * STREAM_RATE + 1);
+	EXPECT_GT(periodic, upSeconds * 1000 / PERIOD_MS);
+	EXPECT_LE(periodic, 3600 * 1000 / PERIOD_MS);
+
+	// No instances created by the traffic
+	EXPECT_EQ(objMngr.getObjects().size(), numObjects);
+
+	autopilot.setStream(SystemStats::OBJID, 0);
+	TelemetryClock::setReal();
+}
+
+int failedTransactions;
+void countFailed(UAVObject *obj, bool success) { if (!success) failedTransactions++; }
+
+TEST(Telemetry, stale_timeout)
+{
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+
+	// Acked on change, nobody answers, the ACK is emitted by the test
+	AttitudeState *att = AttitudeState::GetInstance(&objMngr);
+	UAVObject::Metadata mdata = att->getMetadata();
+	UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_ONCHANGE);
+	UAVObject::SetGcsTelemetryAcked(mdata, true);
+	att->setMetadata(mdata);
+	att->transactionCompleted.connect(countFailed);
+	failedTransactions = 0;
+
+	// No monitor, the link is up from the start
+	GCSTelemetryStats::DataFields gcsStats = GCSTelemetryStats::GetInstance(&objMngr)->getData();
+	gcsStats.Status = GCSTelemetryStats::STATUS_CONNECTED;
+	GCSTelemetryStats::GetInstance(&objMngr)->setData(gcsStats);
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	while (io.poll() > 0);
+
+	// First transaction in flight, second update waits for it
+	att->updated();
+	while (io.poll() > 0);
+	att->updated();
+	while (io.poll() > 0);
+
+	// Timeout (250 ms) expires and its handler is queued before the posted ACK runs,
+	// completion starts the second transaction which may reuse the record
+	TelemetryClock::advance(boost::posix_time::milliseconds(300));
+	utalk.transactionCompleted(att, true);
+	while (io.poll() > 0);
+
+	EXPECT_EQ(tel.getStats().txRetries, 0);
+	EXPECT_EQ(failedTransactions, 0);
+
+	TelemetryClock::setReal();
+}
+
+TEST(Telemetry, adaptive_periods)
+{
+	const int PERIOD_MS = 100;
+
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	setPeriodic(&objMngr, PERIOD_MS);
+	setAckedPeriodic(&objMngr, PERIOD_MS);
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	TelemetryMonitor mon(io, &objMngr, &tel);
+	tel.setCritical(AccessoryDesired::OBJID, true);
+	tel.setAdaptivePeriods(true);
+
+	UAVObjectManager apObjMngr;
+	UAVObjectsInitialize(&apObjMngr);
+	setPeriodic(&apObjMngr, PERIOD_MS);
+	setAckedPeriodic(&apObjMngr, PERIOD_MS);
+	AutopilotEmulator autopilot(io, &apIO, &apObjMngr);
+
+	runFor(io, boost::posix_time::seconds(30));
+	uint64_t backoffs = tel.getStats().backoffs;
+
+	// Acks are lost, the monitor does not notice it yet
+	apIO.setLinkUp(false);
+	runFor(io, boost::posix_time::seconds(3));
+
+	std::vector<Telemetry::PeriodInfo> periods = tel.getPeriods();
+	for (std::vector<Telemetry::PeriodInfo>::iterator it = periods.begin(); it != periods.end(); ++it) {
+		if (it->objId == AttitudeState::OBJID) {
+			EXPECT_EQ(it->basePeriodMs, PERIOD_MS);
+			EXPECT_GT(it->effectivePeriodMs, PERIOD_MS);
+			EXPECT_FALSE(it->critical);
+		} else if (it->objId == AccessoryDesired::OBJID) {
+			EXPECT_EQ(it->effectivePeriodMs, PERIOD_MS);
+			EXPECT_TRUE(it->critical);
+		}
+	}
+	EXPECT_GT(tel.getStats().backoffs, backoffs);
+
+	// Recovered additively after the link is back
+	apIO.setLinkUp(true);
+	runFor(io, boost::posix_time::seconds(60));
+
+	periods = tel.getPeriods();
+	for (std::vector<Telemetry::PeriodInfo>::iterator it = periods.begin(); it != periods.end(); ++it)
+		EXPECT_EQ(it->effectivePeriodMs, it->basePeriodMs);
+
+	TelemetryClock::setReal();
+}
+
+TEST(Telemetry, edf_phases)
+{
+	const int PERIOD_MS = 100;
+	const uint32_t objIds[] = { AccessoryDesired::OBJID, AttitudeState::OBJID, FlightStatus::OBJID };
+	const size_t numObjs = sizeof(objIds) / sizeof(objIds[0]);
+
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	// Same period on both sides, it is retrieved by the monitor
+	UAVObjectManager objMngr, apObjMngr;
+	UAVObjectsInitialize(&objMngr);
+	UAVObjectsInitialize(&apObjMngr);
+	for (size_t n = 0; n < numObjs; ++n) {
+		setGcsPeriodic(objMngr.getObject(objIds[n]), PERIOD_MS);
+		setGcsPeriodic(apObjMngr.getObject(objIds[n]), PERIOD_MS);
+		apObjMngr.getObject(objIds[n])->objectUnpacked.connect(periodicArrived);
+	}
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	TelemetryMonitor mon(io, &objMngr, &tel);
+	AutopilotEmulator autopilot(io, &apIO, &apObjMngr);
+
+	runFor(io, boost::posix_time::seconds(20));
+
+	// Equal periods, but releases are spread over the period: one object per 10 ms step
+	std::map<boost::posix_time::ptime, int> perStep;
+	for (size_t n = 0; n < arrivals.size(); ++n)
+		perStep[arrivals[n].second]++;
+
+	int maxPerStep = 0;
+	for (std::map<boost::posix_time::ptime, int>::iterator it = perStep.begin(); it != perStep.end(); ++it)
+		maxPerStep = std::max(maxPerStep, it->second);
+
+	EXPECT_GT(arrivals.size(), numObjs * 150);
+	EXPECT_EQ(maxPerStep, 1);
+
+	// Sent at most one step late, nothing missed
+	std::vector<Telemetry::ScheduleStats> stats = tel.getScheduleStats();
+	size_t found = 0;
+	for (std::vector<Telemetry::ScheduleStats>::iterator it = stats.begin(); it != stats.end(); ++it) {
+		if (std::find(objIds, objIds + numObjs, it->objId) == objIds + numObjs)
+			continue;
+
+		found++;
+		EXPECT_EQ(it->periodMs, PERIOD_MS);
+		EXPECT_GT(it->updates, 190);
+		EXPECT_EQ(it->misses, 0);
+		EXPECT_LE(it->latenessMaxUs, 10000);
+		EXPECT_GT(it->minSlackUs, 0);
+	}
+	EXPECT_EQ(found, numObjs);
+
+	TelemetryClock::setReal();
+}
+
+/** Virtual time from start to the end of object retrieval
+ * \param[out] done, total Last retrieval progress
+ */
+boost::posix_time::time_duration timeToConnected(uint32_t window, size_t &done, size_t &total)
+{
+	const boost::posix_time::time_duration step = boost::posix_time::milliseconds(10);
+	const boost::posix_time::ptime start(boost::gregorian::date(2013, 1, 1));
+	boost::posix_time::time_duration elapsed;
+	int connected = 0;
+	size_t failed = 0;
+
+	TelemetryClock::setVirtual(start);
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+	gcsIO.setLatency(boost::posix_time::milliseconds(50));
+	apIO.setLatency(boost::posix_time::milliseconds(50));
+
+	UAVObjectManager objMngr, apObjMngr;
+	UAVObjectsInitialize(&objMngr);
+	UAVObjectsInitialize(&apObjMngr);
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	TelemetryMonitor mon(io, &objMngr, &tel);
+	AutopilotEmulator autopilot(io, &apIO, &apObjMngr);
+
+	mon.setRetrieveWindow(window);
+	mon.connected.connect(boost::lambda::var(connected)++);
+	mon.retrievalProgress.connect((
+			boost::lambda::var(done) = boost::lambda::_1,
+			boost::lambda::var(failed) = boost::lambda::_2,
+			boost::lambda::var(total) = boost::lambda::_3));
+
+	while (connected == 0 && elapsed < boost::posix_time::seconds(60)) {
+		TelemetryClock::advance(step);
+		while (io.poll() > 0);
+		elapsed += step;
+	}
+
+	EXPECT_EQ(connected, 1);
+	EXPECT_LT(failed, total);	// a timed out request does not stop the retrieval
+
+	TelemetryClock::setReal();
+	return elapsed;
+}
+
+TEST(TelemetryMonitor, pipelined_retrieval)
+{
+	size_t done = 0, total = 0;
+
+	boost::posix_time::time_duration serial = timeToConnected(1, done, total);
+	EXPECT_GT(total, 8);
+	EXPECT_EQ(done, total);
+
+	boost::posix_time::time_duration pipelined = timeToConnected(8, done, total);
+	EXPECT_EQ(done, total);
+
+	// Handshake takes the same time, retrieval is ~total round trips vs ~total / 8
+	const int rttMs = 100;
+	std::cout << "[retrieval] " << total << " objects, " << serial.total_milliseconds() << " ms serial, "
+		<< pipelined.total_milliseconds() << " ms pipelined" << std::endl;
+	EXPECT_GE((serial - pipelined).total_milliseconds(), int(total - 1 - (total + 7) / 8) * rttMs - 100);
+}
+
+/** Connect GCS objMngr to the autopilot with settings snapshot
+ * \return Number of requested objects
+ */
+size_t connectWithCache(UAVObjectManager *objMngr, UAVObjectManager *apObjMngr, SettingsCache *cache)
+{
+	const boost::posix_time::time_duration step = boost::posix_time::milliseconds(10);
+	boost::posix_time::time_duration elapsed;
+	int connected = 0;
+	size_t done = 0, failed = 0, total = 0;
+
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	UAVTalk utalk(&gcsIO, objMngr);
+	Telemetry tel(io, &utalk, objMngr);
+	TelemetryMonitor mon(io, objMngr, &tel);
+	AutopilotEmulator autopilot(io, &apIO, apObjMngr);
+
+	mon.setSettingsCache(cache);
+	mon.connected.connect(boost::lambda::var(connected)++);
+	mon.retrievalProgress.connect((
+			boost::lambda::var(done) = boost::lambda::_1,
+			boost::lambda::var(failed) = boost::lambda::_2,
+			boost::lambda::var(total) = boost::lambda::_3));
+
+	while (connected == 0 && elapsed < boost::posix_time::seconds(60)) {
+		TelemetryClock::advance(step);
+		while (io.poll() > 0);
+		elapsed += step;
+	}
+
+	EXPECT_EQ(connected, 1);
+	EXPECT_EQ(done, total);
+
+	TelemetryClock::setReal();
+	return total;
+}
+
+TEST(TelemetryMonitor, settings_cache)
+{
+	const std::string path = "test_telemetry-settings.cache";
+	std::remove(path.c_str());
+
+	// Autopilot settings and metadata differ from defaults
+	UAVObjectManager apObjMngr;
+	UAVObjectsInitialize(&apObjMngr);
+	setAckedPeriodic(&apObjMngr, 100);
+	StabilizationSettings *apStab = StabilizationSettings::GetInstance(&apObjMngr);
+	StabilizationSettings::DataFields stab = apStab->getData();
+	stab.RollPI[0] = 1.5;
+	apStab->setData(stab);
+
+	// No snapshot yet, everything is retrieved and saved
+	UAVObjectManager objMngr1;
+	UAVObjectsInitialize(&objMngr1);
+	SettingsCache cache1(&objMngr1, path);
+	size_t full = connectWithCache(&objMngr1, &apObjMngr, &cache1);
+	EXPECT_GT(full, 8);
+
+	// Fresh gateway: metaobjects are applied from the snapshot, everything
+	// is still requested and matches it
+	UAVObjectManager objMngr2;
+	UAVObjectsInitialize(&objMngr2);
+	SettingsCache cache2(&objMngr2, path);
+	EXPECT_EQ(connectWithCache(&objMngr2, &apObjMngr, &cache2), full);
+	EXPECT_TRUE(cache2.isLoaded());
+	EXPECT_EQ(StabilizationSettings::GetInstance(&objMngr2)->getData().RollPI[0], 1.5);
+	EXPECT_EQ(AttitudeState::GetInstance(&objMngr2)->getMetadata().gcsTelemetryUpdatePeriod, 100);
+
+	// Settings changed on the autopilot: snapshot is stale
+	stab.RollPI[0] = 2.5;
+	apStab->setData(stab);
+
+	UAVObjectManager objMngr3;
+	UAVObjectsInitialize(&objMngr3);
+	SettingsCache cache3(&objMngr3, path);
+	EXPECT_EQ(connectWithCache(&objMngr3, &apObjMngr, &cache3), full);
+	EXPECT_FALSE(cache3.isLoaded());
+	EXPECT_EQ(StabilizationSettings::GetInstance(&objMngr3)->getData().RollPI[0], 2.5);
+
+	// Smallest settings object and metadata changed: retrieved values are used
+	OPLinkSettings *apLink = OPLinkSettings::GetInstance(&apObjMngr);
+	OPLinkSettings::DataFields link = apLink->getData();
+	link.MaxRFPower++;
+	apLink->setData(link);
+	setAckedPeriodic(&apObjMngr, 200);
+
+	UAVObjectManager objMngr4;
+	UAVObjectsInitialize(&objMngr4);
+	SettingsCache cache4(&objMngr4, path);
+	EXPECT_EQ(connectWithCache(&objMngr4, &apObjMngr, &cache4), full);
+	EXPECT_EQ(OPLinkSettings::GetInstance(&objMngr4)->getData().MaxRFPower, link.MaxRFPower);
+	EXPECT_EQ(AttitudeState::GetInstance(&objMngr4)->getMetadata().gcsTelemetryUpdatePeriod, 200);
+
+	// Only metadata changed (same settings): the cached metaobject is
+	// replaced by the retrieved one and the snapshot is rewritten
+	setAckedPeriodic(&apObjMngr, 300);
+
+	UAVObjectManager objMngr5;
+	UAVObjectsInitialize(&objMngr5);
+	SettingsCache cache5(&objMngr5, path);
+	EXPECT_EQ(connectWithCache(&objMngr5, &apObjMngr, &cache5), full);
+	EXPECT_FALSE(cache5.isLoaded());
+	EXPECT_EQ(AttitudeState::GetInstance(&objMngr5)->getMetadata().gcsTelemetryUpdatePeriod, 300);
+
+	UAVObjectManager objMngr6;
+	UAVObjectsInitialize(&objMngr6);
+	SettingsCache cache6(&objMngr6, path);
+	EXPECT_EQ(connectWithCache(&objMngr6, &apObjMngr, &cache6), full);
+	EXPECT_TRUE(cache6.isLoaded());
+	EXPECT_EQ(AttitudeState::GetInstance(&objMngr6)->getMetadata().gcsTelemetryUpdatePeriod, 300);
+
+	// Another object set uses only entries of objects it knows
+	UAVObjectManager other;
+	other.registerObject(new SystemStats());
+	SettingsCache otherCache(&other, path);
+	EXPECT_TRUE(otherCache.load());
+	EXPECT_TRUE(otherCache.contains(SystemStats::GetInstance(&other)->getMetaObject()));
+	EXPECT_FALSE(otherCache.contains(SystemStats::GetInstance(&other)));
+	std::remove(path.c_str());
+	EXPECT_FALSE(otherCache.load());
+}
+
+std::map<uint32_t, SettingsUploader::Result> uploadResults;
+void uploadResult(UAVObject *obj, SettingsUploader::Result result) { uploadResults[obj->getObjID()] = result; }
+
+TEST(SettingsUploader, delta)
+{
+	TelemetryClock::setVirtual(boost::posix_time::ptime(boost::gregorian::date(2013, 1, 1)));
+
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	UAVObjectManager objMngr, apObjMngr;
+	UAVObjectsInitialize(&objMngr);
+	UAVObjectsInitialize(&apObjMngr);
+
+	StabilizationSettings::DataFields stab = StabilizationSettings::GetInstance(&apObjMngr)->getData();
+	stab.RollPI[0] = 1.5;
+	StabilizationSettings::GetInstance(&apObjMngr)->setData(stab);
+
+	// Created before connect, settings retrieved by the monitor are the autopilot copy
+	SettingsUploader uploader(&objMngr);
+	uploader.objectResult.connect(uploadResult);
+
+	UAVTalk utalk(&gcsIO, &objMngr);
+	Telemetry tel(io, &utalk, &objMngr);
+	TelemetryMonitor mon(io, &objMngr, &tel);
+	AutopilotEmulator autopilot(io, &apIO, &apObjMngr);
+
+	runFor(io, boost::posix_time::seconds(10));
+	ASSERT_TRUE(autopilot.isConnected());
+
+	// Profile: stabilization as on the autopilot, OPLink changed
+	OPLinkSettings::DataFields oplink = OPLinkSettings::GetInstance(&objMngr)->getData();
+	oplink.MaxRFPower++;
+	uploader.set<StabilizationSettings>(stab);
+	uploader.set<OPLinkSettings>(oplink);
+
+	EXPECT_EQ(uploader.apply(), 1);
+	runFor(io, boost::posix_time::seconds(1));
+
+	EXPECT_FALSE(uploader.isBusy());
+	EXPECT_EQ(uploadResults[uint32_t(StabilizationSettings::OBJID)], SettingsUploader::RESULT_UNCHANGED);
+	EXPECT_EQ(uploadResults[uint32_t(OPLinkSettings::OBJID)], SettingsUploader::RESULT_UPLOADED);
+	EXPECT_EQ(OPLinkSettings::GetInstance(&apObjMngr)->getData().MaxRFPower, oplink.MaxRFPower);
+
+	// Acknowledged upload is the new autopilot copy
+	uploader.set<OPLinkSettings>(oplink);
+	EXPECT_EQ(uploader.apply(), 0);
+	EXPECT_EQ(uploadResults[uint32_t(OPLinkSettings::OBJID)], SettingsUploader::RESULT_UNCHANGED);
+
+	TelemetryClock::setReal();
+}
+
+TEST(SettingsUploader, lazy_objects)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitializeLazy(&objMngr);
+
+	// Object does not exist yet, it is created by the first reception
+	SettingsUploader uploader(&objMngr);
+	uploader.objectResult.connect(uploadResult);
+
+	OPLinkSettings *obj = OPLinkSettings::GetInstance(&objMngr);
+	OPLinkSettings::DataFields oplink = obj->getData();
+	oplink.MaxRFPower++;
+
+	std::vector<uint8_t> buf(OPLinkSettings::NUMBYTES);
+	OPLinkSettings::PackData(oplink, &buf[0]);
+	obj->deserialize(&buf[0]);
+
+	// Received data is the autopilot copy, not the defaults
+	uploader.set<OPLinkSettings>(oplink);
+	EXPECT_EQ(uploader.apply(), 0);
+	EXPECT_EQ(uploadResults[uint32_t(OPLinkSettings::OBJID)], SettingsUploader::RESULT_UNCHANGED);
+}
+
+TEST(TelemetryBudget, solve)
+{
+	const uint32_t BAUDRATE = 9600;
+	const double UTILIZATION = 0.8;
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+
+	// 13 byte frame every 10 ms is more than the whole link
+	setPeriodic(&objMngr, 10);
+
+	TelemetryBudget budget(&objMngr, BAUDRATE);
+	budget.setUtilization(UTILIZATION);
+	budget.setPriority(SystemStats::OBJID, TelemetryBudget::PRIORITY_CRITICAL);
+
+	TelemetryBudget::Report report = budget.solve();
+	const double limit = report.capacity * UTILIZATION;
+
+	EXPECT_EQ(report.capacity, BAUDRATE / 10);
+	EXPECT_FALSE(report.fits);
+	EXPECT_TRUE(report.solved);
+	EXPECT_GT(report.load[TelemetryBudget::DIR_TX], limit);
+	EXPECT_LE(report.proposedLoad[TelemetryBudget::DIR_TX], limit);
+	EXPECT_LE(report.proposedLoad[TelemetryBudget::DIR_RX], limit);
+
+	uint16_t proposed = 0;
+	for (std::vector<TelemetryBudget::Item>::iterator it = report.items.begin(); it != report.items.end(); ++it) {
+		if (it->priority == TelemetryBudget::PRIORITY_CRITICAL) {
+			EXPECT_EQ(it->proposedMs, it->periodMs);
+		}
+		if (it->obj->getObjID() == AccessoryDesired::OBJID && it->dir == TelemetryBudget::DIR_TX)
+			proposed = it->proposedMs;
+	}
+	EXPECT_GT(proposed, 10);
+
+	// Solution is stable
+	budget.apply(report);
+	EXPECT_EQ(AccessoryDesired::GetInstance(&objMngr)->getMetadata().gcsTelemetryUpdatePeriod, proposed);
+	EXPECT_TRUE(budget.solve().fits);
+}
+
+int nacked;
+void talkCompleted(UAVObject *obj, bool success) { nacked += !success; }
+
+TEST(UAVTalk, unknown_objects)
+{
+	boost::asio::io_service io;
+	boost::asio::io_service::work work(io);
+	PipeIO gcsIO(io), apIO(io);
+	gcsIO.connect(&apIO);
+
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+	UAVTalk gcsTalk(&gcsIO, &objMngr);
+	gcsTalk.transactionCompleted.connect(talkCompleted);
+
+	// Autopilot built with a subset, without AttitudeState
+	UAVObjectManager apObjMngr;
+	apObjMngr.registerObject(new SystemStats());
+	UAVTalk apTalk(&apIO, &apObjMngr);
+	int unpacked = 0;
+	SystemStats::GetInstance(&apObjMngr)->objectUnpacked.connect(++boost::lambda::var(unpacked));
+
+	// Unknown update is skipped by its size, the next frame is parsed
+	gcsTalk.sendObject(AttitudeState::GetInstance(&objMngr), false, false);
+	gcsTalk.sendObject(SystemStats::GetInstance(&objMngr), false, false);
+	while (io.poll() > 0);
+	EXPECT_EQ(unpacked, 1);
+
+	// Acked update of unknown object is NACKed, sender does not retry
+	gcsTalk.sendObject(AttitudeState::GetInstance(&objMngr), true, false);
+	while (io.poll() > 0);
+	EXPECT_EQ(nacked, 1);
+
+	UAVTalk::ComStats stats = apTalk.getStats();
+	EXPECT_EQ(stats.rxErrors, 0);
+	EXPECT_EQ(stats.rxUnknown, 2);
+	EXPECT_EQ(stats.rxObjects, 1);
+}
+
+int main(int argc, char **argv){
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -7,6 +7,10 @@
 #include "uavobjectmanager.h"
 #include "uavobjectsinit.h"
 #include "accessorydesired.h"
+#include "stabilizationsettings.h"
+#include "oplinksettings.h"
+#include "uavobjectsvisit.h"
+#include <fstream>
 
 
 using namespace openpilot;
@@ -130,6 +134,27 @@ TEST(UAVObjManager, registerAll)
 	UAVObjectsInitialize(objMngr);
 }
 
+TEST(UAVObjManager, typeIndex)
+{
+	UAVObjectManager::objects_map objects = objMngr->getObjects();
+	std::vector<bool> used(objMngr->getNumTypes(), false);
+
+	EXPECT_EQ(objMngr->getNumTypes(), objects.size());
+
+	// dense and unique per type, shared by instances
+	for (UAVObjectManager::objects_map::iterator it = objects.begin(); it != objects.end(); ++it) {
+		uint32_t idx = it->second[0]->getTypeIndex();
+		ASSERT_LT(idx, used.size());
+		EXPECT_FALSE(used[idx]);
+		used[idx] = true;
+
+		for (size_t n = 1; n < it->second.size(); ++n)
+			EXPECT_EQ(it->second[n]->getTypeIndex(), idx);
+	}
+
+	EXPECT_EQ(AccessoryDesired().getTypeIndex(), UAVObject::INVALID_TYPE_INDEX);
+}
+
 TEST(UAVObjManager, signals)
 {
 	//objMngr = new UAVObjectManager();
@@ -201,6 +226,335 @@ TEST(UAVObjManager, bind_connect_disconneect)
 	EXPECT_EQ(bind_updated, 1);
 }
 
+static bool useEntry(uint32_t objId, uint16_t instId, const uint8_t *data, size_t length)
+{
+	return true;
+}
+
+TEST(UAVObjManager, snapshot)
+{
+	const std::string path = "test_uavobjects-snapshot.bin";
+	const uint32_t INSTANCES = 1000;
+
+	UAVObjectManager src;
+	UAVObjectsInitialize(&src);
+
+	StabilizationSettings::DataFields stab = StabilizationSettings::GetInstance(&src)->getData();
+	stab.RollPI[0] = 1.5;
+	StabilizationSettings::GetInstance(&src)->setData(stab);
+
+	UAVObject::Metadata mdata = StabilizationSettings::GetInstance(&src)->getMetadata();
+	mdata.gcsTelemetryUpdatePeriod = 1234;
+	StabilizationSettings::GetInstance(&src)->setMetadata(mdata);
+
+	for (uint32_t n = 1; n < INSTANCES; ++n) {
+		AccessoryDesired *acc = static_cast<AccessoryDesired *>(AccessoryDesired::GetInstance(&src)->clone(n));
+		AccessoryDesired::DataFields data = acc->getData();
+		data.AccessoryVal = n;
+		acc->setData(data);
+		ASSERT_TRUE(src.registerObject(acc));
+	}
+
+	// Settings only: data and metadata are restored, data objects are not touched
+	ASSERT_TRUE(src.saveSnapshot(path));
+
+	UAVObjectManager settings;
+	UAVObjectsInitialize(&settings);
+	EXPECT_EQ(settings.loadSnapshot(path), 4);	// 2 settings + 2 metaobjects
+	EXPECT_EQ(StabilizationSettings::GetInstance(&settings)->getData().RollPI[0], 1.5);
+	EXPECT_EQ(StabilizationSettings::GetInstance(&settings)->getMetadata().gcsTelemetryUpdatePeriod, 1234);
+	EXPECT_EQ(settings.getNumInstances(AccessoryDesired::OBJID), 1);
+
+	// Header is little endian on any host
+	{
+		std::ifstream f(path.c_str(), std::ios::in | std::ios::binary);
+		char magic[4];
+		f.read(magic, sizeof(magic));
+		EXPECT_EQ(std::string(magic, sizeof(magic)), "UAVS");
+	}
+
+	// Settings with all metadata, read without changing objects
+	ASSERT_TRUE(src.saveSnapshot(path, UAVObjectManager::SNAPSHOT_SETTINGS_METADATA));
+
+	UAVObjectManager::objects_map objs = src.getObjects();
+	ssize_t metaobjects = 0;
+	for (UAVObjectManager::objects_map::iterator it = objs.begin(); it != objs.end(); ++it)
+		if (it->second[0]->isMetaObject())
+			metaobjects++;
+
+	UAVObjectManager untouched;
+	UAVObjectsInitialize(&untouched);
+	EXPECT_EQ(untouched.readSnapshot(path, useEntry), metaobjects + 2);
+	EXPECT_EQ(StabilizationSettings::GetInstance(&untouched)->getData().RollPI[0], 0);
+
+	// All objects: missing instances are created
+	ASSERT_TRUE(src.saveSnapshot(path, UAVObjectManager::SNAPSHOT_ALL));
+
+	UAVObjectManager all;
+	UAVObjectsInitialize(&all);
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	EXPECT_GT(all.loadSnapshot(path), ssize_t(INSTANCES));
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+	std::cout << "[snapshot] " << INSTANCES << " instances loaded in " << elapsed.total_microseconds() << " us" << std::endl;
+
+	EXPECT_EQ(all.getNumInstances(AccessoryDesired::OBJID), INSTANCES);
+	EXPECT_EQ(AccessoryDesired::GetInstance(&all, INSTANCES - 1)->getData().AccessoryVal, INSTANCES - 1);
+	EXPECT_EQ(StabilizationSettings::GetInstance(&all)->getData().RollPI[0], 1.5);
+
+	// Damaged file is not loaded
+	{
+		std::fstream f(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+		f.seekp(100);
+		f.put(0x55);
+	}
+	EXPECT_EQ(all.loadSnapshot(path), -1);
+	EXPECT_EQ(all.loadSnapshot(path + ".missing"), -1);
+
+	// No entries (e.g. lazy mode before any object is created): header only
+	UAVObjectManager empty;
+	EXPECT_TRUE(empty.saveSnapshot(path));
+	EXPECT_EQ(empty.loadSnapshot(path), 0);
+
+	std::remove(path.c_str());
+}
+
+TEST(UAVObjField, descriptors)
+{
+	StabilizationSettings::DataFields data = StabilizationSettings().getData();
+	data.RollPI[1] = 0.25;
+	data.VbarPiroComp = StabilizationSettings::VBARPIROCOMP_TRUE;
+
+	// Fields cover the wire format without gaps, DataFields may be padded
+	size_t wireOffset = 0;
+	for (size_t n = 0; n < StabilizationSettings::NUMFIELDS; ++n) {
+		EXPECT_GE(StabilizationSettings::FIELDS[n].offset, wireOffset);
+		wireOffset += StabilizationSettings::FIELDS[n].getNumBytes();
+	}
+	EXPECT_EQ(wireOffset, size_t(StabilizationSettings::NUMBYTES));
+	EXPECT_GE(sizeof(data), size_t(StabilizationSettings::NUMBYTES));
+
+	const UAVObjectField &rollPI = StabilizationSettings::FIELDS[0];
+	EXPECT_STREQ(rollPI.name, "RollPI");
+	EXPECT_EQ(rollPI.type, UAVObjectField::TYPE_FLOAT32);
+	EXPECT_EQ(rollPI.numElements, uint32_t(StabilizationSettings::ROLLPI_NUMELEM));
+	EXPECT_EQ(rollPI.getDouble(&data, 1), 0.25);
+
+	const UAVObjectField &vbar = StabilizationSettings::FIELDS[StabilizationSettings::NUMFIELDS - 1];
+	EXPECT_EQ(vbar.type, UAVObjectField::TYPE_ENUM);
+	EXPECT_EQ(vbar.numOptions, 2);
+	EXPECT_STREQ(vbar.getOption(&data, 0), "TRUE");
+	EXPECT_EQ(vbar.getDouble(&data, 0), double(StabilizationSettings::VBARPIROCOMP_TRUE));
+}
+
+TEST(UAVObjField, view)
+{
+	StabilizationSettings stab;
+	StabilizationSettings::DataFields data = stab.getData();
+	data.RollPI[2] = 1.5;
+	data.MaxAxisLock = 30;
+	data.VbarPiroComp = StabilizationSettings::VBARPIROCOMP_TRUE;
+
+	// View reads wire layout, as produced by serialize()
+	std::vector<uint8_t> buf(StabilizationSettings::NUMBYTES);
+	stab.setData(data);
+	stab.serialize(&buf[0]);
+
+	StabilizationSettings::View view(&buf[0]);
+	EXPECT_EQ(view.getRollPI(2), 1.5);
+	EXPECT_EQ(view.getMaxAxisLock(), 30);
+	EXPECT_EQ(view.getVbarPiroComp(), StabilizationSettings::VBARPIROCOMP_TRUE);
+
+	StabilizationSettings::DataFields copy = view.getData();
+	EXPECT_EQ(copy.RollPI[2], 1.5);
+}
+
+TEST(UAVObjField, viewLittleEndian)
+{
+	// Hand built wire image: CoordID, MaxRFPower, MinChannel, MaxChannel
+	const uint8_t wire[] = { 0x78, 0x56, 0x34, 0x12, OPLinkSettings::MAXRFPOWER_125, 10, 250 };
+	ASSERT_EQ(sizeof(wire), size_t(OPLinkSettings::NUMBYTES));
+
+	OPLinkSettings::View view(wire);
+	EXPECT_EQ(view.getCoordID(), 0x12345678u);
+
+	OPLinkSettings::DataFields data = view.getData();
+	EXPECT_EQ(data.CoordID, 0x12345678u);
+	EXPECT_EQ(data.MaxRFPower, OPLinkSettings::MAXRFPOWER_125);
+	EXPECT_EQ(data.MinChannel, 10);
+	EXPECT_EQ(data.MaxChannel, 250);
+}
+
+TEST(UAVObjField, codec)
+{
+	// Wire format is little endian on any host
+	uint32_t coordID = 0x12345678;
+	uint8_t wire[sizeof(coordID)];
+	UAVObjectCodec::pack(wire, &coordID, 1);
+	EXPECT_EQ(wire[0], 0x78);
+	EXPECT_EQ(wire[3], 0x12);
+
+	uint16_t words[3] = { 0x0102, 0x0304, 0x0506 };
+	UAVObjectCodec::ByteSwap<2>::apply(reinterpret_cast<uint8_t *>(words), 3);
+	EXPECT_EQ(words[0], 0x0201);
+	EXPECT_EQ(words[2], 0x0605);
+
+	// Round trip through the wire format
+	OPLinkSettings oplink;
+	OPLinkSettings::DataFields data = oplink.getData();
+	data.CoordID = coordID;
+	data.MaxChannel = 250;
+
+	std::vector<uint8_t> buf(OPLinkSettings::NUMBYTES);
+	OPLinkSettings::PackData(data, &buf[0]);
+	EXPECT_EQ(buf[0], 0x78);
+	EXPECT_EQ(buf[OPLinkSettings::NUMBYTES - 1], 250);
+
+	OPLinkSettings::DataFields copy;
+	OPLinkSettings::UnpackData(&buf[0], copy);
+	EXPECT_EQ(copy.CoordID, coordID);
+	EXPECT_EQ(copy.MaxChannel, 250);
+	EXPECT_EQ(oplink.deserialize(&buf[0]), ssize_t(OPLinkSettings::NUMBYTES));
+	EXPECT_EQ(oplink.getData().CoordID, coordID);
+}
+
+TEST(UAVObjField, metadataCodec)
+{
+	UAVObjectManager mngr;
+	UAVObjectsInitialize(&mngr);
+
+	UAVMetaObject *meta = StabilizationSettings::GetInstance(&mngr)->getMetaObject();
+	ASSERT_NE(meta, (void*)NULL);
+	UAVObject::Metadata mdata = meta->getData();
+	mdata.flags = 0x5a;
+	mdata.flightTelemetryUpdatePeriod = 0x0102;
+	mdata.gcsTelemetryUpdatePeriod = 0x0304;
+	mdata.loggingUpdatePeriod = 0x0506;
+	meta->setData(mdata);
+
+	// flags, then the periods little endian
+	const uint8_t expected[] = { 0x5a, 0x02, 0x01, 0x04, 0x03, 0x06, 0x05 };
+	uint8_t wire[sizeof(expected)];
+	EXPECT_EQ(meta->serialize(wire), ssize_t(sizeof(expected)));
+	EXPECT_EQ(memcmp(wire, expected, sizeof(expected)), 0);
+
+	const uint8_t update[] = { 0x21, 0xe8, 0x03, 0x00, 0x00, 0x10, 0x27 };
+	EXPECT_EQ(meta->deserialize(update), ssize_t(sizeof(update)));
+	mdata = meta->getData();
+	EXPECT_EQ(mdata.flags, 0x21);
+	EXPECT_EQ(mdata.flightTelemetryUpdatePeriod, 1000);
+	EXPECT_EQ(mdata.gcsTelemetryUpdatePeriod, 0);
+	EXPECT_EQ(mdata.loggingUpdatePeriod, 10000);
+}
+
+struct KindVisitor {
+	std::vector<std::string> visited;
+
+	void operator()(UAVMetaObject *obj) { visited.push_back("meta"); }
+	void operator()(StabilizationSettings *obj) { visited.push_back("stab"); }
+	void operator()(AccessoryDesired *obj) { visited.push_back("accessory"); }
+	template<class T>
+	void operator()(T *obj) { visited.push_back("other"); }
+};
+
+TEST(UAVObjManager, kindDispatch)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitialize(&objMngr);
+
+	UAVObject *stab = objMngr.getObject(StabilizationSettings::OBJID);
+	UAVObject *meta = objMngr.getObject(StabilizationSettings::OBJID + 1);
+	ASSERT_TRUE(stab != NULL);
+	ASSERT_TRUE(meta != NULL);
+
+	EXPECT_EQ(stab->getKind(), UAVObject::KIND_DATA);
+	EXPECT_EQ(meta->getKind(), UAVObject::KIND_META);
+	EXPECT_EQ(UAVDataObject::cast(stab), stab);
+	EXPECT_TRUE(UAVDataObject::cast(meta) == NULL);
+	EXPECT_EQ(UAVMetaObject::cast(meta), meta);
+	EXPECT_TRUE(UAVMetaObject::cast(stab) == NULL);
+	EXPECT_EQ(StabilizationSettings::GetInstance(&objMngr), stab);
+
+	KindVisitor visitor;
+	EXPECT_TRUE(UAVObjectsVisit(stab, visitor));
+	EXPECT_TRUE(UAVObjectsVisit(meta, visitor));
+	EXPECT_TRUE(UAVObjectsVisit(objMngr.getObject(AccessoryDesired::OBJID), visitor));
+	EXPECT_TRUE(UAVObjectsVisit(objMngr.getObject(FlightStatus::OBJID), visitor));
+	EXPECT_FALSE(UAVObjectsVisit(NULL, visitor));
+
+	ASSERT_EQ(visitor.visited.size(), 4);
+	EXPECT_EQ(visitor.visited[0], "stab");
+	EXPECT_EQ(visitor.visited[1], "meta");
+	EXPECT_EQ(visitor.visited[2], "accessory");
+	EXPECT_EQ(visitor.visited[3], "other");
+}
+
+TEST(UAVObjManager, lazyTypes)
+{
+	UAVObjectManager objMngr;
+	UAVObjectsInitializeLazy(&objMngr);
+
+	uint32_t types = objMngr.getNumLazyTypes();
+	EXPECT_GT(types, 0);
+	EXPECT_EQ(objMngr.getObjects().size(), 0);
+	EXPECT_EQ(objMngr.getNumTypes(), 0);
+
+	newobj = 0;
+	objMngr.newObject.connect(newObject);
+
+	// first use creates object and metaobject
+	StabilizationSettings *stab = StabilizationSettings::GetInstance(&objMngr);
+	ASSERT_TRUE(stab != NULL);
+	EXPECT_EQ(newobj, 2);
+	EXPECT_EQ(objMngr.getObjects().size(), 2);
+	EXPECT_EQ(objMngr.getNumLazyTypes(), types - 1);
+	EXPECT_EQ(StabilizationSettings::GetInstance(&objMngr), stab);
+	EXPECT_EQ(newobj, 2);
+
+	// metaobject ID (e.g. received frame) and name lookup
+	UAVObject *meta = objMngr.getObject(uint32_t(FlightStatus::OBJID) + 1);
+	ASSERT_TRUE(meta != NULL);
+	EXPECT_TRUE(meta->isMetaObject());
+	EXPECT_EQ(UAVMetaObject::cast(meta)->getParentObject(), objMngr.getObject(FlightStatus::OBJID));
+	EXPECT_TRUE(objMngr.getObject("AttitudeStateMeta") != NULL);
+	EXPECT_EQ(objMngr.getNumInstances("AccessoryDesired"), 1);
+	EXPECT_EQ(newobj, 8);
+	EXPECT_EQ(objMngr.getNumLazyTypes(), types - 4);
+
+	// unknown ID is not created
+	EXPECT_TRUE(objMngr.getObject(0x12345678) == NULL);
+	EXPECT_EQ(objMngr.getNumTypes(), 8);
+
+	// directly registered object replaces the lazy type
+	objMngr.registerObject(new ObjectPersistence());
+	EXPECT_EQ(objMngr.getNumLazyTypes(), types - 5);
+	EXPECT_EQ(objMngr.getNumInstances(ObjectPersistence::OBJID), 1);
+
+	objMngr.newObject.disconnect(newObject);
+}
+
+TEST(UAVObjManager, poolAllocation)
+{
+	typedef boost::singleton_pool<AccessoryDesired, sizeof(AccessoryDesired)> obj_pool;
+	typedef boost::singleton_pool<UAVMetaObject, sizeof(UAVMetaObject)> meta_pool;
+
+	UAVObjectManager objMngr;
+	AccessoryDesired *obj = new AccessoryDesired();
+	objMngr.registerObject(obj);
+	UAVObject *inst = objMngr.getObject(AccessoryDesired::OBJID, 0);
+	objMngr.registerObject(obj->clone(1));
+
+	EXPECT_TRUE(obj_pool::is_from(inst));
+	EXPECT_TRUE(obj_pool::is_from(objMngr.getObject(AccessoryDesired::OBJID, 1)));
+	EXPECT_TRUE(meta_pool::is_from(objMngr.getObject(AccessoryDesired::OBJID + 1)));
+
+	// freed chunk is reused
+	void *chunk = AccessoryDesired::operator new(sizeof(AccessoryDesired));
+	AccessoryDesired::operator delete(chunk, sizeof(AccessoryDesired));
+	void *reused = AccessoryDesired::operator new(sizeof(AccessoryDesired));
+	EXPECT_EQ(reused, chunk);
+	AccessoryDesired::operator delete(reused, sizeof(AccessoryDesired));
+}
+
 int main(int argc, char **argv){
 	testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -8,12 +8,20 @@
 #include "uavobjectsinit.h"
 #include "telemetrymanager.h"
 #include "uavtalkrelay.h"
+#include "autopilotemulator.h"
 #include "iodrivers/uavtalkserialio.h"
-#include "iodrivers/uavtalkudpio.h"
+#include "iodrivers/uavtalkptyio.h"
+#include "iodrivers/uavtalkimpairio.h"
 #include "systemstats.h"
 #include "flightstatus.h"
 #include "flighttelemetrystats.h"
 #include "gcstelemetrystats.h"
+#include "accessorydesired.h"
+#include "oplinksettings.h"
+#include "stabilizationsettings.h"
+#include "uavtalklogdecoder.h"
+#include <fstream>
+#include <dirent.h>
 
 
 using namespace openpilot;
@@ -21,9 +29,16 @@ using namespace openpilot;
 
 UAVObjectManager *objMngr;
 TelemetryManager *telMngr;
+LatencyTracer *tracer;
+
+// autopilot side
+UAVObjectManager *apObjMngr;
+UAVTalkPtyIO *pty;
+AutopilotEmulator *autopilot;
 
 boost::recursive_timed_mutex mutex;
 int updated, upauto, upmanual, upreq, newobj, newinst, bind_updated;
+int connected, completed, failed;
 
 
 void objUpdated(UAVObject *obj)
@@ -94,6 +109,8 @@ void newInstance(UAVObject *obj)
 
 void telConnected(void)
 {
+	boost::recursive_timed_mutex::scoped_lock lock(mutex);
+	connected++;
 	std::cout << "[telemetry manager] connected" << std::endl;
 }
 
@@ -102,11 +119,481 @@ void telDisconnected(void)
 	std::cout << "[telemetry manager] disconnected" << std::endl;
 }
 
+void transCompleted(UAVObject *obj, bool success)
+{
+	boost::recursive_timed_mutex::scoped_lock lock(mutex);
+	if (success)
+		completed++;
+	else
+		failed++;
+	std::cout << "[Transaction " << (success ? "completed" : "failed") << "] " << obj->toString();
+}
+
+/** Wait until counter reaches value
+ */
+bool waitFor(int *counter, int value, int timeout_ms)
+{
+	boost::system_time t = boost::get_system_time() +
+		boost::posix_time::milliseconds(timeout_ms);
+
+	while (boost::get_system_time() < t) {
+		{
+			boost::recursive_timed_mutex::scoped_lock lock(mutex);
+			if (*counter >= value)
+				return true;
+		}
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+	}
+
+	return false;
+}
+
+TEST(LatencyTracer, histogram)
+{
+	LatencyHistogram hist;
+
+	EXPECT_EQ(hist.getPercentile(50), 0);
+
+	// 1 us .. 10 ms
+	for (uint64_t v = 1; v <= 10000; ++v)
+		hist.record(v * 1000);
+
+	EXPECT_EQ(hist.getCount(), 10000);
+	EXPECT_EQ(hist.getMin(), 1000);
+	EXPECT_EQ(hist.getMax(), 10000000);
+	EXPECT_EQ(hist.getMean(), 5000500);
+
+	// HDR-style bucket error is under 1/32
+	EXPECT_NEAR(hist.getPercentile(50), 5000000, 5000000 / 32);
+	EXPECT_NEAR(hist.getPercentile(99), 9900000, 9900000 / 32);
+	EXPECT_NEAR(hist.getPercentile(99.9), 9990000, 9990000 / 32);
+	EXPECT_EQ(hist.getPercentile(100), 10000000);
+
+	hist.record(~uint64_t(0));
+	EXPECT_EQ(hist.getMax(), LatencyHistogram::MAX_VALUE);
+}
+
+static void countBytes(LinkCounters *counters, int n)
+{
+	for (int i = 0; i < n; ++i)
+		counters->add(LinkCounters::RX_BYTES, 3);
+}
+
+TEST(LinkCounters, threads)
+{
+	const int THREADS = 12;
+	const int COUNT = 100000;
+	LinkCounters counters;
+	boost::thread_group threads;
+
+	for (int n = 0; n < THREADS; ++n)
+		threads.create_thread(boost::bind(countBytes, &counters, COUNT));
+	threads.join_all();
+
+	EXPECT_EQ(counters.get(LinkCounters::RX_BYTES), uint64_t(3) * THREADS * COUNT);
+	EXPECT_EQ(counters.get(LinkCounters::TX_BYTES), 0);
+}
+
+static uint32_t testRandom(uint32_t &seed)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void appendLE(std::vector<uint8_t> &out, uint64_t value, size_t size)
+{
+	for (size_t n = 0; n < size; ++n)
+		out.push_back((value >> (8 * n)) & 0xFF);
+}
+
+/** Append UAVTalk frame: sync, type, size, object ID, [instance ID], data, CRC-8
+ */
+static void appendFrame(std::vector<uint8_t> &out, uint8_t type, uint32_t objId, bool multiInst, uint16_t instId,
+		const std::vector<uint8_t> &data)
+{
+	size_t start = out.size();
+
+	out.push_back(0x3C);
+	out.push_back(type);
+	appendLE(out, 8 + (multiInst ? 2 : 0) + data.size(), 2);
+	appendLE(out, objId, 4);
+	if (multiInst)
+		appendLE(out, instId, 2);
+	out.insert(out.end(), data.begin(), data.end());
+
+	uint8_t crc = 0;
+	for (size_t n = start; n < out.size(); ++n) {
+		crc ^= out[n];
+		for (int bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : (crc << 1);
+	}
+	out.push_back(crc);
+}
+
+TEST(UAVTalkLogDecoder, chunks)
+{
+	const char *path = "test_uavtalk-capture.opl";
+	const uint8_t TYPE_OBJ = 0x20, TYPE_OBJ_REQ = 0x21;
+	uint32_t seed = 42;
+	UAVObjectManager decMngr;
+	UAVObjectsInitialize(&decMngr);
+
+	// Two object requests planted in settings payloads: a valid frame pair
+	// inside a frame, i.e. a false chunk boundary
+	std::vector<uint8_t> fake;
+	appendFrame(fake, TYPE_OBJ_REQ, SystemStats::OBJID, false, 0, std::vector<uint8_t>());
+	appendFrame(fake, TYPE_OBJ_REQ, SystemStats::OBJID, false, 0, std::vector<uint8_t>());
+	ASSERT_LE(fake.size() + 2, size_t(StabilizationSettings::NUMBYTES));
+
+	std::vector<uint8_t> stream;
+	std::vector<size_t> offsets;
+	size_t garbage = 0;
+	while (stream.size() < 1200 * 1024) {
+		// garbage between frames, without sync bytes
+		for (size_t n = testRandom(seed) % 8; n > 0; --n, ++garbage)
+			stream.push_back(testRandom(seed) % 0x3C);
+
+		std::vector<uint8_t> data;
+		offsets.push_back(stream.size());
+		switch (testRandom(seed) % 3) {
+		case 0:
+			for (size_t n = 0; n < SystemStats::NUMBYTES; ++n)
+				data.push_back(testRandom(seed));
+			appendFrame(stream, TYPE_OBJ, SystemStats::OBJID, false, 0, data);
+			break;
+		case 1:
+			for (size_t n = 0; n < AccessoryDesired::NUMBYTES; ++n)
+				data.push_back(testRandom(seed));
+			appendFrame(stream, TYPE_OBJ, AccessoryDesired::OBJID, true, testRandom(seed) % 4, data);
+			break;
+		default:
+			data.assign(2, 0x3C);
+			data.insert(data.end(), fake.begin(), fake.end());
+			data.resize(StabilizationSettings::NUMBYTES, 0x3C);
+			appendFrame(stream, TYPE_OBJ, StabilizationSettings::OBJID, false, 0, data);
+			break;
+		}
+	}
+
+	// OPL records cut the stream at arbitrary points
+	std::vector<uint8_t> file;
+	std::vector<std::pair<size_t, uint32_t> > times;
+	uint32_t timestamp = 0;
+	for (size_t pos = 0; pos < stream.size(); ) {
+		size_t size = std::min<size_t>(1 + testRandom(seed) % 300, stream.size() - pos);
+		timestamp += testRandom(seed) % 5;
+		times.push_back(std::make_pair(pos, timestamp));
+		appendLE(file, timestamp, 4);
+		appendLE(file, size, 8);
+		file.insert(file.end(), stream.begin() + pos, stream.begin() + pos + size);
+		pos += size;
+	}
+	std::ofstream(path, std::ios::binary).write((const char *)&file[0], file.size());
+
+	UAVTalkLogDecoder single(&decMngr);
+	ASSERT_TRUE(single.load(path, UAVTalkLogDecoder::FORMAT_OPL));
+	single.decode(1);
+
+	const std::vector<UAVTalkLogDecoder::Record> &expected = single.getRecords();
+	ASSERT_EQ(expected.size(), offsets.size());
+	EXPECT_EQ(single.getStats().badBytes, garbage);
+	for (size_t n = 0, t = 0; n < offsets.size(); ++n) {
+		while (t + 1 < times.size() && times[t + 1].first <= offsets[n])
+			++t;
+		ASSERT_EQ(expected[n].offset, offsets[n]);
+		ASSERT_EQ(expected[n].timestamp, times[t].second);
+	}
+
+	// same records from 16 chunks, some split at the planted frames
+	UAVTalkLogDecoder multi(&decMngr);
+	ASSERT_TRUE(multi.load(path, UAVTalkLogDecoder::FORMAT_OPL));
+	multi.decode(16);
+
+	UAVTalkLogDecoder::Stats stats = multi.getStats();
+	EXPECT_EQ(stats.chunks, 16);
+	EXPECT_GT(stats.redecoded, 0);
+	EXPECT_EQ(stats.badBytes, garbage);
+
+	const std::vector<UAVTalkLogDecoder::Record> &records = multi.getRecords();
+	ASSERT_EQ(records.size(), expected.size());
+	for (size_t n = 0; n < records.size(); ++n) {
+		ASSERT_EQ(records[n].offset, expected[n].offset);
+		EXPECT_EQ(records[n].timestamp, expected[n].timestamp);
+		EXPECT_EQ(records[n].objId, expected[n].objId);
+		EXPECT_EQ(records[n].instId, expected[n].instId);
+		EXPECT_EQ(records[n].length, expected[n].length);
+	}
+
+	std::remove(path);
+}
+
+/** Read and remove dump files <prefix>-<time>-<reason>.log
+ */
+static std::vector<std::string> readDump(const std::string &prefix, const std::string &reason)
+{
+	std::vector<std::string> lines;
+	const std::string suffix = "-" + reason + ".log";
+	DIR *dir = opendir(".");
+	struct dirent *ent;
+
+	while (dir != NULL && (ent = readdir(dir)) != NULL) {
+		std::string name = ent->d_name;
+		if (name.compare(0, prefix.size(), prefix) != 0 || name.size() < prefix.size() + suffix.size() ||
+				name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+			continue;
+
+		std::ifstream in(name.c_str());
+		for (std::string line; std::getline(in, line); )
+			lines.push_back(line);
+		std::remove(name.c_str());
+	}
+
+	if (dir != NULL)
+		closedir(dir);
+	return lines;
+}
+
+TEST(FlightRecorder, dump)
+{
+	const std::string prefix = "test_uavtalk-recorder";
+	const uint8_t data[] = { 1, 2, 3, 4 };
+	std::vector<std::string> lines;
+
+	// ring keeps the last records, destructor waits for the dump
+	{
+		FlightRecorder recorder(8);
+		recorder.setDumpPrefix(prefix);
+		for (uint16_t n = 0; n < 20; ++n)
+			recorder.recordFrame(FlightRecorder::REC_RX_FRAME, 0x20, SystemStats::OBJID, n, data, sizeof(data));
+		recorder.dump("wrap");
+	}
+	lines = readDump(prefix, "wrap");
+	ASSERT_EQ(lines.size(), 1 + 8);
+	EXPECT_NE(lines[1].find(" RX OBJ "), std::string::npos);
+	EXPECT_NE(lines[1].find(" inst 12 len 4 : 01 02 03 04"), std::string::npos);
+	EXPECT_NE(lines[8].find(" inst 19 "), std::string::npos);
+
+	// only records of the last window are written
+	{
+		FlightRecorder recorder(64);
+		recorder.setDumpPrefix(prefix);
+		recorder.setWindow(100);
+		for (uint16_t n = 0; n < 8; ++n) {
+			if (n == 5)
+				boost::this_thread::sleep(boost::posix_time::milliseconds(300));
+			recorder.recordFrame(FlightRecorder::REC_TX_FRAME, 0x22, SystemStats::OBJID, n, data, sizeof(data));
+		}
+		recorder.dump("window");
+	}
+	lines = readDump(prefix, "window");
+	ASSERT_EQ(lines.size(), 1 + 3);
+	EXPECT_NE(lines[1].find(" TX OBJ_ACK "), std::string::npos);
+	EXPECT_NE(lines[1].find(" inst 5 "), std::string::npos);
+
+	// disconnect dumps by itself
+	{
+		FlightRecorder recorder(64);
+		recorder.setDumpPrefix(prefix);
+		recorder.recordEvent(FlightRecorder::EV_CONNECTED);
+		recorder.recordFrame(FlightRecorder::REC_RX_FRAME, 0x20, SystemStats::OBJID, 0, data, sizeof(data));
+		recorder.recordEvent(FlightRecorder::EV_DISCONNECTED);
+	}
+	lines = readDump(prefix, "disconnect");
+	ASSERT_EQ(lines.size(), 1 + 3);
+	EXPECT_NE(lines[0].find("disconnect, 3 records"), std::string::npos);
+	EXPECT_NE(lines[1].find(" EV CONNECTED"), std::string::npos);
+	EXPECT_NE(lines[3].find(" EV DISCONNECTED"), std::string::npos);
+}
+
+/** Collects written bytes
+ */
+class BufferIO : public UAVTalkIOBase {
+public:
+	void write(const uint8_t *data, size_t length)
+	{
+		boost::mutex::scoped_lock lock(bufferMutex);
+		buffer.insert(buffer.end(), data, data + length);
+	}
+
+	bool is_open() { return true; }
+
+	std::vector<uint8_t> getBuffer()
+	{
+		boost::mutex::scoped_lock lock(bufferMutex);
+		return buffer;
+	}
+
+private:
+	boost::mutex bufferMutex;
+	std::vector<uint8_t> buffer;
+};
+
+static std::vector<uint8_t> impairedStream(uint32_t seed, const UAVTalkImpairIO::Impairment &imp,
+		const std::vector<uint8_t> &stream, UAVTalkImpairIO::ImpairStats *stats = NULL)
+{
+	BufferIO dev;
+	UAVTalkImpairIO impair(&dev, seed);
+
+	impair.setImpairment(UAVTalkImpairIO::DIR_TX, imp);
+	for (size_t pos = 0; pos < stream.size(); pos += 64)
+		impair.write(&stream[pos], std::min<size_t>(64, stream.size() - pos));
+
+	if (stats != NULL)
+		*stats = impair.getImpairStats(UAVTalkImpairIO::DIR_TX);
+	return dev.getBuffer();
+}
+
+TEST(UAVTalkImpairIO, errors)
+{
+	UAVTalkImpairIO::Impairment imp = UAVTalkImpairIO::Impairment();
+	imp.bitErrorRate = 1e-3;
+	imp.dropRate = 1e-2;
+
+	std::vector<uint8_t> stream(1000000);
+	uint32_t seed = 1;
+	for (size_t n = 0; n < stream.size(); ++n)
+		stream[n] = testRandom(seed);
+
+	// same seed, same damage
+	UAVTalkImpairIO::ImpairStats stats;
+	std::vector<uint8_t> out = impairedStream(7, imp, stream, &stats);
+	EXPECT_TRUE(out == impairedStream(7, imp, stream));
+	EXPECT_FALSE(out == impairedStream(8, imp, stream));
+
+	// rates within 5% (about 5 sigma)
+	EXPECT_EQ(stats.bytes, stream.size());
+	EXPECT_EQ(out.size(), stream.size() - stats.bytesDropped);
+	EXPECT_NEAR(stats.bytesDropped, stream.size() * imp.dropRate, stream.size() * imp.dropRate * 0.05);
+	EXPECT_NEAR(stats.bitsFlipped, out.size() * 8 * imp.bitErrorRate, out.size() * 8 * imp.bitErrorRate * 0.05);
+
+	// without drops, flipped bits are the difference to the input
+	imp.dropRate = 0;
+	out = impairedStream(7, imp, stream, &stats);
+	ASSERT_EQ(out.size(), stream.size());
+	uint32_t flipped = 0;
+	for (size_t n = 0; n < out.size(); ++n)
+		flipped += __builtin_popcount(out[n] ^ stream[n]);
+	EXPECT_EQ(flipped, stats.bitsFlipped);
+}
+
+TEST(UAVTalkImpairIO, delay)
+{
+	UAVTalkImpairIO::Impairment imp = UAVTalkImpairIO::Impairment();
+	imp.latencyMs = 50;
+	imp.baudrate = 19200;	// 480 bytes take 250 ms
+
+	BufferIO dev;
+	UAVTalkImpairIO impair(&dev, 0);
+	impair.setImpairment(UAVTalkImpairIO::DIR_TX, imp);
+
+	std::vector<uint8_t> data(480, 0x55);
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	impair.write(&data[0], data.size());
+	EXPECT_TRUE(dev.getBuffer().empty());
+
+	while (dev.getBuffer().size() < data.size() &&
+			boost::posix_time::microsec_clock::universal_time() - start < boost::posix_time::seconds(2))
+		boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+	EXPECT_TRUE(dev.getBuffer() == data);
+	EXPECT_GE(elapsed.total_milliseconds(), 300 - 5);
+	EXPECT_LT(elapsed.total_milliseconds(), 1000);
+}
+
+/** Records first byte of each written frame
+ */
+class CaptureIO : public UAVTalkIOBase {
+public:
+	void write(const uint8_t *data, size_t length)
+	{
+		boost::mutex::scoped_lock lock(captureMutex);
+		tags.push_back(data[0]);
+	}
+
+	bool is_open() { return true; }
+
+	std::vector<uint8_t> getTags()
+	{
+		boost::mutex::scoped_lock lock(captureMutex);
+		return tags;
+	}
+
+private:
+	boost::mutex captureMutex;
+	std::vector<uint8_t> tags;
+};
+
+TEST(TrafficShaper, priorities)
+{
+	const size_t FRAME_LENGTH = 100;
+	const size_t FRAMES = 36;	// below queue limit
+	const size_t TOTAL = 2 * FRAMES + 2;
+	CaptureIO capture;
+	std::vector<uint8_t> frame(FRAME_LENGTH);
+	std::vector<uint8_t> tags;
+
+	// 11520 bytes/s
+	TrafficShaper shaper(&capture, 115200);
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+	// Telemetry and settings flood, then handshake and ack
+	for (size_t n = 0; n < FRAMES; ++n) {
+		frame[0] = TrafficShaper::CLASS_BULK;
+		EXPECT_TRUE(shaper.enqueue(TrafficShaper::CLASS_BULK, &frame[0], frame.size()));
+		frame[0] = TrafficShaper::CLASS_SETTINGS;
+		EXPECT_TRUE(shaper.enqueue(TrafficShaper::CLASS_SETTINGS, &frame[0], frame.size()));
+	}
+	frame[0] = TrafficShaper::CLASS_CONTROL;
+	EXPECT_TRUE(shaper.enqueue(TrafficShaper::CLASS_CONTROL, &frame[0], frame.size()));
+	frame[0] = TrafficShaper::CLASS_ACK;
+	EXPECT_TRUE(shaper.enqueue(TrafficShaper::CLASS_ACK, &frame[0], frame.size()));
+
+	for (int n = 0; n < 300 && tags.size() < TOTAL; ++n) {
+		boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		tags = capture.getTags();
+	}
+	boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+	ASSERT_EQ(tags.size(), TOTAL);
+
+	// Released at link rate, after the initial burst
+	const double burst = 2 * TrafficShaper::MAX_FRAME_LENGTH;
+	EXPECT_GE(elapsed.total_milliseconds(), (TOTAL * FRAME_LENGTH - burst) / 11520 * 1000 * 0.9);
+
+	// Strict classes go right after frames released before they were queued
+	size_t control = std::find(tags.begin(), tags.end(), TrafficShaper::CLASS_CONTROL) - tags.begin();
+	size_t ack = std::find(tags.begin(), tags.end(), TrafficShaper::CLASS_ACK) - tags.begin();
+	EXPECT_LE(control, burst / FRAME_LENGTH + 1);
+	EXPECT_EQ(ack, control + 1);
+
+	// Bulk has three times the weight of settings
+	int bulk = 0, weighted = 0;
+	for (size_t n = 0; n < tags.size() && weighted < 40; ++n) {
+		if (tags[n] == TrafficShaper::CLASS_BULK || tags[n] == TrafficShaper::CLASS_SETTINGS) {
+			weighted++;
+			bulk += (tags[n] == TrafficShaper::CLASS_BULK);
+		}
+	}
+	EXPECT_GE(bulk, 26);
+	EXPECT_LE(bulk, 34);
+
+	TrafficShaper::ClassStats stats = shaper.getClassStats(TrafficShaper::CLASS_BULK);
+	EXPECT_EQ(stats.frames, FRAMES);
+	EXPECT_EQ(stats.bytes, FRAMES * FRAME_LENGTH);
+	EXPECT_EQ(stats.queuedBytes, 0);
+	EXPECT_EQ(stats.dropped, 0);
+
+	// Queue limit
+	TrafficShaper::ClassConfig config = shaper.getClassConfig(TrafficShaper::CLASS_BULK);
+	std::vector<uint8_t> big(config.queueLimit + 1);
+	EXPECT_FALSE(shaper.enqueue(TrafficShaper::CLASS_BULK, &big[0], big.size()));
+	EXPECT_EQ(shaper.getClassStats(TrafficShaper::CLASS_BULK).dropped, 1);
+}
+
 TEST(UAVTalkManager, init_talk)
 {
-	boost::system_time t;
 	objMngr = new UAVObjectManager();
-
 	UAVObjectsInitialize(objMngr);
 
 	objMngr->newObject.connect(newObject);
@@ -115,11 +602,6 @@ TEST(UAVTalkManager, init_talk)
 	SystemStats *sysSts = SystemStats::GetInstance(objMngr, 0);
 	sysSts->objectUpdated.connect(objUpdated);
 
-	//UAVObject::Metadata mdata = sysSts->getMetadata();
-	//mdata.gcsTelemetryUpdatePeriod = 500;
-	//UAVObject::SetGcsTelemetryUpdateMode(mdata, UAVObject::UPDATEMODE_PERIODIC);
-	//sysSts->setMetadata(mdata);
-
 	FlightStatus *flSt = FlightStatus::GetInstance(objMngr, 0);
 	flSt->objectUpdated.connect(objUpdated);
 
@@ -129,22 +611,126 @@ TEST(UAVTalkManager, init_talk)
 	GCSTelemetryStats *gcsSts = GCSTelemetryStats::GetInstance(objMngr, 0);
 	gcsSts->objectUpdated.connect(objUpdated);
 
-	UAVTalkSerialIO *ser = new UAVTalkSerialIO("/dev/ttyUSB0", 57600);
-	//ser->write((const uint8_t *)"some crap for write debugging", 29);
+	// Autopilot emulator on the master side of pty
+	apObjMngr = new UAVObjectManager();
+	UAVObjectsInitialize(apObjMngr);
+	pty = new UAVTalkPtyIO();
+	autopilot = new AutopilotEmulator(pty, apObjMngr);
+
+	UAVTalkSerialIO *ser = new UAVTalkSerialIO(pty->getSlaveName(), 57600);
 	telMngr = new TelemetryManager(objMngr);
+	tracer = new LatencyTracer(objMngr);
+	telMngr->setLatencyTracer(tracer);
 	telMngr->connected.connect(telConnected);
 	telMngr->disconnected.connect(telDisconnected);
 	telMngr->start(ser);
 
-	UAVTalkUDPIO *udp = new UAVTalkUDPIO("any-todo", 9000);
-	UAVTalkRelay *relay = new UAVTalkRelay(udp, objMngr);
+	EXPECT_TRUE(waitFor(&connected, 1, 15000));
+	EXPECT_TRUE(telMngr->isConnected());
+	EXPECT_TRUE(autopilot->isConnected());
+	EXPECT_GT(autopilot->getEmulatorStats().objectRequests, 0);
+}
+
+TEST(UAVTalkManager, stream)
+{
+	int start = updated;
+
+	autopilot->setStream(SystemStats::OBJID, 50);
+	EXPECT_TRUE(waitFor(&updated, start + 25, 2000));
+	autopilot->setStream(SystemStats::OBJID, 0);
+
+	LatencyTracer::Stats total, dispatch;
+	ASSERT_TRUE(tracer->getStats(SystemStats::OBJID, LatencyTracer::STAGE_TOTAL, total));
+	ASSERT_TRUE(tracer->getStats(SystemStats::OBJID, LatencyTracer::STAGE_DISPATCH, dispatch));
+	EXPECT_GT(total.count, 10);
+	EXPECT_EQ(total.count, dispatch.count);
+	EXPECT_LE(total.min, total.p50);
+	EXPECT_LE(total.p50, total.p99);
+	EXPECT_LE(total.p99, total.max);
+	EXPECT_GE(total.max, dispatch.max);
+
+	TrafficStats::ObjectStats traffic;
+	ASSERT_TRUE(telMngr->getTrafficStats()->getObjectStats(SystemStats::OBJID, traffic));
+	EXPECT_GE(traffic.rxFrames, total.count);
+	EXPECT_EQ(traffic.rxBytes, traffic.rxFrames * (8 + SystemStats::NUMBYTES + 1));
+	EXPECT_EQ(traffic.rxErrors, 0);
+	EXPECT_GT(traffic.rxRate, 25);
+	EXPECT_LT(traffic.rxRate, 100);
+
+	tracer->dump(std::cout);
+}
+
+TEST(UAVTalkManager, object_request)
+{
+	SystemStats *sysSts = SystemStats::GetInstance(objMngr, 0);
+	OPLinkSettings *oplSts = OPLinkSettings::GetInstance(objMngr, 0);
+
+	sysSts->transactionCompleted.connect(transCompleted);
+	oplSts->transactionCompleted.connect(transCompleted);
+
+	sysSts->requestUpdate();
+	EXPECT_TRUE(waitFor(&completed, 1, 2000));
+
+	autopilot->setNack(OPLinkSettings::OBJID);
+	oplSts->requestUpdate();
+	EXPECT_TRUE(waitFor(&failed, 1, 2000));
+	EXPECT_EQ(autopilot->getEmulatorStats().nacksSent, 1);
+}
+
+TEST(UAVTalkManager, new_instance)
+{
+	AccessoryDesired *acc = AccessoryDesired::GetInstance(apObjMngr, 0);
+	UAVDataObject *inst = acc->clone(1);
+
+	ASSERT_TRUE(apObjMngr->registerObject(inst));
+	autopilot->sendObject(inst, false, false);
+
+	EXPECT_TRUE(waitFor(&newinst, 1, 2000));
+	EXPECT_TRUE(objMngr->getObject(AccessoryDesired::OBJID, 1) != NULL);
+}
+
+int received, receivedCPULoad, sysUpdated;
+
+void sysStatsUpdated(UAVObject *obj)
+{
+	boost::recursive_timed_mutex::scoped_lock lock(mutex);
+	sysUpdated++;
+}
+
+void objReceived(UAVObject *obj, const uint8_t *data)
+{
+	boost::recursive_timed_mutex::scoped_lock lock(mutex);
+	received++;
+	receivedCPULoad = SystemStats::View(data).getCPULoad();
+}
+
+TEST(UAVTalkManager, uncached_view)
+{
+	SystemStats *apSysSts = SystemStats::GetInstance(apObjMngr, 0);
+	SystemStats::DataFields apData = apSysSts->getData();
+	apData.CPULoad = 42;
+	apSysSts->setData(apData);
+
+	SystemStats *sysSts = SystemStats::GetInstance(objMngr, 0);
+	SystemStats::DataFields before = sysSts->getData();
+	sysSts->setDataCached(false);
+	sysSts->objectReceived.connect(objReceived);
+	sysSts->objectUpdated.connect(sysStatsUpdated);
+
+	autopilot->setStream(SystemStats::OBJID, 50);
+	EXPECT_TRUE(waitFor(&received, 10, 2000));
+	autopilot->setStream(SystemStats::OBJID, 0);
+	boost::this_thread::sleep(boost::posix_time::milliseconds(100));
 
-	while(true) {};
+	sysSts->objectReceived.disconnect(objReceived);
+	sysSts->objectUpdated.disconnect(sysStatsUpdated);
+	sysSts->setDataCached(true);
 
-	t = boost::get_system_time() +
-		boost::posix_time::milliseconds(10000);
-	mutex.timed_lock(t);
-	EXPECT_GT(newinst, 0);
+	// Read from the frame, object is not touched
+	boost::recursive_timed_mutex::scoped_lock lock(mutex);
+	EXPECT_EQ(receivedCPULoad, 42);
+	EXPECT_EQ(sysUpdated, 0);
+	EXPECT_EQ(sysSts->getData().CPULoad, before.CPULoad);
 }
 
 int main(int argc, char **argv){